@@ -29,6 +29,12 @@ const char MAIN_page[] PROGMEM = R"=====(
       <div class="card">
         <p style="color:rgb(10, 66, 64);">DISK SPACE REMAINING</p><p><span class="reading"><span id="disk">%DISKSPACE%</span> Bytes</span></p>
       </div>
+      <div class="card">
+        <p style="color:rgb(10, 66, 64);">REPAIRED AT BOOT</p><p><span class="reading"><span id="rep">%REPAIRED%</span></span></p>
+      </div>
+      <div class="card">
+        <p style="color:rgb(10, 66, 64);">LAST RECORDING</p><p><span class="reading"><span id="last">%LASTRECORDING%</span></span></p>
+      </div>
       <div class="card">
         <p style="color:rgb(10, 66, 64);">RUN TIME</p>
         <p><span class="reading">
@@ -70,6 +76,16 @@ if (!!window.EventSource) {
   document.getElementById("disk").innerHTML = formatBytes(e.data);
  }, false);
 
+ source.addEventListener('repaired', function(e) {
+  console.log("repaired", e.data);
+  document.getElementById("rep").innerHTML = e.data;
+ }, false);
+
+ source.addEventListener('lastrecording', function(e) {
+  console.log("lastrecording", e.data);
+  document.getElementById("last").innerHTML = e.data;
+ }, false);
+
  source.addEventListener('runtime', function(e) {
   console.log("runtime", e.data);
   document.getElementById("rt").innerHTML = e.data;
@@ -32,6 +32,7 @@
 
 static String processor(const String &var);
 static void send_events_to_web_client(void);
+static String last_recording_text(void);
 
 // Teensy UART communications setup
 // Define the RX pin for Serial
@@ -44,6 +45,13 @@ typedef struct __attribute__((packed, aligned(1))) {
     uint8_t mode;
     uint16_t recordings;
     uint64_t disk_remaining;
+    uint16_t repaired;        // Recordings repaired at boot after a power cut
+    uint32_t recovery_millis; // Time taken by the boot catalogue/recovery pass
+    uint16_t last_number;     // Levels of the last recording made, dB/LUFS x 100
+    int16_t last_rms;
+    int16_t last_peak;
+    int16_t last_loudness;
+    uint32_t last_clipped;    // Samples at full scale
 } teensy_data_t;
 
 teensy_data_t audio_guestbook_data;
@@ -190,6 +198,13 @@ void setup() {
 
     audio_guestbook_data.disk_remaining = 0;
     audio_guestbook_data.recordings = 0;
+    audio_guestbook_data.repaired = 0;
+    audio_guestbook_data.recovery_millis = 0;
+    audio_guestbook_data.last_number = 0;
+    audio_guestbook_data.last_rms = 0;
+    audio_guestbook_data.last_peak = 0;
+    audio_guestbook_data.last_loudness = 0;
+    audio_guestbook_data.last_clipped = 0;
     audio_guestbook_data.mode = INITIALISING;
 }
 
@@ -254,6 +269,15 @@ void loop() {
                             Serial.print("   ");
                             Serial.print("Disk Remaining = ");
                             Serial.print(audio_guestbook_data.disk_remaining);
+                            Serial.print("   ");
+                            Serial.print("Repaired = ");
+                            Serial.print(audio_guestbook_data.repaired);
+                            Serial.print(" (");
+                            Serial.print(audio_guestbook_data.recovery_millis);
+                            Serial.print(" ms)");
+                            Serial.print("   ");
+                            Serial.print("Last recording = ");
+                            Serial.print(last_recording_text());
                             Serial.println(' ');
                             Serial.println("===========================");
                         }
@@ -292,6 +316,10 @@ static String processor(const String &var) {
         }
     } else if (var == "RECORDINGS") {
         return String(audio_guestbook_data.recordings);
+    } else if (var == "REPAIRED") {
+        return String(audio_guestbook_data.repaired) + " in " + String(audio_guestbook_data.recovery_millis) + " ms";
+    } else if (var == "LASTRECORDING") {
+        return last_recording_text();
     } else if (var == "RUNTIME") {
         return String(runtime_buffer);
     }
@@ -321,6 +349,9 @@ static void send_events_to_web_client(void) {
     }
 
     events.send(String(audio_guestbook_data.recordings).c_str(), "recordings", millis());
+    events.send((String(audio_guestbook_data.repaired) + " in " + String(audio_guestbook_data.recovery_millis) + " ms").c_str(),
+                "repaired", millis());
+    events.send(last_recording_text().c_str(), "lastrecording", millis());
 
     // So the user knows the application is still running!
     last_time = millis();
@@ -334,4 +365,21 @@ static void send_events_to_web_client(void) {
     }
 
     events.send(String(runtime_buffer), "runtime", millis());
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Levels of the last recording made, so clipped or silent messages are spotted straight away.
+ */
+static String last_recording_text(void) {
+    if (audio_guestbook_data.last_number == 0 && audio_guestbook_data.last_loudness == 0) {
+        return "None yet";
+    }
+
+    String text = "#" + String(audio_guestbook_data.last_number) + ": " +
+                  String(audio_guestbook_data.last_loudness / 100.0, 1) + " LUFS, peak " +
+                  String(audio_guestbook_data.last_peak / 100.0, 1) + " dBFS";
+    if (audio_guestbook_data.last_clipped > 0) {
+        text += ", CLIPPED (" + String(audio_guestbook_data.last_clipped) + " samples)";
+    }
+    return text;
+}
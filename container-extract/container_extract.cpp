@@ -0,0 +1,206 @@
+/**
+ * Split a recording container (guestbook.rec) in to standard .wav/.flac files, see README.md.
+ *
+ * Usage: container_extract [--scan] <container> [output directory]
+ */
+#include "container_format.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Containers are bigger than a 32-bit long can seek
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+static bool read_at(FILE *file, uint64_t offset, void *buffer, size_t length);
+static bool read_segment(FILE *file, uint32_t at, uint32_t generation, container_segment_t *segment);
+static bool read_index(FILE *file, const container_header_t &header, std::vector<container_entry_t> &entries);
+static void scan(FILE *file, uint32_t generation, std::vector<container_entry_t> &entries);
+static bool extract(FILE *file, const container_entry_t &entry, uint32_t generation, const std::string &directory);
+
+static uint64_t container_bytes = 0;
+
+int main(int argc, char **argv) {
+    bool force_scan = false;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "--scan") == 0) {
+        force_scan = true;
+        arg++;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [--scan] <container> [output directory]\n", argv[0]);
+        return 2;
+    }
+    const char *path = argv[arg++];
+    std::string directory = (arg < argc) ? argv[arg] : ".";
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+    fseek64(file, 0, SEEK_END);
+    container_bytes = ftell64(file);
+
+    // The header gives the generation and where the index is, without it the first segment gives the generation
+    container_header_t header;
+    bool header_ok = read_at(file, 0, &header, sizeof header) && header.magic == CONTAINER_MAGIC &&
+                     header.version == CONTAINER_VERSION && header.sector_bytes == CONTAINER_SECTOR_BYTES &&
+                     header.crc == container_crc32(0, &header, offsetof(container_header_t, crc));
+    uint32_t generation = header_ok ? header.generation : 0;
+    if (!header_ok) {
+        container_segment_t first;
+        if (!read_segment(file, 1, 0, &first)) {
+            fprintf(stderr, "%s: not a recording container\n", path);
+            fclose(file);
+            return 1;
+        }
+        generation = first.generation;
+        fprintf(stderr, "Container header damaged, scanning for recordings\n");
+    }
+
+    std::vector<container_entry_t> entries;
+    if (force_scan || !header_ok || !read_index(file, header, entries)) {
+        if (header_ok && !force_scan) {
+            fprintf(stderr, "Index missing (recording interrupted?), scanning for recordings\n");
+        }
+        scan(file, generation, entries);
+    }
+
+    int failed = 0;
+    for (const container_entry_t &entry : entries) {
+        if (!extract(file, entry, generation, directory)) {
+            failed++;
+        }
+    }
+    fclose(file);
+
+    printf("%zu recordings extracted", entries.size() - failed);
+    if (failed > 0) {
+        printf(", %d failed", failed);
+    }
+    printf("\n");
+
+    return (failed > 0) ? 1 : 0;
+}
+
+/**
+ * @brief Read 'length' bytes at 'offset', false if they aren't all there.
+ */
+static bool read_at(FILE *file, uint64_t offset, void *buffer, size_t length) {
+    return fseek64(file, offset, SEEK_SET) == 0 && fread(buffer, 1, length, file) == length;
+}
+
+/**
+ * @brief Read and check the segment header at sector 'at', belonging to 'generation' (any if 0).
+ */
+static bool read_segment(FILE *file, uint32_t at, uint32_t generation, container_segment_t *segment) {
+    if (!read_at(file, (uint64_t)at * CONTAINER_SECTOR_BYTES, segment, sizeof *segment)) {
+        return false;
+    }
+
+    return segment->magic == CONTAINER_SEGMENT_MAGIC && (generation == 0 || segment->generation == generation) &&
+           segment->crc == container_crc32(0, segment, offsetof(container_segment_t, crc)) &&
+           ((uint64_t)at + container_segment_sectors(segment->header_bytes + segment->data_bytes)) *
+                   CONTAINER_SECTOR_BYTES <=
+               container_bytes;
+}
+
+/**
+ * @brief Read and check the index at the end of the log.
+ */
+static bool read_index(FILE *file, const container_header_t &header, std::vector<container_entry_t> &entries) {
+    container_index_t index;
+
+    if (!read_at(file, (uint64_t)header.end_sector * CONTAINER_SECTOR_BYTES, &index, sizeof index) ||
+        index.magic != CONTAINER_INDEX_MAGIC || index.generation != header.generation ||
+        (uint64_t)index.count * sizeof(container_entry_t) > container_bytes) {
+        return false;
+    }
+
+    entries.resize(index.count);
+    size_t bytes = index.count * sizeof(container_entry_t);
+    if (bytes > 0 && (fread(entries.data(), 1, bytes, file) != bytes ||
+                      container_crc32(0, entries.data(), bytes) != index.crc)) {
+        entries.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Find the recordings by hopping from segment header to segment header from the start of the log.
+ */
+static void scan(FILE *file, uint32_t generation, std::vector<container_entry_t> &entries) {
+    container_segment_t segment;
+    uint32_t at = 1;
+
+    entries.clear();
+    while (read_segment(file, at, generation, &segment) && segment.data_bytes > 0) {
+        container_entry_t entry = {segment.number, 0, at, segment.header_bytes + segment.data_bytes,
+                                   segment.timestamp};
+        entries.push_back(entry);
+        at += container_segment_sectors(entry.bytes);
+    }
+}
+
+/**
+ * @brief Write one recording out as a file named from its number, with the extension its header calls for.
+ */
+static bool extract(FILE *file, const container_entry_t &entry, uint32_t generation, const std::string &directory) {
+    container_segment_t segment;
+    char name[32];
+
+    if (!read_segment(file, entry.sector, generation, &segment) || segment.number != entry.number) {
+        fprintf(stderr, "Recording %05u: bad segment header at sector %u\n", entry.number, entry.sector);
+        return false;
+    }
+
+    std::vector<uint8_t> data(entry.bytes);
+    if (!read_at(file, ((uint64_t)entry.sector + 1) * CONTAINER_SECTOR_BYTES, data.data(), data.size())) {
+        fprintf(stderr, "Recording %05u: truncated\n", entry.number);
+        return false;
+    }
+
+    const char *extension = "bin";
+    if (data.size() >= 4 && memcmp(data.data(), "RIFF", 4) == 0) {
+        extension = "wav";
+    } else if (data.size() >= 4 && memcmp(data.data(), "fLaC", 4) == 0) {
+        extension = "flac";
+    }
+    snprintf(name, sizeof name, "%05u.%s", entry.number, extension);
+    std::string path = directory + "/" + name;
+
+    FILE *out = fopen(path.c_str(), "wb");
+    if (out == NULL) {
+        perror(path.c_str());
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+    ok = (fclose(out) == 0) && ok;
+
+    // FAT date and time, as the guestbook stamps its files
+    uint16_t date = entry.timestamp >> 16;
+    uint16_t time = entry.timestamp & 0xFFFF;
+    printf("%s  %u bytes  %04u-%02u-%02u %02u:%02u:%02u", path.c_str(), entry.bytes, 1980 + (date >> 9),
+           (date >> 5) & 15, date & 31, time >> 11, (time >> 5) & 63, (time & 31) * 2);
+
+    // Levels follow the segment header once the recording was closed
+    container_levels_t levels;
+    if ((segment.flags & CONTAINER_SEGMENT_LEVELS) &&
+        read_at(file, (uint64_t)entry.sector * CONTAINER_SECTOR_BYTES + sizeof segment, &levels, sizeof levels) &&
+        levels.crc == container_crc32(0, &levels, offsetof(container_levels_t, crc))) {
+        printf("  loudness %.1f LUFS, peak %.1f dBFS, %u samples clipped", levels.lufs_cb / 100.0,
+               levels.peak_cb / 100.0, levels.clipped);
+    }
+    printf("\n");
+
+    return ok;
+}
@@ -0,0 +1,109 @@
+/**
+ * On-disk layout of the single file recording container (see recording_container.h), shared with the host side
+ * extractor so it only uses the standard C headers.
+ *
+ * Everything is little endian and in 512 byte sectors:
+ *
+ *   sector 0              container header, where the log ends (the index), how many segments are in it and how big
+ *                         the container is
+ *   sector 1...           segments, one per recording, each starting on a sector boundary:
+ *                             segment header sector (number, sizes, CRC, then the levels once it is closed)
+ *                             the recording's own header (a normal WAV or FLAC header, header_bytes long)
+ *                             data_bytes of audio
+ *   end_sector            index: an index header then one entry per segment, rewritten after every recording
+ *                         just past the last segment (the next recording overwrites it)
+ *
+ * A segment header is rewritten with the current size at every checkpoint, so a segment cut short by a power cut is
+ * still complete up to its last checkpoint and the log can be rebuilt by hopping from one segment header to the next.
+ * Writing a segment's header and audio back to back gives a standard .wav or .flac file.
+ */
+#ifndef CONTAINER_FORMAT_H
+#define CONTAINER_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONTAINER_SECTOR_BYTES 512
+#define CONTAINER_VERSION 2
+#define CONTAINER_MAGIC 0x4E4F4347UL         // "GCON"
+#define CONTAINER_SEGMENT_MAGIC 0x47455347UL // "GSEG"
+#define CONTAINER_INDEX_MAGIC 0x58444947UL   // "GIDX"
+
+// Segment flags
+#define CONTAINER_SEGMENT_LEVELS 0x0001 // Closed, with its levels after the segment header
+
+// Sector 0
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t sector_bytes;
+    uint32_t generation; // Random for each new container, so stale segments from an old one are never picked up
+    uint32_t end_sector; // Where the index is, one past the last segment
+    uint32_t segments;
+    uint32_t total_sectors; // Sectors allocated, on exFAT the file size only goes up to the last sector written
+    uint32_t crc;           // Of everything before it
+} container_header_t;
+
+// First sector of each segment
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t generation;
+    uint16_t number;       // Recording number
+    uint16_t flags;        // CONTAINER_SEGMENT_*
+    uint32_t timestamp;    // FAT date (high 16 bits) and time (low 16 bits) recording started
+    uint32_t header_bytes; // Recording's own header, after this sector
+    uint32_t data_bytes;   // Audio after the recording's header, as of the last checkpoint
+    uint32_t crc;          // Of everything before it
+} container_segment_t;
+
+// Straight after the segment header with CONTAINER_SEGMENT_LEVELS, what the loudness index keeps for a recording in a
+// file of its own
+typedef struct __attribute__((packed)) {
+    uint32_t samples;
+    int16_t rms_cb;   // dBFS x 100
+    int16_t peak_cb;  // dBFS x 100
+    int16_t lufs_cb;  // LUFS x 100
+    uint32_t clipped; // Samples at full scale
+    uint32_t crc;     // Of everything before it
+} container_levels_t;
+
+// Start of the index, followed directly by 'count' entries
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t count;
+    uint32_t crc; // Of the entries
+} container_index_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t number;
+    uint16_t flags;     // Reserved, 0
+    uint32_t sector;    // Segment header
+    uint32_t bytes;     // Recording's header and audio, after the segment header
+    uint32_t timestamp;
+} container_entry_t;
+
+/**
+ * @brief CRC-32 (the zlib/PNG one) of 'length' bytes, carrying on from 'crc' (0 to start).
+ */
+static inline uint32_t container_crc32(uint32_t crc, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    crc = ~crc;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Sectors taken by a segment with 'bytes' of recording header and audio, including its header sector.
+ */
+static inline uint32_t container_segment_sectors(uint32_t bytes) {
+    return 1 + (uint32_t)(((uint64_t)bytes + CONTAINER_SECTOR_BYTES - 1) / CONTAINER_SECTOR_BYTES);
+}
+
+#endif /* CONTAINER_FORMAT_H */
@@ -0,0 +1,97 @@
+/**
+ * Polyphase FIR sample rate converter for the recording path, 44.1kHz down to a lower rate.
+ *
+ * The handset microphone is telephone bandwidth so there is nothing above a few kHz worth storing at 44.1kHz.
+ * Sits between the audio input and the AudioRecordRing and resamples by the rational factor L/M (160/441 for 16kHz,
+ * 1/2 for 22.05kHz).  Only the output samples actually needed are computed, each from DECIMATOR_TAPS input samples
+ * and one phase of a windowed-sinc low pass filter, two samples per cycle with the M7's dual 16-bit multiply
+ * accumulate (SMLAD).  Output samples are gathered in to full audio blocks, so the node transmits a block on only
+ * L/M of the updates.
+ *
+ * The filter is designed in begin(), no tables need generating off line for each rate.
+ */
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+// Rate the audio library runs at, as far as file headers are concerned
+#define DECIMATOR_INPUT_RATE 44100
+
+// Filter taps per output sample (per phase), must be even. More taps gives a sharper cut off for more cycles.
+#ifndef DECIMATOR_TAPS
+#define DECIMATOR_TAPS 48
+#endif
+
+// Most polyphase phases (L) supported, 160 covers 16kHz (160/441). The coefficients take L x DECIMATOR_TAPS x 2 bytes.
+#ifndef DECIMATOR_MAX_PHASES
+#define DECIMATOR_MAX_PHASES 160
+#endif
+
+// Low pass cut off (-6dB) as a fraction of the output Nyquist frequency, the transition band is above it
+#ifndef DECIMATOR_CUTOFF
+#define DECIMATOR_CUTOFF 0.8
+#endif
+
+// Kaiser window beta, ~60dB stop band
+#ifndef DECIMATOR_KAISER_BETA
+#define DECIMATOR_KAISER_BETA 6.0
+#endif
+
+static_assert(DECIMATOR_TAPS % 2 == 0, "DECIMATOR_TAPS must be even (two taps per SMLAD)");
+
+class AudioDecimator : public AudioStream {
+public:
+    AudioDecimator(void) : AudioStream(1, input_queue_array) {}
+
+    /**
+     * @brief Design the filter for 'output_rate' and start resampling. DECIMATOR_INPUT_RATE (or a failure) passes
+     * blocks straight through.
+     *
+     * @return false if the rate is higher than the input or needs more than DECIMATOR_MAX_PHASES phases.
+     */
+    bool begin(uint32_t output_rate);
+
+    /**
+     * @brief Sample rate of the blocks transmitted.
+     */
+    uint32_t output_rate(void) const { return rate; }
+
+    /**
+     * @brief Output samples lost because no audio block could be allocated.
+     */
+    uint32_t overruns(void) const { return dropped_samples; }
+
+    /**
+     * @brief Number of phases needed to convert to 'output_rate', 0 if it can't be done.
+     */
+    static constexpr uint32_t phases_for(uint32_t output_rate) {
+        return (output_rate == 0 || output_rate > DECIMATOR_INPUT_RATE ||
+                output_rate / gcd(output_rate, DECIMATOR_INPUT_RATE) > DECIMATOR_MAX_PHASES)
+                   ? 0
+                   : output_rate / gcd(output_rate, DECIMATOR_INPUT_RATE);
+    }
+
+    virtual void update(void);
+
+private:
+    static constexpr uint32_t gcd(uint32_t a, uint32_t b) { return (b == 0) ? a : gcd(b, a % b); }
+
+    audio_block_t *input_queue_array[1];
+    // Phase p is coefficients[p * DECIMATOR_TAPS ...], in reverse order so it lines up with the oldest sample first
+    int16_t coefficients[DECIMATOR_MAX_PHASES * DECIMATOR_TAPS] __attribute__((aligned(4)));
+    // The last DECIMATOR_TAPS - 1 samples of the previous block then the current block
+    int16_t history[DECIMATOR_TAPS - 1 + AUDIO_BLOCK_SAMPLES] __attribute__((aligned(4)));
+    uint32_t rate = DECIMATOR_INPUT_RATE;
+    uint32_t up = 1;   // L
+    uint32_t down = 1; // M
+    uint32_t index = 0; // Input sample (in the current block) of the next output sample
+    uint32_t phase = 0; // and its filter phase
+    audio_block_t *output = NULL;
+    uint32_t output_fill = 0;
+    volatile bool resampling = false;
+    volatile uint32_t dropped_samples = 0;
+};
+
+#endif /* DECIMATOR_H */
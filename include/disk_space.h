@@ -0,0 +1,38 @@
+/**
+ * Free space on the SD card, counted once and then kept up to date by the recorder.
+ *
+ * SD.usedSize() walks the whole FAT (or exFAT allocation bitmap) every time, seconds on a big card, and used to run
+ * after every call just as the next guest might lift the handset.  Instead the free clusters are counted once at
+ * boot and each new file's clusters are taken off as it is closed, so reading the free space costs nothing.  Files
+ * copied, deleted or written over USB are passed on by MTP (see MTPStorage::setSpaceCallbacks()), so the count stays
+ * right until the next boot recounts it.
+ */
+#ifndef DISK_SPACE_H
+#define DISK_SPACE_H
+
+#include <Arduino.h>
+#include <SD.h>
+
+/**
+ * @brief Count the free clusters on 'volume', the one slow part, call once at boot.
+ *
+ * @return false if the volume couldn't be read, everything then reads 0.
+ */
+bool disk_space_begin(FsVolume *volume);
+
+/**
+ * @brief Account for a file that has grown from 'old_bytes' to 'new_bytes' long (0 for a new file).
+ */
+void disk_space_file_grew(uint64_t old_bytes, uint64_t new_bytes);
+
+/**
+ * @brief Size of the volume in bytes.
+ */
+uint64_t disk_space_total(void);
+
+/**
+ * @brief Bytes not yet allocated to any file.
+ */
+uint64_t disk_space_free(void);
+
+#endif /* DISK_SPACE_H */
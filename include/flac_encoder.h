@@ -0,0 +1,52 @@
+/**
+ * Streaming lossless (FLAC subset) encoder for recordings.
+ *
+ * Each audio library block (AUDIO_BLOCK_SAMPLES, 256 samples) becomes one FLAC frame, 16-bit mono.  Each frame uses
+ * whichever of the fixed linear predictors (order 0 to FLAC_MAX_FIXED_ORDER) suits it best, with Rice coded residuals
+ * in up to 2^FLAC_MAX_PARTITION_ORDER partitions, or falls back to a constant/verbatim subframe.  There is no LPC
+ * search so the work per block is bounded: one pass per predictor order and one per partition order.
+ *
+ * The output is a standard .flac file: "fLaC", STREAMINFO, an optional VORBIS_COMMENT and PADDING up to a whole 512
+ * byte sector, then the frames.  So like the .wav recordings the header space can be reserved when the recording
+ * starts and all the frames that follow start sector aligned.
+ */
+#ifndef FLAC_ENCODER_H
+#define FLAC_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLAC_BLOCK_SAMPLES 256        // Samples per frame, one audio library block
+#define FLAC_HEADER_BYTES 512         // Metadata blocks padded out to a sector
+#define FLAC_MAX_FIXED_ORDER 4        // Highest fixed predictor tried
+#define FLAC_MAX_PARTITION_ORDER 3    // Up to 8 Rice partitions per frame
+#define FLAC_MAX_FRAME_BYTES (FLAC_BLOCK_SAMPLES * 2 + 32) // Verbatim frame plus header/footer
+#define FLAC_MAX_COMMENT 400
+
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t frame_number;
+    uint64_t total_samples;
+    uint32_t min_frame_bytes;
+    uint32_t max_frame_bytes;
+} flac_encoder_t;
+
+/**
+ * @brief Reset the encoder ready for a new recording.
+ */
+void flac_init(flac_encoder_t *encoder, uint32_t sample_rate);
+
+/**
+ * @brief Encode 'samples' samples (a multiple of FLAC_BLOCK_SAMPLES) as frames in to 'out'.
+ *
+ * @return Number of bytes written to 'out', at most (samples / FLAC_BLOCK_SAMPLES) * FLAC_MAX_FRAME_BYTES.
+ */
+size_t flac_encode(flac_encoder_t *encoder, const int16_t *pcm, uint32_t samples, uint8_t *out);
+
+/**
+ * @brief Build the FLAC_HEADER_BYTES of metadata for what has been encoded so far, with an optional comment (NULL
+ * for none) in a VORBIS_COMMENT block.
+ */
+void flac_build_header(const flac_encoder_t *encoder, uint8_t *sector, const char *comment);
+
+#endif /* FLAC_ENCODER_H */
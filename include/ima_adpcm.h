@@ -0,0 +1,43 @@
+/**
+ * Streaming IMA ADPCM encoder (WAV format tag 0x11, mono) for recordings.
+ *
+ * 16-bit samples go in as they arrive from the audio library, complete 512 byte ADPCM blocks (1017 samples each) come
+ * out.  4 bits per sample, a quarter of the bytes of 16-bit PCM, so fewer SD writes and longer card life.  Each block
+ * is exactly one SD sector.
+ */
+#ifndef IMA_ADPCM_H
+#define IMA_ADPCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IMA_ADPCM_BLOCK_BYTES 512
+#define IMA_ADPCM_SAMPLES_PER_BLOCK ((IMA_ADPCM_BLOCK_BYTES - 4) * 2 + 1)
+
+typedef struct {
+    int32_t predictor;     // Last decoded sample, what the decoder will have
+    int32_t index;         // Step table index
+    uint32_t block_fill;   // Samples in the block being built
+    uint8_t block[IMA_ADPCM_BLOCK_BYTES];
+} ima_adpcm_encoder_t;
+
+/**
+ * @brief Reset the encoder ready for a new recording.
+ */
+void ima_adpcm_init(ima_adpcm_encoder_t *encoder);
+
+/**
+ * @brief Encode 'samples' samples, copying any blocks that are completed to 'out'.
+ *
+ * @return Number of bytes written to 'out', always a whole number of blocks.
+ */
+size_t ima_adpcm_encode(ima_adpcm_encoder_t *encoder, const int16_t *pcm, uint32_t samples, uint8_t *out);
+
+/**
+ * @brief Finish the recording, copying the last (short) block to 'out'.
+ *
+ * @return Number of bytes written to 'out'.
+ */
+size_t ima_adpcm_flush(ima_adpcm_encoder_t *encoder, uint8_t *out);
+
+#endif /* IMA_ADPCM_H */
@@ -0,0 +1,49 @@
+/**
+ * Sidecar index of the levels of every recording, one small fixed size record per recording appended to a single
+ * file in the root of the SD card as each recording is closed.  Clipped or nearly silent messages can be listed in
+ * a few milliseconds from the one file without opening (or copying off) any of the recordings.  Recordings in the
+ * container keep theirs in their segment headers instead (see container_format.h).
+ *
+ * The file is an 8 byte header (magic, record size, version) followed by loudness_record_t records in the order the
+ * recordings were made.
+ */
+#ifndef LOUDNESS_INDEX_H
+#define LOUDNESS_INDEX_H
+
+#include "loudness_meter.h"
+#include <Arduino.h>
+#include <SD.h>
+
+#define LOUDNESS_INDEX_FILE "loudness.idx"
+#define LOUDNESS_INDEX_MAGIC 0x5844494CUL // "LIDX"
+#define LOUDNESS_INDEX_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t record_bytes;
+    uint16_t version;
+} loudness_index_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t number;    // Recording number
+    uint32_t samples;   // Length of the recording
+    uint32_t timestamp; // FAT date (high 16 bits) and time (low 16 bits) it was started
+    loudness_t levels;
+} loudness_record_t;
+
+// Called for each record by loudness_index_list(), return false to stop
+typedef bool (*loudness_index_visit_fn)(const loudness_record_t *record);
+
+/**
+ * @brief Append the levels of a recording to the index, creating it if need be.
+ */
+bool loudness_index_append(const loudness_record_t *record);
+
+/**
+ * @brief Call 'visit' for each record in the index, oldest first.
+ *
+ * @return Number of records visited.
+ */
+uint32_t loudness_index_list(loudness_index_visit_fn visit);
+
+#endif /* LOUDNESS_INDEX_H */
@@ -0,0 +1,73 @@
+/**
+ * Streaming level analysis of recordings: RMS, peak, clipping and an approximate integrated loudness (LUFS).
+ *
+ * Fed every block as the recorder writes it, so a clipped or nearly silent message is known as soon as the call
+ * ends without reading the file back.  Loudness follows ITU-R BS.1770: K-weighting (a high shelf and a high pass,
+ * designed for the recording's sample rate), 400ms blocks overlapping by 75%, an absolute gate at -70 LUFS and a
+ * relative gate 10 LU below the ungated loudness.  To keep memory fixed however long the recording, the block
+ * loudnesses are kept as a histogram in quarter LU bins rather than individually, so the result is within ~0.1 LU.
+ */
+#ifndef LOUDNESS_METER_H
+#define LOUDNESS_METER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Samples at or beyond this magnitude count as clipped, the ADC has hit full scale
+#ifndef LOUDNESS_CLIP_LEVEL
+#define LOUDNESS_CLIP_LEVEL 32700
+#endif
+
+// Histogram of 400ms block loudness from -70 LUFS to 0 in quarter LU bins
+#define LOUDNESS_FLOOR_LUFS -70
+#define LOUDNESS_BINS_PER_LU 4
+#define LOUDNESS_BINS (-LOUDNESS_FLOOR_LUFS * LOUDNESS_BINS_PER_LU)
+
+// Levels are kept in hundredths of a dB (centibels), this is what silence reads as
+#define LOUDNESS_SILENT_CB -9900
+
+typedef struct {
+    float b0, b1, b2, a1, a2; // Normalised so a0 == 1
+    float z1, z2;             // Transposed direct form II state
+} loudness_biquad_t;
+
+typedef struct {
+    uint32_t sample_rate;
+    loudness_biquad_t shelf;     // K-weighting stage 1
+    loudness_biquad_t high_pass; // K-weighting stage 2
+    uint32_t step_samples;       // 100ms, a quarter of a gating block
+    uint32_t step_fill;          // Samples in the current step
+    float step_energy;           // K-weighted sum of squares for the current step
+    float steps[4];              // Mean squares of the last four steps, a gating block
+    uint32_t step_count;
+    uint64_t sum_squares;        // Unweighted, for the RMS
+    uint32_t samples;
+    uint16_t peak;
+    uint32_t clipped;
+    uint16_t histogram[LOUDNESS_BINS];
+} loudness_meter_t;
+
+// Result for one recording
+typedef struct __attribute__((packed)) {
+    int16_t rms_cb;  // dBFS x 100
+    int16_t peak_cb; // dBFS x 100
+    int16_t lufs_cb; // LUFS x 100, LOUDNESS_SILENT_CB if no block was above the absolute gate
+    uint32_t clipped; // Samples at full scale
+} loudness_t;
+
+/**
+ * @brief Reset the meter and design the K-weighting filters for 'sample_rate', ready for a new recording.
+ */
+void loudness_init(loudness_meter_t *meter, uint32_t sample_rate);
+
+/**
+ * @brief Measure the next 'samples' samples.
+ */
+void loudness_block(loudness_meter_t *meter, const int16_t *pcm, uint32_t samples);
+
+/**
+ * @brief Levels of everything measured since loudness_init().
+ */
+void loudness_result(const loudness_meter_t *meter, loudness_t *result);
+
+#endif /* LOUDNESS_METER_H */
@@ -0,0 +1,55 @@
+/**
+ * Player for sounds held in the prompt cache (see prompt_cache.h), a drop in for AudioPlaySdWavX with the same
+ * play/stop/isStopped API.
+ *
+ * update() copies the next block of samples straight from memory, so it takes the same time every block and never
+ * waits on the SD card, and play() starts the sound at the next audio update.
+ */
+#ifndef PLAY_MEMORY_WAV_H
+#define PLAY_MEMORY_WAV_H
+
+#include "prompt_cache.h"
+#include <Arduino.h>
+#include <AudioStream.h>
+
+class AudioPlayMemoryWav : public AudioStream {
+public:
+    AudioPlayMemoryWav(void) : AudioStream(0, NULL) {}
+
+    /**
+     * @brief Start playing the cached sound loaded from 'filename', stopping anything already playing.
+     *
+     * @return false if it isn't in the cache.
+     */
+    bool play(const char *filename) { return play(prompt_cache_find(filename)); }
+
+    /**
+     * @brief Start playing 'prompt', stopping anything already playing.
+     *
+     * @return false if 'prompt' is NULL.
+     */
+    bool play(const prompt_t *prompt);
+
+    void stop(void);
+    bool isPlaying(void) const { return remaining > 0; }
+    bool isStopped(void) const { return remaining == 0; }
+
+    /**
+     * @brief Time since the start of the sound playing.
+     */
+    uint32_t positionMillis(void) const;
+
+    /**
+     * @brief Length of the sound playing.
+     */
+    uint32_t lengthMillis(void) const;
+
+    virtual void update(void);
+
+private:
+    const int16_t *volatile next = NULL; // Next sample to play
+    volatile uint32_t remaining = 0;     // Samples left to play, 0 when stopped
+    uint32_t length = 0;                 // Of the sound playing
+};
+
+#endif /* PLAY_MEMORY_WAV_H */
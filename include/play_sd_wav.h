@@ -30,6 +30,38 @@
 #include "Arduino.h"
 #include "AudioStream.h"
 #include "SD.h"
+#include "resampler.h"
+
+// The file is read ahead of playback in to a ring of chunks by fill(), called from loop(), so update() (in the audio
+// interrupt) only ever copies from RAM and a slow SD read can't hold up the rest of the audio graph.  Must be a power
+// of 2.
+#ifndef PLAY_SD_WAV_READ_AHEAD_CHUNKS
+#define PLAY_SD_WAV_READ_AHEAD_CHUNKS 16
+#endif
+#define PLAY_SD_WAV_CHUNK_BYTES 512
+
+// Files and memory clips queued to play one after the other.  The next is opened and read in to the ring by fill()
+// while the one before is still playing, and update() goes straight on to it part way through an audio block, so
+// there is no gap between them.  Must be a power of 2.
+#ifndef PLAY_SD_WAV_QUEUE_LENGTH
+#define PLAY_SD_WAV_QUEUE_LENGTH 8
+#endif
+#define PLAY_SD_WAV_NAME_BYTES 32
+
+// false to read the file from update() as the Audio library's player does, to compare worst case update times
+#ifndef PLAY_SD_WAV_READ_AHEAD
+#define PLAY_SD_WAV_READ_AHEAD true
+#endif
+
+// Files at other sample rates (8kHz to 48kHz) and 8-bit files are converted to 44.1kHz 16-bit as they play, with
+// setResampler() choosing the interpolator (see resampler.h).  The slowest update() is kept in maxUpdateCycles(),
+// this is what it should stay under as a percentage of the CPU time one audio block takes.
+#ifndef PLAY_SD_WAV_UPDATE_BUDGET_PERCENT
+#define PLAY_SD_WAV_UPDATE_BUDGET_PERCENT 2
+#endif
+#define PLAY_SD_WAV_UPDATE_BUDGET_CYCLES \
+	(uint32_t)((double)F_CPU_ACTUAL * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT * \
+		PLAY_SD_WAV_UPDATE_BUDGET_PERCENT / 100)
 
 class AudioPlaySdWavX : public AudioStream
 {
@@ -37,6 +69,9 @@ public:
 	AudioPlaySdWavX(void) : AudioStream(0, NULL), block_left(NULL), block_right(NULL) { begin(); }
 	void begin(void);
 	bool play(const char *filename);
+	bool queue(const char *filename);
+	bool queue(const int16_t *samples, uint32_t length);
+	uint32_t queued(void) { return queue_head - queue_tail; }
 	void togglePlayPause(void);
 	void stop(void);
 	bool isPlaying(void);
@@ -44,9 +79,28 @@ public:
 	bool isStopped(void);
 	uint32_t positionMillis(void);
 	uint32_t lengthMillis(void);
+	void fill(void);
+	uint32_t maxReadMicros(void) { return max_read_us; }
+	uint32_t underruns(void) { return underrun_count; }
+	uint32_t maxUpdateCycles(void) { return max_update_cycles; }
+	uint32_t avgUpdateCycles(void) { return update_count ? total_update_cycles / update_count : 0; }
+	void resetStats(void) {
+		max_read_us = 0;
+		underrun_count = 0;
+		max_update_cycles = 0;
+		total_update_cycles = 0;
+		update_count = 0;
+	}
+	void setResampler(uint8_t mode) { resampler_mode = mode; }
 	virtual void update(void);
 private:
 	File wavfile;
+	bool start(void);
+	bool add(const char *filename, const int16_t *samples, uint32_t length);
+	bool open_next(void);
+	void start_item(uint8_t flags);
+	void play_block(void);
+	bool read_chunk(void);
 	bool consume(uint32_t size);
 	bool parse_format(void);
 	uint32_t header[10];		// temporary storage of wav header data
@@ -56,9 +110,32 @@ private:
 	audio_block_t *block_left;
 	audio_block_t *block_right;
 	uint16_t block_offset;		// how much data is in block_left & block_right
-	uint8_t buffer[AUDIO_BLOCK_SAMPLES*sizeof(int16_t)*2];		// buffer two blocks of data
-	uint16_t buffer_offset;		// where we're at consuming "buffer"
-	uint16_t buffer_length;		// how much data is in "buffer" 
+	uint8_t ring[PLAY_SD_WAV_READ_AHEAD_CHUNKS][PLAY_SD_WAV_CHUNK_BYTES] __attribute__((aligned(4)));
+	const uint8_t *ring_data[PLAY_SD_WAV_READ_AHEAD_CHUNKS];	// the chunk read, or a memory clip
+	uint32_t ring_length[PLAY_SD_WAV_READ_AHEAD_CHUNKS];	// bytes in each chunk
+	uint8_t ring_flags[PLAY_SD_WAV_READ_AHEAD_CHUNKS];	// RING_START, RING_CLIP
+	volatile uint32_t ring_head;	// free running, chunks read, only written by fill()
+	volatile uint32_t ring_tail;	// free running, chunks used up, only written by update()
+	volatile bool ring_eof;		// everything queued has been read
+	bool file_start;		// the next chunk read is the first of its file
+	struct {
+		char name[PLAY_SD_WAV_NAME_BYTES];
+		const int16_t *samples;	// memory clip, or NULL for the file "name"
+		uint32_t length;
+	} queue_items[PLAY_SD_WAV_QUEUE_LENGTH];
+	volatile uint32_t queue_head;	// free running, items queued
+	volatile uint32_t queue_tail;	// free running, items opened by fill()
+	const uint8_t *buffer;		// chunk being consumed, NULL if none
+	uint32_t buffer_offset;		// where we're at consuming "buffer"
+	uint32_t buffer_length;		// how much data is in "buffer" 
+	uint32_t max_read_us;		// slowest chunk read
+	uint32_t underrun_count;	// updates fill() hadn't read far enough ahead for
+	uint32_t max_update_cycles;	// slowest update()
+	uint64_t total_update_cycles;	// all the updates while playing
+	uint32_t update_count;
+	resampler_t resampler;		// for the STATE_CONVERT_* states
+	uint32_t tail_frames;		// silent frames still to push through the resampler after the data
+	uint8_t resampler_mode;
 	uint8_t header_offset;		// number of bytes in header[]
 	uint8_t state;
 	uint8_t state_play;
@@ -0,0 +1,49 @@
+/**
+ * Prompts and other fixed sounds held in memory, so they play without touching the SD card.
+ *
+ * Each .wav is read once at boot, converted to 16-bit mono samples at the audio library's sample rate (resampled with
+ * the default resampler.h interpolator if it was recorded at another) and kept in EXTMEM (PSRAM) when fitted,
+ * otherwise in internal RAM.  AudioPlayMemoryWav (see play_memory_wav.h) then plays it from there: starting is just
+ * setting a pointer, so the prompt starts within one audio block of being asked for whatever the card is doing, and
+ * the card is left free for the recorder.
+ */
+#ifndef PROMPT_CACHE_H
+#define PROMPT_CACHE_H
+
+#include <Arduino.h>
+
+// Most sounds the cache can hold
+#ifndef PROMPT_CACHE_MAX
+#define PROMPT_CACHE_MAX 4
+#endif
+
+// Largest sound that will be cached, longer ones are left to play from the card
+#ifndef PROMPT_CACHE_MAX_BYTES
+#define PROMPT_CACHE_MAX_BYTES (4UL * 1024 * 1024)
+#endif
+
+typedef struct {
+    char name[16];          // Filename it was loaded from
+    const int16_t *samples; // Mono, at the audio library's sample rate
+    uint32_t length;        // Samples
+} prompt_t;
+
+/**
+ * @brief Load the .wav file 'filename' from the SD card in to the cache (8 or 16-bit PCM, mono or stereo, 8kHz to
+ * 48kHz).
+ *
+ * @return false if it couldn't be read, isn't a format that can be cached, or there isn't the memory for it.
+ */
+bool prompt_cache_load(const char *filename);
+
+/**
+ * @brief The cached sound loaded from 'filename', NULL if it isn't cached.
+ */
+const prompt_t *prompt_cache_find(const char *filename);
+
+/**
+ * @brief Memory taken by the cached sounds, in bytes.
+ */
+uint32_t prompt_cache_bytes(void);
+
+#endif /* PROMPT_CACHE_H */
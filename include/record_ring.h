@@ -0,0 +1,140 @@
+/**
+ * Lock-free single producer/single consumer ring of audio blocks for recording.
+ *
+ * Replaces AudioRecordQueue on the microphone input.  The producer is update(), which runs in the audio library's
+ * update interrupt, and the only consumer is the SD writer (see recorder.cpp) which runs in its own lower priority
+ * context.  Each side only ever writes its own index so no locking is needed, the audio interrupt never waits on the
+ * SD card and the main state machine never touches the ring at all.
+ *
+ * By default the ring holds pointers to the audio library's own blocks, so SD stalls are limited to the AudioMemory()
+ * headroom (100 blocks, ~580ms).  Calling use_elastic() switches to an elastic buffer: each block is copied in to a
+ * much larger buffer (in EXTMEM/PSRAM when fitted) and handed straight back to the audio library, so the recording
+ * can ride out multi-second SD card stalls.
+ *
+ * The ring can also pre-roll: capture continuously keeping only the newest few blocks (while the prompt plays), then
+ * hold() everything from that point on until the writer is started, so a recording can begin just before the moment
+ * it was asked for rather than after the file has been opened.
+ */
+#ifndef RECORD_RING_H
+#define RECORD_RING_H
+
+#include <Arduino.h>
+#include <AudioStream.h>
+#include <EventResponder.h>
+
+// Number of audio block pointers the ring can hold, must be a power of 2. The ring can never hold more blocks than
+// were given to AudioMemory() so this just needs to be at least that big.
+#ifndef RECORD_RING_BLOCKS
+#define RECORD_RING_BLOCKS 128
+#endif
+
+// Most blocks use_elastic() takes when there is no PSRAM (64KB, ~2 seconds of 16kHz audio). extmem_malloc() falls
+// back to internal RAM2, which the recording catalogue, container index and prompt cache are allocated from after it.
+#ifndef RECORD_RING_INTERNAL_BLOCKS
+#define RECORD_RING_INTERNAL_BLOCKS 128
+#endif
+
+class AudioRecordRing : public AudioStream {
+public:
+    AudioRecordRing(void) : AudioStream(1, input_queue_array) { clear(); }
+
+    /**
+     * @brief Copy blocks in to an elastic buffer of 'blocks' (power of 2) blocks instead of holding audio library
+     * blocks.  Allocated with extmem_malloc() so PSRAM is used when fitted, otherwise at most
+     * RECORD_RING_INTERNAL_BLOCKS of internal RAM.
+     *
+     * @return Number of blocks actually allocated, 0 if no memory (ring stays as block pointers).
+     */
+    uint32_t use_elastic(uint32_t blocks);
+
+    /**
+     * @brief Start accepting blocks, writer is triggered every 'trigger_blocks' blocks.
+     */
+    void begin(EventResponder *writer, uint32_t trigger_blocks);
+
+    /**
+     * @brief Discard anything held and start capturing, keeping only the newest 'blocks' blocks (at most capacity()),
+     * the writer isn't woken.
+     */
+    void preroll(uint32_t blocks);
+
+    /**
+     * @brief Stop discarding pre-roll, everything from the oldest pre-roll block on is kept for the writer.
+     *
+     * @return Number of pre-roll blocks held.
+     */
+    uint32_t hold(void);
+
+    /**
+     * @brief Pre-roll blocks held by hold() that begin() hasn't taken over yet, 0 if none.
+     */
+    uint32_t held(void) const { return preroll_held; }
+
+    /**
+     * @brief Stop accepting blocks, anything already in the ring is left for the writer.
+     */
+    void end(void) {
+        enabled = false;
+        preroll_limit = 0;
+        draining = false;
+    }
+
+    /**
+     * @brief Stop accepting blocks but keep waking the writer every audio update until end(), so it can work through
+     * what is left a piece at a time.
+     */
+    void drain(void) {
+        enabled = false;
+        draining = true;
+    }
+
+    /**
+     * @brief Discard anything still held and reset the counters, only call when the writer is idle.
+     */
+    void clear(void);
+
+    /**
+     * @brief Number of blocks waiting for the writer (consumer side).
+     */
+    uint32_t available(void) const { return head - tail; }
+
+    /**
+     * @brief Copy up to 'max_blocks' of the oldest blocks to 'dst' and remove them (consumer side).
+     *
+     * @return Number of blocks copied.
+     */
+    uint32_t read(void *dst, uint32_t max_blocks);
+
+    /**
+     * @brief Samples of block 'n' (0 is the oldest, n < available()) without removing it (consumer side).
+     */
+    const int16_t *peek(uint32_t n) const {
+        uint32_t t = tail + n;
+        return (elastic != NULL) ? elastic + (t & mask) * AUDIO_BLOCK_SAMPLES : ring[t & mask]->data;
+    }
+
+    uint32_t capacity(void) const { return mask + 1; }
+    bool is_elastic(void) const { return elastic != NULL; }
+    uint32_t overruns(void) const { return dropped_blocks; }
+    uint32_t peak_depth(void) const { return max_depth; }
+
+    virtual void update(void);
+
+private:
+    audio_block_t *input_queue_array[1];
+    audio_block_t *volatile ring[RECORD_RING_BLOCKS];
+    int16_t *elastic = NULL;             // Elastic buffer of (mask + 1) blocks of samples, NULL if not in use
+    uint32_t mask = RECORD_RING_BLOCKS - 1;
+    volatile uint32_t head = 0; // Free running, only written by the producer (audio interrupt)
+    volatile uint32_t tail = 0; // Free running, only written by the consumer (SD writer), or producer pre-rolling
+    volatile bool enabled = false;
+    volatile bool draining = false;
+    EventResponder *writer_event = NULL;
+    uint32_t trigger = 1;
+    volatile uint32_t dropped_blocks = 0; // Blocks lost because the ring was full
+    volatile uint32_t max_depth = 0;      // Deepest the ring has been since clear()
+    volatile uint32_t preroll_limit = 0;  // Blocks kept while pre-rolling, 0 when not
+    uint32_t preroll_held = 0;            // Blocks held by hold() for the next begin()
+};
+
+#endif /* RECORD_RING_H */
@@ -0,0 +1,258 @@
+/**
+ * SD card writer for recordings.
+ *
+ * All writes of audio to the open recording file happen here, in an EventResponder attached as an interrupt (PendSV
+ * on the Teensy 4.x, the lowest priority in the system).  The audio interrupt fills the AudioRecordRing and wakes
+ * the writer, so the writer pre-empts loop() whenever audio is waiting but is itself pre-empted by the audio library.
+ * Blocking code in the main state machine (beeps, UART updates to the admin monitor) therefore no longer eats in
+ * to the AudioMemory headroom.
+ *
+ * The main program opens and closes the file, the writer only touches it between recorder_begin() and
+ * recorder_end().
+ */
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "loudness_meter.h"
+#include "record_ring.h"
+#include "voice_detector.h"
+#include <Arduino.h>
+#include <SD.h>
+
+// Number of audio blocks written to the SD card at a time, 16 x 256 samples x 2 bytes = 8KB
+#ifndef RECORDER_WRITE_BLOCKS
+#define RECORDER_WRITE_BLOCKS 16
+#endif
+
+// Record to RAM: keep the whole call in the elastic buffer and write nothing to the SD card until the handset is put
+// down, then flush it in the background while the phone is ready for the next guest. A call that outgrows 3/4 of the
+// buffer switches over to writing as it goes, without losing anything.
+#ifndef RECORDER_RAM_MODE
+#define RECORDER_RAM_MODE false
+#endif
+
+// Elastic buffer between capture and the SD writer, in blocks (power of 2). 2048 blocks is 1MB, ~32.8 seconds of
+// 16kHz audio, when the PSRAM is fitted; without it only RECORD_RING_INTERNAL_BLOCKS of internal RAM is used. Record
+// to RAM defaults to 4MB, ~98 seconds before writing starts. Set to 0 to only use the AudioMemory() blocks.
+#ifndef RECORDER_ELASTIC_BLOCKS
+#if RECORDER_RAM_MODE
+#define RECORDER_ELASTIC_BLOCKS 8192
+#else
+#define RECORDER_ELASTIC_BLOCKS 2048
+#endif
+#endif
+
+// Preallocate a contiguous extent for the whole of the maximum recording time when the file is opened, so no FAT or
+// exFAT bitmap updates (the main source of SD write latency spikes) happen whilst recording. The file is truncated
+// back to the real length when the recording stops. Set to false to grow the file as it is written.
+#ifndef RECORDER_PREALLOCATE
+#define RECORDER_PREALLOCATE true
+#endif
+
+// Sample rate of the recordings. The microphone is resampled from 44.1kHz (see decimator.h), 16kHz or 22.05kHz are
+// plenty for the handset and cut the SD bandwidth and storage by 2.75x or 2x. 44100 records at the full rate.
+#ifndef RECORDER_SAMPLE_RATE
+#define RECORDER_SAMPLE_RATE 16000
+#endif
+
+// Format of the recordings: 16-bit PCM .wav, IMA ADPCM .wav (4:1 fewer bytes to write, lossy) or .flac (lossless,
+// typically 1.5-2:1 on speech)
+#define RECORDER_FORMAT_PCM 0
+#define RECORDER_FORMAT_IMA_ADPCM 1
+#define RECORDER_FORMAT_FLAC 2
+#ifndef RECORDER_FORMAT
+#define RECORDER_FORMAT RECORDER_FORMAT_PCM
+#endif
+
+// Rewrite the header and sync the file every 'n' seconds of audio so a power cut (brown-out) loses at most that much
+// of a message. Done by the writer, never on the capture path. 0 turns checkpoints off. Can be changed at run time
+// with recorder_set_checkpoint_interval().
+#ifndef RECORDER_CHECKPOINT_SECONDS
+#define RECORDER_CHECKPOINT_SECONDS 10
+#endif
+
+// Audio kept from before the prompt finished when recording starts (see recorder_preroll()), so a guest who talks
+// over the end of the prompt/beep loses nothing. Without the PSRAM the pre-roll is limited to a quarter of the ring.
+#ifndef RECORDER_PREROLL_MS
+#define RECORDER_PREROLL_MS 500
+#endif
+
+// Gain applied to the pre-roll, most of which is the prompt bleeding from the earpiece in to the microphone. Ramps up
+// to full gain over the last pre-roll block.
+#ifndef RECORDER_PREROLL_BLEED_GAIN
+#define RECORDER_PREROLL_BLEED_GAIN 0.25f
+#endif
+
+// Largest header a format can have, a sector for the WAV/FLAC header and one for a container segment header
+#define RECORDER_MAX_HEADER_BYTES 1024
+
+// Upper bound (ms) of each bucket in the SD write latency histogram, the last bucket is everything slower
+#define RECORDER_HISTOGRAM_BUCKETS 8
+#define RECORDER_HISTOGRAM_LIMITS_MS {1, 2, 5, 10, 20, 50, 100, UINT32_MAX}
+
+// Capture health for one recording, written in to the file when it is finalised
+typedef struct {
+    uint32_t peak_depth;      // Most blocks waiting for the writer at once
+    uint32_t capacity;        // Blocks the ring/elastic buffer can hold
+    uint32_t dropped_blocks;  // Blocks lost because the ring was full
+    uint32_t writes;          // Number of SD writes
+    uint32_t min_write_us;    // SD write latency
+    uint32_t max_write_us;
+    uint64_t total_write_us;  // For the average
+    uint32_t max_checkpoint_us;
+    uint32_t max_encode_cycles; // CPU cycles to encode one audio block (0 for PCM)
+    uint64_t total_encode_cycles;
+    uint32_t encoded_blocks;
+    uint32_t samples;         // Samples in the file, after any trim
+    uint32_t trimmed_samples; // Trailing silence cut from the end of the file
+    uint32_t histogram[RECORDER_HISTOGRAM_BUCKETS];
+} recorder_stats_t;
+
+// Build the file header (always a whole number of sectors) for 'data_bytes' of audio, with an optional comment (NULL
+// for none)
+typedef void (*recorder_header_fn)(uint8_t *header, uint32_t data_bytes, const char *comment);
+
+// Encoder for compressed formats: reset for a new file, encode samples and flush at the end. Encoders return the
+// number of bytes they put in 'out', which can be up to one write of PCM plus a sector.
+typedef void (*recorder_reset_fn)(void);
+typedef size_t (*recorder_encode_fn)(const int16_t *pcm, uint32_t samples, uint8_t *out);
+typedef size_t (*recorder_flush_fn)(uint8_t *out);
+
+// Told the recording has been cut back (trailing silence trimmed) to its first 'samples' samples
+typedef void (*recorder_trim_fn)(uint32_t samples);
+
+// What the writer needs to know about the format of the file being recorded
+typedef struct {
+    uint32_t header_bytes;           // Space reserved at the start of the file for the header
+    uint32_t sample_rate;            // Samples per second, checkpoints are every so many seconds of audio
+    uint32_t byte_rate;              // Bytes of audio per second, the most it can be for variable rate formats
+    uint32_t block_samples;          // Samples per encoded block/frame (1 for PCM), the encoder holds back any
+                                     // samples short of a whole block until it is flushed
+    const char *extension;           // File extension, "wav" or "flac"
+    recorder_header_fn build_header; // Used to reserve the header space and for checkpoints
+    recorder_reset_fn reset;         // All NULL for PCM, written as is
+    recorder_encode_fn encode;
+    recorder_flush_fn flush;
+    recorder_trim_fn trim;           // NULL if the data size is all the header needs
+} recorder_format_t;
+
+/**
+ * @brief Attach the writer to the ring, call once from setup().
+ */
+void recorder_init(AudioRecordRing *ring);
+
+/**
+ * @brief Start capturing in to the ring before the recording proper, keeping only the last RECORDER_PREROLL_MS.
+ * Call when the prompt starts playing.
+ */
+void recorder_preroll(void);
+
+/**
+ * @brief The prompt has finished: keep the pre-roll and everything captured from now on for recorder_begin(), however
+ * long opening the file takes.
+ */
+void recorder_hold(void);
+
+/**
+ * @brief Throw away the pre-roll, the recording isn't going to happen (handset replaced during the prompt).
+ */
+void recorder_cancel(void);
+
+/**
+ * @brief Start capturing audio in to the (already open) file at its current position, resets the encoder and writes
+ * an empty header to reserve its space.  Audio held by recorder_hold() is the start of the recording, with the prompt
+ * bleed turned down and not counted as voice.
+ */
+void recorder_begin(FsFile *file, const recorder_format_t *format);
+
+/**
+ * @brief Set how often the header is checkpointed, in seconds of audio (0 for never).
+ */
+void recorder_set_checkpoint_interval(uint32_t seconds);
+
+/**
+ * @brief Limit recordings to 'milliseconds' of audio (rounded up to a whole audio block), 0 for no limit.  Audio
+ * captured past the limit is never written, so the file is exactly the limit long however late loop() notices.
+ */
+void recorder_set_limit(uint32_t milliseconds);
+
+/**
+ * @brief Samples captured for the recording so far (including the pre-roll, not past the limit), whether or not they
+ * have been written yet.  Once the recording has been finished, the samples in the file.
+ */
+uint32_t recorder_samples(void);
+
+/**
+ * @brief Whether the recording has captured as much audio as recorder_set_limit() allows.
+ */
+bool recorder_limit_reached(void);
+
+/**
+ * @brief Stop capturing and have the writer save everything still in the ring.  Waits for it (the file is finished
+ * with when this returns) unless RECORDER_RAM_MODE, which returns straight away, see recorder_poll().
+ *
+ * With VAD_TRIM, recorder_bytes_saved() is then cut back to the end of the last voice, the caller truncates the file.
+ */
+void recorder_end(void);
+
+/**
+ * @brief Whether everything since recorder_end() is in the file and the writer has let go of it (true when there is no
+ * recording).  Call from loop() while a RAM mode recording is being flushed in the background.
+ */
+bool recorder_poll(void);
+
+/**
+ * @brief How long the recording has been silent (no voice), in milliseconds, see voice_detector.h.
+ */
+uint32_t recorder_silent_ms(void);
+
+/**
+ * @brief Levels (RMS, peak, clipping, loudness) of the last recording, valid once it has been finished.
+ */
+const loudness_t *recorder_loudness(void);
+
+/**
+ * @brief Number of bytes of audio written to the file since recorder_begin().
+ */
+uint32_t recorder_bytes_saved(void);
+
+/**
+ * @brief Samples in the audio written to the file since recorder_begin(), not counting any the encoder has produced
+ * that are still waiting for a whole sector.  What a header written now (a checkpoint) should count.
+ */
+uint32_t recorder_samples_saved(void);
+
+/**
+ * @brief Peak number of blocks waiting for the writer since recorder_begin(), and how many the buffer can hold.
+ */
+uint32_t recorder_peak_fill(void);
+uint32_t recorder_capacity(void);
+
+/**
+ * @brief Longest single SD write since recorder_begin(), in microseconds.
+ */
+uint32_t recorder_max_write_us(void);
+
+/**
+ * @brief Capture health counters for the current (or last) recording.
+ */
+const recorder_stats_t *recorder_stats(void);
+
+/**
+ * @brief Format the capture health counters as text for the file's LIST/INFO chunk.
+ *
+ * @return Length of the text (excluding the terminator).
+ */
+size_t recorder_format_stats(char *text, size_t size);
+
+/**
+ * @brief Longest header checkpoint (write and sync) since recorder_begin(), in microseconds.
+ */
+uint32_t recorder_max_checkpoint_us(void);
+
+/**
+ * @brief Number of audio blocks lost because the ring was full since recorder_begin().
+ */
+uint32_t recorder_dropped_blocks(void);
+
+#endif /* RECORDER_H */
@@ -0,0 +1,95 @@
+/**
+ * In RAM catalogue of the recordings on the SD card.
+ *
+ * Built with a single pass over the card at boot and kept sorted by recording number, so finding the next free
+ * filename is O(1) however many recordings are on the card and the admin monitor can be given the true total number
+ * of recordings rather than just those made since power on.
+ *
+ * Recordings are filed by the RTC in a directory per day and a subdirectory per hour, named from when they started:
+ *
+ *   /2024-06-01/14/00042-1432.wav
+ *
+ * so no directory ever holds more than an hour's recordings and opening, creating or listing one (on the Teensy or
+ * over USB) never has to wade through the whole card.  The path can be rebuilt from the number, start time (to the
+ * minute) and format, which is all the catalogue keeps.  Recordings from before the change, " NNNNN.wav" in the
+ * root, are still found.
+ */
+#ifndef RECORDING_CATALOGUE_H
+#define RECORDING_CATALOGUE_H
+
+#include <Arduino.h>
+#include <SD.h>
+
+// Most recordings the catalogue can hold, allocated once at boot (PSRAM if fitted).
+#ifndef CATALOGUE_MAX_RECORDINGS
+#define CATALOGUE_MAX_RECORDINGS 10000
+#endif
+
+// File new recordings in per day/per hour directories, false for the old " NNNNN.wav" in the root
+#ifndef RECORDING_DATE_DIRECTORIES
+#define RECORDING_DATE_DIRECTORIES true
+#endif
+
+// Longest recording path, "/YYYY-MM-DD/HH/NNNNN-HHMM.flac" and the terminator
+#define CATALOGUE_PATH_BYTES 32
+
+// recording_entry_t flags
+#define CATALOGUE_FLAC 0x01      // .flac rather than .wav
+#define CATALOGUE_DATED 0x02     // In the day/hour directories, otherwise in the root
+#define CATALOGUE_CONTAINER 0x04 // A segment in the recording container, not a file of its own
+
+typedef struct __attribute__((packed)) {
+    uint16_t number;    // Recording number, from the filename
+    uint8_t flags;      // CATALOGUE_...
+    uint32_t size;      // File size in bytes
+    uint32_t timestamp; // FAT date (high 16 bits) and time (low 16 bits), when it started if dated or last modified
+} recording_entry_t;
+
+// Called for each recording found while the catalogue is built, the file is open read/write. Read-only files are not
+// visited, they are still added
+typedef bool (*catalogue_visit_fn)(FsFile *file);
+
+/**
+ * @brief Scan the SD card root and date directories once and build the catalogue, calling 'visit' (if not NULL) for
+ * each recording on the way so other boot time checks don't need their own directory pass.
+ *
+ * @return false if the catalogue could not be allocated or the directory could not be read.
+ */
+bool catalogue_build(catalogue_visit_fn visit);
+
+/**
+ * @brief Add (or update) a recording after it has been closed.
+ */
+void catalogue_add(uint16_t number, uint32_t size, uint32_t timestamp, uint8_t flags);
+
+/**
+ * @brief Number to use for the next recording, one more than the highest on the card.
+ */
+uint16_t catalogue_next_number(void);
+
+/**
+ * @brief Total number of recordings on the card.
+ */
+uint16_t catalogue_count(void);
+
+/**
+ * @brief Entry 'index' (0 .. catalogue_count() - 1) in recording number order, NULL if out of range.
+ */
+const recording_entry_t *catalogue_entry(uint16_t index);
+
+/**
+ * @brief Path of the recording 'number' started at 'timestamp' (FAT date and time), in to 'path' which should be
+ * CATALOGUE_PATH_BYTES long.
+ *
+ * @return false if the recording has no file of its own (it is in the container).
+ */
+bool catalogue_path(uint16_t number, uint32_t timestamp, uint8_t flags, char *path, size_t size);
+
+/**
+ * @brief Recording number from a " NNNNN.wav" (or " NNNNN.flac") filename.
+ *
+ * @return false if the name is not one of ours.
+ */
+bool catalogue_parse_name(const char *name, uint16_t *number);
+
+#endif /* RECORDING_CATALOGUE_H */
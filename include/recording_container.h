@@ -0,0 +1,96 @@
+/**
+ * Log structured store that appends every recording to one preallocated container file on the SD card, instead of
+ * creating a file per recording.
+ *
+ * The container is one contiguous extent allocated the first time it is opened, so recording never creates a file,
+ * grows a directory or touches the FAT (or exFAT bitmap): each recording is a segment written straight after the
+ * last, and closing one is a rewrite of the small index that trails the log and the header sector at the start.  See
+ * container_format.h for the layout, and container-extract/ for the host tool that splits a container back in to
+ * ordinary .wav/.flac files.
+ *
+ * If the power goes mid-recording the index has been overwritten by the new segment, so at boot the log is rebuilt
+ * by scanning the segment headers from the start, keeping the interrupted recording up to its last checkpoint.
+ */
+#ifndef RECORDING_CONTAINER_H
+#define RECORDING_CONTAINER_H
+
+#include "container_format.h"
+#include "loudness_index.h"
+#include <Arduino.h>
+#include <SD.h>
+
+// Record in to the container rather than a file per recording
+#ifndef RECORDER_CONTAINER
+#define RECORDER_CONTAINER false
+#endif
+
+#ifndef CONTAINER_FILE
+#define CONTAINER_FILE "guestbook.rec"
+#endif
+
+// Size of the container, allocated in one go when it is created. FAT32 cards are limited to just under 4GB per file,
+// exFAT can be bigger.
+#ifndef CONTAINER_BYTES
+#define CONTAINER_BYTES (2048ULL * 1024 * 1024)
+#endif
+
+// Most recordings the container index can hold, kept in RAM (PSRAM if fitted) at 16 bytes each
+#ifndef CONTAINER_MAX_SEGMENTS
+#define CONTAINER_MAX_SEGMENTS 4096
+#endif
+
+/**
+ * @brief Open the container in to 'file', creating it if need be and rebuilding the index if a recording was cut
+ * short, then add its recordings to the catalogue (which must already be built).  'file' stays open from then on.
+ */
+bool container_open(FsFile *file);
+
+/**
+ * @brief Start a new segment for recording 'number' at the end of the log, 'file' is left positioned for the
+ * recorder to write the header and audio.
+ *
+ * @return false if there isn't room for 'max_bytes' of header and audio.
+ */
+bool container_begin_segment(FsFile *file, uint16_t number, uint32_t timestamp, uint32_t max_bytes);
+
+/**
+ * @brief Build the segment header sector for the segment being recorded, with 'header_bytes' of recording header
+ * followed by 'data_bytes' of audio.
+ */
+void container_segment_header(uint8_t *out, uint32_t header_bytes, uint32_t data_bytes);
+
+/**
+ * @brief Keep the levels of the segment being recorded, 'samples' long, in its header.  They go in with the segment
+ * header built after this, the final one written when the recording is closed, in place of the loudness index.
+ */
+void container_segment_levels(uint32_t samples, const loudness_t *levels);
+
+/**
+ * @brief Close the segment being recorded, now 'bytes' of header and audio long, and rewrite the index after it.
+ */
+bool container_end_segment(FsFile *file, uint32_t bytes);
+
+/**
+ * @brief Call 'visit' with the levels of each recording in the container that was closed, oldest first.  One sector
+ * read per recording.
+ *
+ * @return Number of recordings visited.
+ */
+uint32_t container_list_levels(FsFile *file, loudness_index_visit_fn visit);
+
+/**
+ * @brief Number of recordings in the container.
+ */
+uint32_t container_count(void);
+
+/**
+ * @brief Whether the index had to be rebuilt from the segment headers at boot.
+ */
+bool container_rebuilt(void);
+
+/**
+ * @brief Bytes left in the container for recordings.
+ */
+uint64_t container_free(void);
+
+#endif /* RECORDING_CONTAINER_H */
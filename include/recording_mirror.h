@@ -0,0 +1,59 @@
+/**
+ * Background mirroring of finished recordings to a second storage device.
+ *
+ * Each recording in the catalogue is copied, a chunk at a time, to the same path on a second FS (the audio board's SD
+ * card over SPI, or LittleFS on QSPI flash) so one failed card doesn't lose a whole event.  mirror_poll() is only
+ * called from loop() between calls, never while a recording is being captured or flushed, and is rate limited so the
+ * state machine stays responsive.
+ *
+ * Progress survives a reboot: the number of the next recording to mirror is kept in a small file on the mirror, and
+ * a part copied recording carries on from the size of the copy already there.
+ */
+#ifndef RECORDING_MIRROR_H
+#define RECORDING_MIRROR_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define MIRROR_NONE 0
+#define MIRROR_SPI_SD 1     // Audio board SD card slot
+#define MIRROR_QSPI_FLASH 2 // LittleFS on flash soldered to the Teensy 4.1's bottom pads
+
+#ifndef MIRROR_TARGET
+#define MIRROR_TARGET MIRROR_NONE
+#endif
+
+// Chip select of the audio board's SD card
+#ifndef MIRROR_SD_CS_PIN
+#define MIRROR_SD_CS_PIN 10
+#endif
+
+// Most bytes copied per second, averaged, and per call to mirror_poll()
+#ifndef MIRROR_BYTES_PER_SECOND
+#define MIRROR_BYTES_PER_SECOND (128 * 1024)
+#endif
+#define MIRROR_CHUNK_BYTES 4096
+
+#define MIRROR_PROGRESS_FILE "mirror.pos"
+
+/**
+ * @brief Start mirroring to 'target' (already begun), reading back how far a previous run got.
+ */
+void mirror_begin(FS *target);
+
+/**
+ * @brief Copy the next chunk if the rate limit allows, call from loop() only while the phone is idle.
+ */
+void mirror_poll(void);
+
+/**
+ * @brief Number of recordings in the catalogue not yet (completely) mirrored.
+ */
+uint16_t mirror_pending(void);
+
+/**
+ * @brief Whether the mirror has run out of space, mirroring stops when it does.
+ */
+bool mirror_full(void);
+
+#endif /* RECORDING_MIRROR_H */
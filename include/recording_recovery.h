@@ -0,0 +1,38 @@
+/**
+ * Boot time recovery of recordings left unfinalised by a power cut.
+ *
+ * Run as part of the catalogue's single directory pass at boot, only the header sector of each recording is read.
+ * A recording whose RIFF/data sizes don't match the length of the file (the power went mid-call, before
+ * stop_recording() could finalise it) is cut back to the audio its last checkpointed header covers, with the header
+ * repaired to match, so it plays back and the rest of a preallocated extent is given back.  FLAC recordings are cut
+ * back to the frames their STREAMINFO counts, which means walking the frames of those that weren't finalised.
+ */
+#ifndef RECORDING_RECOVERY_H
+#define RECORDING_RECOVERY_H
+
+#include <Arduino.h>
+#include <SD.h>
+
+/**
+ * @brief Reset the counters, call before the catalogue is built.
+ */
+void recovery_begin(void);
+
+/**
+ * @brief Check the header of a recording (opened read/write) and repair it if needed.
+ *
+ * @return true if the recording was repaired.
+ */
+bool recovery_visit(FsFile *file);
+
+/**
+ * @brief Number of recordings repaired since recovery_begin().
+ */
+uint16_t recovery_repaired(void);
+
+/**
+ * @brief Number of recordings that could not be repaired (no usable header) since recovery_begin().
+ */
+uint16_t recovery_unrepairable(void);
+
+#endif /* RECORDING_RECOVERY_H */
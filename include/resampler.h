@@ -0,0 +1,107 @@
+/**
+ * Streaming sample rate converter for playing sounds recorded at other rates (8kHz to 48kHz) at the audio library's
+ * 44.1kHz, one or two channels.
+ *
+ * Input frames are pushed in one at a time and output samples taken out whenever resampler_ready() says one is due, so
+ * the caller can stop at the end of an audio block and carry on from the same place next time.  The position is kept
+ * as a 32.32 fixed point count of input samples, so any pair of rates works without a rational factor being found.
+ *
+ * Three interpolators, cheapest first:
+ *   RESAMPLER_LINEAR     between the two nearest samples
+ *   RESAMPLER_CUBIC      Catmull-Rom spline through the four nearest samples
+ *   RESAMPLER_POLYPHASE  RESAMPLER_TAPS tap windowed-sinc low pass, with RESAMPLER_PHASES phases and linear
+ *                        interpolation between neighbouring phases, two taps per cycle with SMLAD
+ *
+ * Linear and cubic are only fit for upsampling speech, polyphase band limits properly (including 48kHz down to
+ * 44.1kHz).  The polyphase table is shared by every resampler and built once by resampler_design().
+ */
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <Arduino.h>
+
+#define RESAMPLER_NONE 0 // Same rate, samples pass straight through
+#define RESAMPLER_LINEAR 1
+#define RESAMPLER_CUBIC 2
+#define RESAMPLER_POLYPHASE 3
+
+#ifndef RESAMPLER_DEFAULT_MODE
+#define RESAMPLER_DEFAULT_MODE RESAMPLER_POLYPHASE
+#endif
+
+// Filter taps per output sample, must be even.  The table takes (RESAMPLER_PHASES + 1) x RESAMPLER_TAPS x 2 bytes.
+#ifndef RESAMPLER_TAPS
+#define RESAMPLER_TAPS 32
+#endif
+
+// Filter phases between input samples, must be a power of 2
+#ifndef RESAMPLER_PHASES
+#define RESAMPLER_PHASES 64
+#endif
+
+// Low pass cut off (-6dB) in cycles per input sample.  0.4 is 80% of the input's Nyquist frequency when upsampling,
+// and with the transition band still clear of 22.05kHz for 48kHz in.
+#ifndef RESAMPLER_CUTOFF
+#define RESAMPLER_CUTOFF 0.4
+#endif
+
+// Kaiser window beta, ~60dB stop band
+#ifndef RESAMPLER_KAISER_BETA
+#define RESAMPLER_KAISER_BETA 6.0
+#endif
+
+#define RESAMPLER_MIN_RATE 4000
+#define RESAMPLER_MAX_RATE 48000
+
+static_assert(RESAMPLER_TAPS % 2 == 0, "RESAMPLER_TAPS must be even (two taps per SMLAD)");
+static_assert((RESAMPLER_PHASES & (RESAMPLER_PHASES - 1)) == 0, "RESAMPLER_PHASES must be a power of 2");
+
+typedef struct {
+    uint8_t mode;
+    uint8_t channels;
+    uint64_t step; // Input samples per output sample, 32.32
+    uint32_t frac; // Position of the next output sample after the input sample it follows, 0.32
+    uint32_t need; // Input frames to push before the next output sample is due
+    uint32_t write; // Where the next input sample goes in history
+    uint32_t delay; // Input frames the output lags by, push this many silent ones after the last to get it all out
+    // Each sample is written twice, RESAMPLER_TAPS apart, so the newest RESAMPLER_TAPS are always in a row
+    int16_t history[2][2 * RESAMPLER_TAPS] __attribute__((aligned(4)));
+} resampler_t;
+
+/**
+ * @brief Build the polyphase filter table, if it hasn't been already.  Takes a few ms so call it from setup() or
+ * loop(), never from an audio update.
+ */
+void resampler_design(void);
+
+/**
+ * @brief Reset 'resampler' to convert 'channels' (1 or 2) channels from 'in_rate' to 'out_rate' with interpolator
+ * 'mode', or to pass samples straight through if the rates are the same.  Cheap enough for an audio update.
+ *
+ * @return false if the rates are out of range, or polyphase was asked for before resampler_design().
+ */
+bool resampler_init(resampler_t *resampler, uint32_t in_rate, uint32_t out_rate, uint8_t channels, uint8_t mode);
+
+/**
+ * @brief Whether an output sample is due before the next input frame is pushed.
+ */
+static inline bool resampler_ready(const resampler_t *resampler) { return resampler->need == 0; }
+
+/**
+ * @brief Push the next input frame, 'right' is ignored for one channel.  Only when resampler_ready() is false.
+ */
+static inline void resampler_push(resampler_t *resampler, int16_t left, int16_t right) {
+    uint32_t w = resampler->write;
+
+    resampler->history[0][w] = resampler->history[0][w + RESAMPLER_TAPS] = left;
+    resampler->history[1][w] = resampler->history[1][w + RESAMPLER_TAPS] = right;
+    resampler->write = (w + 1 == RESAMPLER_TAPS) ? 0 : w + 1;
+    resampler->need--;
+}
+
+/**
+ * @brief Take the output sample that is due, 'right' is left alone for one channel.  Only when resampler_ready().
+ */
+void resampler_output(resampler_t *resampler, int16_t *left, int16_t *right);
+
+#endif /* RESAMPLER_H */
@@ -0,0 +1,99 @@
+/**
+ * Streaming voice activity detector for recordings.
+ *
+ * Classifies each audio block as voice or not from its energy (mean square) and zero crossing rate, all fixed point.
+ * A block is voice when its energy is well above the background noise floor, or when it is a quieter block with lots
+ * of zero crossings (the fricatives, "s", "f", "sh", which carry little energy).  The noise floor is the quietest block
+ * of the last VAD_NOISE_WINDOW_MS: speech always has a pause or a quiet syllable in that time, steady hiss, hum or a
+ * room getting louder doesn't.  A hangover keeps short pauses between words counted as voice.  Used by the recorder
+ * to end a call nobody is talking on and to trim the silence at the end of a message.
+ */
+#ifndef VOICE_DETECTOR_H
+#define VOICE_DETECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// End the recording after this many seconds without voice, the handset has been left off the hook. 0 turns it off.
+#ifndef VAD_SILENCE_SECONDS
+#define VAD_SILENCE_SECONDS 10
+#endif
+
+// Trim the silence after the last voice (plus the hangover) from the end of the file when a recording stops
+#ifndef VAD_TRIM
+#define VAD_TRIM true
+#endif
+
+// Lowest block energy (mean square of the samples) counted as voice, ~-50dBFS
+#ifndef VAD_ENERGY_MIN
+#define VAD_ENERGY_MIN 10000
+#endif
+
+// Voice must also be this many times the background noise energy (4 = 6dB)
+#ifndef VAD_NOISE_RATIO
+#define VAD_NOISE_RATIO 4
+#endif
+
+// Blocks with more zero crossings than a tone of this frequency and half the voice energy are fricatives.  Half, so
+// they are still twice the background noise: hiss crosses zero as often as an "s" does.
+#ifndef VAD_ZCR_HZ
+#define VAD_ZCR_HZ 2500
+#endif
+
+// The noise floor is the quietest block in this long, split in to VAD_NOISE_WINDOWS parts so it can be tracked a part
+// at a time.  Also how long a steady noise louder than VAD_ENERGY_MIN takes to be learnt as background.
+#ifndef VAD_NOISE_WINDOW_MS
+#define VAD_NOISE_WINDOW_MS 2000
+#endif
+#define VAD_NOISE_WINDOWS 4
+
+// How long after the last voice block audio still counts as voice
+#ifndef VAD_HANGOVER_MS
+#define VAD_HANGOVER_MS 500
+#endif
+
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t noise_floor;         // Background energy, the quietest of noise_min[] and window_min
+    uint32_t noise_min[VAD_NOISE_WINDOWS]; // Quietest block in each of the last parts of the noise window
+    uint32_t window_min;          // and in the part being tracked
+    uint32_t window_blocks;       // Blocks per part
+    uint32_t window_fill;         // Blocks in the part being tracked
+    uint32_t window_index;        // Where it goes in noise_min[]
+    uint32_t zcr_threshold;       // Zero crossings per block for VAD_ZCR_HZ
+    uint32_t hangover_samples;
+    uint32_t samples;             // Samples classified so far
+    uint32_t last_voice_samples;  // 'samples' at the end of the last voice block (plus the hangover), 0 for none
+    uint32_t block_samples;       // Block size zcr_threshold is for
+} voice_detector_t;
+
+/**
+ * @brief Reset the detector ready for a new recording.
+ */
+void vad_init(voice_detector_t *vad, uint32_t sample_rate);
+
+/**
+ * @brief Classify the next 'samples' samples (one audio block).
+ *
+ * @return true if they are voice.
+ */
+bool vad_block(voice_detector_t *vad, const int16_t *pcm, uint32_t samples);
+
+/**
+ * @brief Count the next 'samples' samples as not voice without classifying them, for audio known not to be the guest.
+ */
+static inline void vad_skip(voice_detector_t *vad, uint32_t samples) { vad->samples += samples; }
+
+/**
+ * @brief Whether any voice has been heard since vad_init().
+ */
+static inline bool vad_heard_voice(const voice_detector_t *vad) { return vad->last_voice_samples > 0; }
+
+/**
+ * @brief Samples since the end of the last voice (and its hangover), all of them if there hasn't been any.
+ */
+static inline uint32_t vad_silent_samples(const voice_detector_t *vad) {
+    return (vad->samples > vad->last_voice_samples) ? vad->samples - vad->last_voice_samples : 0;
+}
+
+#endif /* VOICE_DETECTOR_H */
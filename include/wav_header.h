@@ -0,0 +1,151 @@
+/**
+ * WAV (RIFF) header builder for recordings.
+ *
+ * The canonical 44 byte PCM header is built in one go in to a buffer, the format fields are all worked out at compile
+ * time from the template parameters.  The header is padded out to a whole 512 byte sector with a "JUNK" chunk (which
+ * every WAV reader skips) so that space for it can be reserved when the recording starts, all the audio that follows
+ * is sector aligned, and finalising the file is a single sector write rather than a seek and ~44 single byte writes.
+ *
+ * When the recording is finalised some of the padding can instead carry a LIST/INFO chunk with a comment (ICMT), used
+ * for the capture health counters of the recording.
+ *
+ * IMA ADPCM (format tag 0x11) recordings have the extended "fmt " chunk and the "fact" chunk that format needs, with
+ * one 512 byte ADPCM block per sector.
+ */
+#ifndef WAV_HEADER_H
+#define WAV_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAV_HEADER_CANONICAL_BYTES 44 // RIFF + fmt + data chunk headers
+#define WAV_HEADER_SECTOR_BYTES 512   // Space reserved at the start of each recording, audio starts here
+#define WAV_HEADER_MAX_COMMENT 400    // Longest LIST/INFO comment that fits alongside the header
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+#define WAV_IMA_ADPCM_BLOCK_BYTES 512 // nBlockAlign of IMA ADPCM recordings (mono)
+
+template <uint16_t CHANNELS, uint32_t SAMPLE_RATE, uint16_t BITS_PER_SAMPLE, uint16_t FORMAT = WAV_FORMAT_PCM>
+class WavHeader {
+public:
+    static constexpr bool is_adpcm = (FORMAT == WAV_FORMAT_IMA_ADPCM);
+    static constexpr uint16_t audio_format = FORMAT;
+    static constexpr uint16_t channels = CHANNELS;
+    static constexpr uint32_t sample_rate = SAMPLE_RATE;
+    static constexpr uint16_t bits_per_sample = BITS_PER_SAMPLE;
+    static constexpr uint16_t block_align =
+        is_adpcm ? WAV_IMA_ADPCM_BLOCK_BYTES * CHANNELS : CHANNELS * (BITS_PER_SAMPLE / 8);
+    // ADPCM: 4 byte header per channel holds the first sample, then 2 samples per byte
+    static constexpr uint16_t samples_per_block = is_adpcm ? (block_align - 4 * CHANNELS) * 2 / CHANNELS + 1 : 1;
+    static constexpr uint32_t byte_rate = (uint64_t)SAMPLE_RATE * block_align / samples_per_block;
+    static constexpr uint32_t header_bytes = WAV_HEADER_SECTOR_BYTES;
+
+    static_assert(is_adpcm ? BITS_PER_SAMPLE == 4 : BITS_PER_SAMPLE % 8 == 0, "Unsupported bits per sample");
+
+    /**
+     * @brief Build the complete header sector for 'data_bytes' of audio.
+     */
+    static constexpr void build(uint8_t *sector, uint32_t data_bytes) { build(sector, data_bytes, nullptr); }
+
+    /**
+     * @brief Build the complete header sector for 'data_bytes' of audio with a LIST/INFO comment (can be NULL),
+     * comments longer than WAV_HEADER_MAX_COMMENT are cut short.
+     */
+    static constexpr void build(uint8_t *sector, uint32_t data_bytes, const char *comment) {
+        uint32_t pos = 12;
+
+        put_id(sector + 0, "RIFF");
+        put_le32(sector + 4, WAV_HEADER_SECTOR_BYTES - 8 + data_bytes);
+        put_id(sector + 8, "WAVE");
+
+        put_id(sector + pos, "fmt ");
+        put_le32(sector + pos + 4, is_adpcm ? 20 : 16);
+        put_le16(sector + pos + 8, audio_format);
+        put_le16(sector + pos + 10, channels);
+        put_le32(sector + pos + 12, sample_rate);
+        put_le32(sector + pos + 16, byte_rate);
+        put_le16(sector + pos + 20, block_align);
+        put_le16(sector + pos + 22, bits_per_sample);
+        pos += 24;
+
+        if (is_adpcm) {
+            // cbSize and wSamplesPerBlock, then the "fact" chunk with the total number of samples
+            put_le16(sector + pos, 2);
+            put_le16(sector + pos + 2, samples_per_block);
+            pos += 4;
+
+            put_id(sector + pos, "fact");
+            put_le32(sector + pos + 4, 4);
+            put_le32(sector + pos + 8, adpcm_samples(data_bytes));
+            pos += 12;
+        }
+
+        if (comment != nullptr) {
+            // "LIST" size "INFO" "ICMT" size text (nul terminated, padded to an even length). The ICMT size is the
+            // text without the pad byte, as for any RIFF chunk, the LIST size counts the pad as it is inside it
+            uint32_t text_bytes = 0;
+            while (comment[text_bytes] != 0 && text_bytes < WAV_HEADER_MAX_COMMENT) {
+                sector[pos + 20 + text_bytes] = comment[text_bytes];
+                text_bytes++;
+            }
+            sector[pos + 20 + text_bytes++] = 0;
+            uint32_t padded_bytes = text_bytes + (text_bytes & 1);
+            if (padded_bytes > text_bytes) {
+                sector[pos + 20 + text_bytes] = 0;
+            }
+
+            put_id(sector + pos, "LIST");
+            put_le32(sector + pos + 4, 4 + 8 + padded_bytes);
+            put_id(sector + pos + 8, "INFO");
+            put_id(sector + pos + 12, "ICMT");
+            put_le32(sector + pos + 16, text_bytes);
+            pos += 20 + padded_bytes;
+        }
+
+        // Pad the rest of the sector up to the "data" chunk
+        uint32_t junk_bytes = WAV_HEADER_SECTOR_BYTES - 8 - pos - 8;
+        put_id(sector + pos, "JUNK");
+        put_le32(sector + pos + 4, junk_bytes);
+        for (uint32_t i = 0; i < junk_bytes; i++) {
+            sector[pos + 8 + i] = 0;
+        }
+
+        put_id(sector + WAV_HEADER_SECTOR_BYTES - 8, "data");
+        put_le32(sector + WAV_HEADER_SECTOR_BYTES - 4, data_bytes);
+    }
+
+    /**
+     * @brief Number of samples in 'data_bytes' of IMA ADPCM, the last block may be short.
+     */
+    static constexpr uint32_t adpcm_samples(uint32_t data_bytes) {
+        uint32_t samples = data_bytes / block_align * samples_per_block;
+        uint32_t partial = data_bytes % block_align;
+
+        if (partial >= 4u * channels) {
+            samples += 1 + (partial - 4 * channels) * 2 / channels;
+        }
+        return samples;
+    }
+
+private:
+    static constexpr void put_id(uint8_t *p, const char *id) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = id[i];
+        }
+    }
+
+    static constexpr void put_le16(uint8_t *p, uint16_t value) {
+        p[0] = value & 0xff;
+        p[1] = (value >> 8) & 0xff;
+    }
+
+    static constexpr void put_le32(uint8_t *p, uint32_t value) {
+        p[0] = value & 0xff;
+        p[1] = (value >> 8) & 0xff;
+        p[2] = (value >> 16) & 0xff;
+        p[3] = (value >> 24) & 0xff;
+    }
+};
+
+#endif /* WAV_HEADER_H */
@@ -1256,6 +1256,7 @@ void MTPStorage::close()
 	// update record with file size
 	Record r = ReadIndexRecord(open_file_);
 	if (!r.isdir) {
+		fileSizeChanged(r.store, r.child, size);
 		r.child = size;
 		WriteIndexRecord(open_file_, r);
 	}
@@ -1620,6 +1621,7 @@ bool MTPStorage::CompleteCopyFile(uint32_t from, uint32_t to)
 	f1.close();
 
 	mtp_lock_storage(true);
+	fileSizeChanged(r.store, r.child, file_.size());
 	r.child = (uint32_t)file_.size();
 	WriteIndexRecord(to, r);
 #if DEBUG > 1
@@ -1682,6 +1684,7 @@ bool MTPStorage::CopyByPathNames(uint32_t store0, char *oldfilename, uint32_t st
 	}
 
 	// close all files
+	fileSizeChanged(store1, 0, f2.size());
 	f1.close();
 	f2.close();
 #if !defined(__IMXRT1062__)
@@ -1729,6 +1732,8 @@ bool MTPStorage::removeFilesystem(uint32_t store)
 	if ((store < fsCount) && (name[store])) {
 		name[store] = nullptr;
 		fs[store] = nullptr;
+		free_space_cb_[store] = nullptr;
+		file_size_cb_[store] = nullptr;
 		// Now lets see about pruning
 		clearStoreIndexItems(store);
 
@@ -57,6 +57,12 @@
 
 typedef bool (STORAGE_LOOP_CB)(uint8_t store, FS *pfs);
 
+// For a store that keeps its own count of free space, e.g. an SD card where usedSize() walks the whole FAT and can
+// take seconds: STORAGE_FREE_SPACE_CB is asked instead of totalSize() - usedSize(), and STORAGE_FILE_SIZE_CB is told
+// each time MTP grows, shrinks or removes a file (0 bytes when gone), or makes or removes a directory (1 byte)
+typedef uint64_t (STORAGE_FREE_SPACE_CB)(void);
+typedef void (STORAGE_FILE_SIZE_CB)(uint64_t old_bytes, uint64_t new_bytes);
+
 // The mtp_fstype_t right now is WIP, the main user is MTP_FSTYPE_SD which calls per each object
 // but USBFS is a class level
 typedef enum {MTP_FSTYPE_UNKNOWN=0, MTP_FSTYPE_SD, MTP_FSTYPE_USBFS} mtp_fstype_t;
@@ -181,7 +187,9 @@ public:
 	}
 	bool mkdir(uint32_t store, char *filename) {
 		if (fs[store] == nullptr) return false;
-		return fs[store]->mkdir(filename);
+		if (!fs[store]->mkdir(filename)) return false;
+		fileSizeChanged(store, 0, 1);
+		return true;
 	}
 	bool rename(uint32_t store, char *oldfilename, char *newfilename) {
 		if (fs[store] == nullptr) return false;
@@ -189,11 +197,21 @@ public:
 	}
 	bool remove(uint32_t store, const char *filename) {
 		if (fs[store] == nullptr) return false;
-		return fs[store]->remove(filename);
+		uint64_t size = 0;
+		if (file_size_cb_[store]) {
+			File f = fs[store]->open(filename, FILE_READ);
+			size = f ? f.size() : 0;
+			f.close();
+		}
+		if (!fs[store]->remove(filename)) return false;
+		fileSizeChanged(store, size, 0);
+		return true;
 	}
 	bool rmdir(uint32_t store, const char *filename) {
 		if (fs[store] == nullptr) return false;
-		return fs[store]->rmdir(filename);
+		if (!fs[store]->rmdir(filename)) return false;
+		fileSizeChanged(store, 1, 0);
+		return true;
 	}
 	uint64_t totalSize(uint32_t store) {
 		if (fs[store] == nullptr) {
@@ -206,6 +224,22 @@ public:
 		if (fs[store] == nullptr) return (uint64_t)-1;
 		return fs[store]->usedSize();
 	}
+	uint64_t freeSize(uint32_t store) {
+		if (fs[store] == nullptr) return 0;
+		if (free_space_cb_[store]) return free_space_cb_[store]();
+		return fs[store]->totalSize() - fs[store]->usedSize();
+	}
+	// Use the store's own free space count, see STORAGE_FREE_SPACE_CB
+	void setSpaceCallbacks(uint32_t store, STORAGE_FREE_SPACE_CB *free_space, STORAGE_FILE_SIZE_CB *file_size) {
+		if (store >= MTPD_MAX_FILESYSTEMS) return;
+		free_space_cb_[store] = free_space;
+		file_size_cb_[store] = file_size;
+	}
+	void fileSizeChanged(uint32_t store, uint64_t old_bytes, uint64_t new_bytes) {
+		if ((store < MTPD_MAX_FILESYSTEMS) && file_size_cb_[store] && (old_bytes != new_bytes)) {
+			file_size_cb_[store](old_bytes, new_bytes);
+		}
+	}
 	bool CompleteCopyFile(uint32_t from, uint32_t to); 
 	bool CopyByPathNames(uint32_t store0, char *oldfilename, uint32_t store1, char *newfilename);
 	bool moveDir(uint32_t store0, char *oldfilename, uint32_t store1, char *newfilename);
@@ -275,6 +309,8 @@ private:
 	const char *name[MTPD_MAX_FILESYSTEMS] = {nullptr};
 	FS *fs[MTPD_MAX_FILESYSTEMS] = {nullptr};
 	mtp_fstype_t fstype_[MTPD_MAX_FILESYSTEMS] = {MTP_FSTYPE_UNKNOWN};
+	STORAGE_FREE_SPACE_CB *free_space_cb_[MTPD_MAX_FILESYSTEMS] = {nullptr};
+	STORAGE_FILE_SIZE_CB *file_size_cb_[MTPD_MAX_FILESYSTEMS] = {nullptr};
 	bool loop_check_known_fstypes_changed_ = false;
 	uint16_t store_first_child_[MTPD_MAX_FILESYSTEMS] = {0};
 	uint8_t store_scanned_[MTPD_MAX_FILESYSTEMS] = {0};
@@ -421,9 +421,9 @@ uint32_t MTP_class::SendObjectInfo(struct MTPContainer &cmd) { // MTP 1.1 spec,
     return MTP_RESPONSE_INVALID_DATASET;
   }
   // Lets see if we have enough room to store this file:
-  uint32_t free_space = storage_.totalSize(store) - storage_.usedSize(store);
+  uint64_t free_space = storage_.freeSize(store);
   if (file_size > free_space) {
-    printf("Size of object:%u is > free space: %u\n", file_size, free_space);
+    printf("Size of object:%u is > free space: %llu\n", file_size, free_space);
     return MTP_RESPONSE_STORAGE_FULL;
   }
   const bool dir = (oformat == 0x3001);
@@ -774,9 +774,9 @@ uint32_t MTP_class::GetStorageInfo(struct MTPContainer &cmd) {
   //elapsedMillis em;
   uint64_t ntotal = storage_.totalSize(store);
   write64(ntotal); // max capacity
-  uint64_t nused = storage_.usedSize(store);
-  write64((ntotal - nused)); // free space (100M)
-  //printf("GetStorageInfo dt:%u tot:%lu, used: %lu\n", (uint32_t)em, ntotal, nused);
+  uint64_t nfree = storage_.freeSize(store);
+  write64(nfree); // free space (100M)
+  //printf("GetStorageInfo dt:%u tot:%lu, free: %lu\n", (uint32_t)em, ntotal, nfree);
   write32(0xFFFFFFFFUL); // free space (objects)
   writestring(name); // storage descriptor
   writestring(_volumeID); // volume identifier
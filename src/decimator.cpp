@@ -0,0 +1,134 @@
+/**
+ * Polyphase FIR sample rate converter for the recording path, see decimator.h.
+ */
+#include "decimator.h"
+#include <dspinst.h>
+#include <math.h>
+
+static double bessel_i0(double x);
+
+/**
+ * @brief Design the polyphase filter for 'output_rate' and start resampling.
+ */
+bool AudioDecimator::begin(uint32_t output_rate) {
+    uint32_t phases = phases_for(output_rate);
+
+    // Pass through while the coefficients are changed
+    resampling = false;
+    rate = DECIMATOR_INPUT_RATE;
+    if (phases == 0 || output_rate == DECIMATOR_INPUT_RATE) {
+        return output_rate == DECIMATOR_INPUT_RATE;
+    }
+
+    up = phases;
+    down = DECIMATOR_INPUT_RATE / (output_rate / phases);
+
+    // Windowed-sinc low pass for the input upsampled by L, with a gain of L so each phase has unity gain
+    uint32_t length = up * DECIMATOR_TAPS;
+    double cutoff = DECIMATOR_CUTOFF * 0.5 * output_rate / ((double)DECIMATOR_INPUT_RATE * up); // cycles/sample
+    double centre = (length - 1) / 2.0;
+    double window_scale = 1.0 / bessel_i0(DECIMATOR_KAISER_BETA);
+
+    for (uint32_t k = 0; k < length; k++) {
+        double t = k - centre;
+        double sinc = (t == 0.0) ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double r = t / centre;
+        double window = bessel_i0(DECIMATOR_KAISER_BETA * sqrt(fmax(0.0, 1.0 - r * r))) * window_scale;
+        long tap = lround(sinc * window * up * 32768.0);
+
+        // Tap k belongs to phase k % L, and multiplies the input sample k / L before the newest
+        uint32_t p = k % up;
+        uint32_t j = DECIMATOR_TAPS - 1 - k / up;
+        coefficients[p * DECIMATOR_TAPS + j] = (tap > 32767) ? 32767 : (tap < -32768) ? -32768 : tap;
+    }
+
+    memset(history, 0, sizeof history);
+    index = 0;
+    phase = 0;
+    dropped_samples = 0;
+    rate = output_rate;
+    __disable_irq();
+    if (output != NULL) {
+        release(output);
+        output = NULL;
+    }
+    resampling = true;
+    __enable_irq();
+
+    return true;
+}
+
+/**
+ * @brief Resample one block of input, transmitting a block whenever one has been filled.
+ */
+void AudioDecimator::update(void) {
+    audio_block_t *block = receiveReadOnly();
+    if (block == NULL) {
+        return;
+    }
+
+    if (!resampling) {
+        transmit(block);
+        release(block);
+        return;
+    }
+
+    memcpy(history + DECIMATOR_TAPS - 1, block->data, AUDIO_BLOCK_SAMPLES * sizeof(int16_t));
+    release(block);
+
+    while (index < AUDIO_BLOCK_SAMPLES) {
+        if (output == NULL) {
+            output = allocate();
+            output_fill = 0;
+        }
+
+        if (output != NULL) {
+            // x[index - TAPS + 1] .. x[index] against phase 'phase', two samples per SMLAD (unaligned loads are
+            // fine on the M7)
+            const int16_t *x = history + index;
+            const int16_t *c = coefficients + phase * DECIMATOR_TAPS;
+            int32_t sum = 0;
+            for (uint32_t j = 0; j < DECIMATOR_TAPS; j += 2) {
+                uint32_t samples;
+                uint32_t taps;
+                memcpy(&samples, x + j, sizeof samples);
+                memcpy(&taps, c + j, sizeof taps);
+                sum = multiply_accumulate_16tx16t_add_16bx16b(sum, samples, taps);
+            }
+            output->data[output_fill++] = signed_saturate_rshift(sum + (1 << 14), 16, 15);
+
+            if (output_fill == AUDIO_BLOCK_SAMPLES) {
+                transmit(output);
+                release(output);
+                output = NULL;
+            }
+        } else {
+            dropped_samples++;
+        }
+
+        // Next output sample is M/L input samples on
+        phase += down;
+        index += phase / up;
+        phase %= up;
+    }
+
+    index -= AUDIO_BLOCK_SAMPLES;
+    memmove(history, history + AUDIO_BLOCK_SAMPLES, (DECIMATOR_TAPS - 1) * sizeof(int16_t));
+}
+
+/**
+ * @brief Modified Bessel function of the first kind, order 0, for the Kaiser window.
+ */
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
@@ -0,0 +1,66 @@
+/**
+ * Free space on the SD card, see disk_space.h.
+ */
+#include "disk_space.h"
+
+static uint32_t bytes_per_cluster = 0;
+static uint32_t cluster_count = 0;
+static uint32_t free_clusters = 0;
+
+/**
+ * @brief Clusters a file of 'bytes' occupies.
+ */
+static uint32_t clusters_for(uint64_t bytes) {
+    return (uint32_t)((bytes + bytes_per_cluster - 1) / bytes_per_cluster);
+}
+
+/**
+ * @brief Count the free clusters on 'volume', call once at boot.
+ */
+bool disk_space_begin(FsVolume *volume) {
+    bytes_per_cluster = volume->bytesPerCluster();
+    cluster_count = volume->clusterCount();
+
+    // freeClusterCount() returns -1 (as unsigned) if the FAT couldn't be read
+    int32_t count = (int32_t)volume->freeClusterCount();
+    if (bytes_per_cluster == 0 || count < 0) {
+        bytes_per_cluster = 0;
+        cluster_count = 0;
+        free_clusters = 0;
+        return false;
+    }
+
+    free_clusters = count;
+    return true;
+}
+
+/**
+ * @brief Account for a file that has grown from 'old_bytes' to 'new_bytes' long.
+ */
+void disk_space_file_grew(uint64_t old_bytes, uint64_t new_bytes) {
+    if (bytes_per_cluster == 0) {
+        return;
+    }
+
+    uint32_t old_clusters = clusters_for(old_bytes);
+    uint32_t new_clusters = clusters_for(new_bytes);
+    if (new_clusters >= old_clusters) {
+        uint32_t used = new_clusters - old_clusters;
+        free_clusters = (used < free_clusters) ? free_clusters - used : 0;
+    } else {
+        free_clusters += old_clusters - new_clusters;
+        if (free_clusters > cluster_count) {
+            free_clusters = cluster_count;
+        }
+    }
+}
+
+/**
+ * @brief Size of the volume in bytes.
+ */
+uint64_t disk_space_total(void) { return (uint64_t)cluster_count * bytes_per_cluster; }
+
+/**
+ * @brief Bytes not yet allocated to any file.
+ */
+uint64_t disk_space_free(void) { return (uint64_t)free_clusters * bytes_per_cluster; }
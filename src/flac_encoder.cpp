@@ -0,0 +1,410 @@
+/**
+ * Streaming lossless (FLAC subset) encoder, see flac_encoder.h.
+ */
+#include "flac_encoder.h"
+#include <string.h>
+
+#define FLAC_VENDOR "audio-guestbook"
+#define FLAC_MAX_RICE_PARAMETER 14 // 15 is the escape code, not used
+
+#define FLAC_SUBFRAME_CONSTANT 0x00
+#define FLAC_SUBFRAME_VERBATIM 0x01
+#define FLAC_SUBFRAME_FIXED 0x08 // | order
+
+#define FLAC_PARTITIONS (1 << FLAC_MAX_PARTITION_ORDER)
+
+static_assert((FLAC_BLOCK_SAMPLES >> FLAC_MAX_PARTITION_ORDER) > FLAC_MAX_FIXED_ORDER,
+              "First Rice partition must be longer than the predictor warm up");
+
+// CRC-8 (x^8 + x^2 + x + 1) of the frame header and CRC-16 (x^16 + x^15 + x^2 + 1) of the whole frame, MSB first
+struct flac_crc_tables {
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+
+    constexpr flac_crc_tables() : crc8(), crc16() {
+        for (int i = 0; i < 256; i++) {
+            uint8_t c8 = i;
+            uint16_t c16 = i << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+                c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+            }
+            crc8[i] = c8;
+            crc16[i] = c16;
+        }
+    }
+};
+static constexpr flac_crc_tables crc_tables;
+
+// MSB first bit writer, at most 24 bits at a time
+typedef struct {
+    uint8_t *out;
+    uint32_t bytes;
+    uint32_t accumulator;
+    uint32_t bits;
+} bit_writer_t;
+
+// Rice parameters chosen for one frame
+typedef struct {
+    uint32_t order; // Partition order
+    uint8_t parameter[FLAC_PARTITIONS];
+} rice_plan_t;
+
+static int32_t residual[FLAC_BLOCK_SAMPLES];
+
+static uint32_t choose_order(const int16_t *pcm);
+static void compute_residual(const int16_t *pcm, uint32_t order);
+static uint32_t plan_rice(uint32_t order, rice_plan_t *plan);
+static size_t encode_frame(flac_encoder_t *encoder, const int16_t *pcm, uint8_t *out);
+static uint8_t sample_rate_code(uint32_t sample_rate);
+static void put_bits(bit_writer_t *writer, uint32_t value, uint32_t bits);
+static void put_rice(bit_writer_t *writer, uint32_t value, uint32_t parameter);
+static void put_be(uint8_t *p, uint32_t value, uint32_t bytes);
+static void put_le32(uint8_t *p, uint32_t value);
+
+/**
+ * @brief Reset the encoder ready for a new recording.
+ */
+void flac_init(flac_encoder_t *encoder, uint32_t sample_rate) {
+    encoder->sample_rate = sample_rate;
+    encoder->frame_number = 0;
+    encoder->total_samples = 0;
+    encoder->min_frame_bytes = UINT32_MAX;
+    encoder->max_frame_bytes = 0;
+}
+
+/**
+ * @brief Encode 'samples' samples (a multiple of FLAC_BLOCK_SAMPLES) as frames in to 'out'.
+ */
+size_t flac_encode(flac_encoder_t *encoder, const int16_t *pcm, uint32_t samples, uint8_t *out) {
+    size_t length = 0;
+
+    for (uint32_t i = 0; i + FLAC_BLOCK_SAMPLES <= samples; i += FLAC_BLOCK_SAMPLES) {
+        size_t frame_bytes = encode_frame(encoder, pcm + i, out + length);
+
+        if (frame_bytes < encoder->min_frame_bytes) {
+            encoder->min_frame_bytes = frame_bytes;
+        }
+        if (frame_bytes > encoder->max_frame_bytes) {
+            encoder->max_frame_bytes = frame_bytes;
+        }
+        encoder->frame_number++;
+        encoder->total_samples += FLAC_BLOCK_SAMPLES;
+        length += frame_bytes;
+    }
+
+    return length;
+}
+
+/**
+ * @brief Build the FLAC_HEADER_BYTES of metadata: STREAMINFO, VORBIS_COMMENT (if there is a comment) and PADDING.
+ */
+void flac_build_header(const flac_encoder_t *encoder, uint8_t *sector, const char *comment) {
+    uint32_t pos = 0;
+
+    memcpy(sector, "fLaC", 4);
+    pos += 4;
+
+    // STREAMINFO, block sizes, frame sizes (0 for unknown), then rate, channels - 1, bits - 1 and total samples packed
+    // in to 64 bits, and no MD5 (all zeros means not computed)
+    sector[pos] = 0x00;
+    put_be(sector + pos + 1, 34, 3);
+    put_be(sector + pos + 4, FLAC_BLOCK_SAMPLES, 2);
+    put_be(sector + pos + 6, FLAC_BLOCK_SAMPLES, 2);
+    put_be(sector + pos + 8, (encoder->max_frame_bytes > 0) ? encoder->min_frame_bytes : 0, 3);
+    put_be(sector + pos + 11, encoder->max_frame_bytes, 3);
+    put_be(sector + pos + 14, (encoder->sample_rate << 12) | (0 << 9) | ((16 - 1) << 4) |
+                                  (uint32_t)((encoder->total_samples >> 32) & 0x0f), 4);
+    put_be(sector + pos + 18, (uint32_t)encoder->total_samples, 4);
+    memset(sector + pos + 22, 0, 16);
+    pos += 4 + 34;
+
+    if (comment != NULL) {
+        // Little endian lengths as in Ogg Vorbis: vendor, one "COMMENT=text" field
+        uint32_t text_bytes = strnlen(comment, FLAC_MAX_COMMENT);
+        uint32_t vendor_bytes = sizeof FLAC_VENDOR - 1;
+        uint32_t block_bytes = 4 + vendor_bytes + 4 + 4 + 8 + text_bytes;
+
+        sector[pos] = 0x04;
+        put_be(sector + pos + 1, block_bytes, 3);
+        pos += 4;
+        put_le32(sector + pos, vendor_bytes);
+        memcpy(sector + pos + 4, FLAC_VENDOR, vendor_bytes);
+        pos += 4 + vendor_bytes;
+        put_le32(sector + pos, 1);
+        put_le32(sector + pos + 4, 8 + text_bytes);
+        memcpy(sector + pos + 8, "COMMENT=", 8);
+        memcpy(sector + pos + 16, comment, text_bytes);
+        pos += 16 + text_bytes;
+    }
+
+    // PADDING to the end of the sector, the last metadata block
+    sector[pos] = 0x80 | 0x01;
+    put_be(sector + pos + 1, FLAC_HEADER_BYTES - pos - 4, 3);
+    memset(sector + pos + 4, 0, FLAC_HEADER_BYTES - pos - 4);
+}
+
+/**
+ * @brief Encode one FLAC_BLOCK_SAMPLES frame, picking the smallest of constant, fixed predictor or verbatim.
+ */
+static size_t encode_frame(flac_encoder_t *encoder, const int16_t *pcm, uint8_t *out) {
+    bit_writer_t writer = {out, 0, 0, 0};
+    uint32_t frame_number = encoder->frame_number;
+    uint8_t crc8 = 0;
+    uint16_t crc16 = 0;
+
+    // Frame header: sync code and fixed block size, 256 samples (code 8), mono, 16 bits (code 4)
+    put_bits(&writer, 0xfff8, 16);
+    put_bits(&writer, (0x08 << 4) | sample_rate_code(encoder->sample_rate), 8);
+    put_bits(&writer, (0x00 << 4) | (0x04 << 1), 8);
+
+    // Frame number, UTF-8 style coding
+    if (frame_number < 0x80) {
+        put_bits(&writer, frame_number, 8);
+    } else {
+        uint32_t extra = (frame_number < 0x800) ? 1 : (frame_number < 0x10000) ? 2 : (frame_number < 0x200000) ? 3
+                         : (frame_number < 0x4000000) ? 4 : 5;
+        put_bits(&writer, ((0xff00 >> (extra + 1)) & 0xff) | (frame_number >> (6 * extra)), 8);
+        while (extra-- > 0) {
+            put_bits(&writer, 0x80 | ((frame_number >> (6 * extra)) & 0x3f), 8);
+        }
+    }
+
+    for (uint32_t i = 0; i < writer.bytes; i++) {
+        crc8 = crc_tables.crc8[crc8 ^ out[i]];
+    }
+    put_bits(&writer, crc8, 8);
+
+    // Subframe
+    bool constant = true;
+    for (uint32_t i = 1; i < FLAC_BLOCK_SAMPLES && constant; i++) {
+        constant = (pcm[i] == pcm[0]);
+    }
+
+    if (constant) {
+        put_bits(&writer, FLAC_SUBFRAME_CONSTANT << 1, 8);
+        put_bits(&writer, (uint16_t)pcm[0], 16);
+    } else {
+        rice_plan_t plan;
+        uint32_t order = choose_order(pcm);
+        compute_residual(pcm, order);
+        uint32_t rice_bits = plan_rice(order, &plan);
+
+        // The estimate is an upper bound, so a frame is never bigger than verbatim
+        if (order * 16 + 6 + rice_bits < FLAC_BLOCK_SAMPLES * 16) {
+            put_bits(&writer, (FLAC_SUBFRAME_FIXED | order) << 1, 8);
+            for (uint32_t i = 0; i < order; i++) {
+                put_bits(&writer, (uint16_t)pcm[i], 16);
+            }
+
+            // Rice coding with 4 bit parameters, then each partition
+            put_bits(&writer, (0x00 << 4) | plan.order, 6);
+            uint32_t partition_samples = FLAC_BLOCK_SAMPLES >> plan.order;
+            uint32_t i = order;
+            for (uint32_t partition = 0; partition < (1u << plan.order); partition++) {
+                uint32_t parameter = plan.parameter[partition];
+                put_bits(&writer, parameter, 4);
+                for (uint32_t end = (partition + 1) * partition_samples; i < end; i++) {
+                    put_rice(&writer, ((uint32_t)residual[i] << 1) ^ (uint32_t)(residual[i] >> 31), parameter);
+                }
+            }
+        } else {
+            put_bits(&writer, FLAC_SUBFRAME_VERBATIM << 1, 8);
+            for (uint32_t i = 0; i < FLAC_BLOCK_SAMPLES; i++) {
+                put_bits(&writer, (uint16_t)pcm[i], 16);
+            }
+        }
+    }
+
+    // Pad to a byte, then the CRC-16 of everything before it
+    if (writer.bits > 0) {
+        put_bits(&writer, 0, 8 - writer.bits);
+    }
+    for (uint32_t i = 0; i < writer.bytes; i++) {
+        crc16 = (crc16 << 8) ^ crc_tables.crc16[(crc16 >> 8) ^ out[i]];
+    }
+    put_bits(&writer, crc16, 16);
+
+    return writer.bytes;
+}
+
+/**
+ * @brief Pick the fixed predictor order with the smallest total absolute residual.
+ */
+static uint32_t choose_order(const int16_t *pcm) {
+    uint32_t total[FLAC_MAX_FIXED_ORDER + 1] = {0};
+    int32_t last[FLAC_MAX_FIXED_ORDER + 1] = {0};
+    uint32_t best = 0;
+
+    // The residual of each order is the difference of successive residuals of the order below, all orders are
+    // compared over the same samples (after the longest warm up)
+    for (uint32_t i = 0; i < FLAC_BLOCK_SAMPLES; i++) {
+        int32_t difference = pcm[i];
+        for (uint32_t order = 0; order <= FLAC_MAX_FIXED_ORDER; order++) {
+            if (i >= FLAC_MAX_FIXED_ORDER) {
+                total[order] += (difference < 0) ? -difference : difference;
+            }
+            int32_t next = difference - last[order];
+            last[order] = difference;
+            difference = next;
+        }
+    }
+
+    for (uint32_t order = 1; order <= FLAC_MAX_FIXED_ORDER; order++) {
+        if (total[order] < total[best]) {
+            best = order;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Residual of the fixed predictor 'order' for samples order .. FLAC_BLOCK_SAMPLES - 1.
+ */
+static void compute_residual(const int16_t *pcm, uint32_t order) {
+    for (uint32_t i = order; i < FLAC_BLOCK_SAMPLES; i++) {
+        switch (order) {
+        case 0:
+            residual[i] = pcm[i];
+            break;
+        case 1:
+            residual[i] = pcm[i] - pcm[i - 1];
+            break;
+        case 2:
+            residual[i] = pcm[i] - 2 * pcm[i - 1] + pcm[i - 2];
+            break;
+        case 3:
+            residual[i] = pcm[i] - 3 * pcm[i - 1] + 3 * pcm[i - 2] - pcm[i - 3];
+            break;
+        default:
+            residual[i] = pcm[i] - 4 * pcm[i - 1] + 6 * pcm[i - 2] - 4 * pcm[i - 3] + pcm[i - 4];
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Choose the partition order and Rice parameters for the residual.
+ *
+ * @return Bits for the partitions (parameters included), an upper bound as sum(u >> k) <= sum(u) >> k.
+ */
+static uint32_t plan_rice(uint32_t order, rice_plan_t *plan) {
+    uint32_t sum[FLAC_PARTITIONS];
+    uint32_t best_bits = UINT32_MAX;
+    uint32_t partition_samples = FLAC_BLOCK_SAMPLES >> FLAC_MAX_PARTITION_ORDER;
+
+    // Sums of the zig-zag folded residual for the smallest partitions, merged pairwise for the larger ones
+    for (uint32_t partition = 0; partition < FLAC_PARTITIONS; partition++) {
+        uint32_t total = 0;
+        uint32_t start = (partition == 0) ? order : 0;
+        for (uint32_t i = partition * partition_samples + start; i < (partition + 1) * partition_samples; i++) {
+            total += ((uint32_t)residual[i] << 1) ^ (uint32_t)(residual[i] >> 31);
+        }
+        sum[partition] = total;
+    }
+
+    for (int32_t partition_order = FLAC_MAX_PARTITION_ORDER; partition_order >= 0; partition_order--) {
+        uint32_t partitions = 1u << partition_order;
+        uint32_t bits = 0;
+        uint8_t parameter[FLAC_PARTITIONS];
+
+        if (partition_order < FLAC_MAX_PARTITION_ORDER) {
+            for (uint32_t partition = 0; partition < partitions; partition++) {
+                sum[partition] = sum[2 * partition] + sum[2 * partition + 1];
+            }
+        }
+
+        for (uint32_t partition = 0; partition < partitions; partition++) {
+            uint32_t samples = (FLAC_BLOCK_SAMPLES >> partition_order) - ((partition == 0) ? order : 0);
+            uint32_t partition_bits = UINT32_MAX;
+
+            for (uint32_t k = 0; k <= FLAC_MAX_RICE_PARAMETER; k++) {
+                uint32_t estimate = samples * (k + 1) + (sum[partition] >> k);
+                if (estimate < partition_bits) {
+                    partition_bits = estimate;
+                    parameter[partition] = k;
+                }
+            }
+            bits += 4 + partition_bits;
+        }
+
+        if (bits < best_bits) {
+            best_bits = bits;
+            plan->order = partition_order;
+            memcpy(plan->parameter, parameter, partitions);
+        }
+    }
+
+    return best_bits;
+}
+
+/**
+ * @brief Frame header sample rate code, 0 (from STREAMINFO) for rates without their own code.
+ */
+static uint8_t sample_rate_code(uint32_t sample_rate) {
+    switch (sample_rate) {
+    case 8000:
+        return 0x04;
+    case 16000:
+        return 0x05;
+    case 22050:
+        return 0x06;
+    case 24000:
+        return 0x07;
+    case 32000:
+        return 0x08;
+    case 44100:
+        return 0x09;
+    case 48000:
+        return 0x0a;
+    case 96000:
+        return 0x0b;
+    default:
+        return 0x00;
+    }
+}
+
+/**
+ * @brief Append the low 'bits' (up to 24) of 'value'.
+ */
+static void put_bits(bit_writer_t *writer, uint32_t value, uint32_t bits) {
+    writer->accumulator = (writer->accumulator << bits) | (value & ((1u << bits) - 1));
+    writer->bits += bits;
+    while (writer->bits >= 8) {
+        writer->bits -= 8;
+        writer->out[writer->bytes++] = writer->accumulator >> writer->bits;
+    }
+}
+
+/**
+ * @brief Append 'value' Rice coded with 'parameter': the quotient in unary (zeros ended by a one), then the low bits.
+ */
+static void put_rice(bit_writer_t *writer, uint32_t value, uint32_t parameter) {
+    uint32_t quotient = value >> parameter;
+
+    while (quotient >= 16) {
+        put_bits(writer, 0, 16);
+        quotient -= 16;
+    }
+    put_bits(writer, 1, quotient + 1);
+    put_bits(writer, value, parameter);
+}
+
+/**
+ * @brief Store the low 'bytes' of 'value' big endian.
+ */
+static void put_be(uint8_t *p, uint32_t value, uint32_t bytes) {
+    for (uint32_t i = 0; i < bytes; i++) {
+        p[i] = value >> (8 * (bytes - 1 - i));
+    }
+}
+
+/**
+ * @brief Store 'value' little endian.
+ */
+static void put_le32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
@@ -0,0 +1,132 @@
+/**
+ * Streaming IMA ADPCM encoder, see ima_adpcm.h.
+ */
+#include "ima_adpcm.h"
+#include <string.h>
+
+static const int16_t step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,
+    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,   337,   371,   408,   449,   494,
+    544,   598,   658,   724,   796,   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,
+    9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+static const int8_t index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static uint8_t encode_sample(ima_adpcm_encoder_t *encoder, int32_t sample);
+
+/**
+ * @brief Reset the encoder ready for a new recording.
+ */
+void ima_adpcm_init(ima_adpcm_encoder_t *encoder) {
+    encoder->predictor = 0;
+    encoder->index = 0;
+    encoder->block_fill = 0;
+}
+
+/**
+ * @brief Encode 'samples' samples, copying any blocks that are completed to 'out'.
+ */
+size_t ima_adpcm_encode(ima_adpcm_encoder_t *encoder, const int16_t *pcm, uint32_t samples, uint8_t *out) {
+    size_t out_bytes = 0;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        int32_t sample = pcm[i];
+        uint32_t fill = encoder->block_fill;
+
+        if (fill == 0) {
+            // Block header: first sample as is, step index, reserved byte
+            encoder->predictor = sample;
+            encoder->block[0] = sample & 0xff;
+            encoder->block[1] = (sample >> 8) & 0xff;
+            encoder->block[2] = encoder->index;
+            encoder->block[3] = 0;
+        } else {
+            // Sample n goes in the low nibble for odd n, high nibble for even n
+            uint8_t code = encode_sample(encoder, sample);
+            uint8_t *p = &encoder->block[4 + (fill - 1) / 2];
+            if (fill & 1) {
+                *p = code;
+            } else {
+                *p |= code << 4;
+            }
+        }
+
+        if (++fill == IMA_ADPCM_SAMPLES_PER_BLOCK) {
+            memcpy(out + out_bytes, encoder->block, IMA_ADPCM_BLOCK_BYTES);
+            out_bytes += IMA_ADPCM_BLOCK_BYTES;
+            fill = 0;
+        }
+        encoder->block_fill = fill;
+    }
+
+    return out_bytes;
+}
+
+/**
+ * @brief Finish the recording, copying the last (short) block to 'out'.
+ */
+size_t ima_adpcm_flush(ima_adpcm_encoder_t *encoder, uint8_t *out) {
+    uint32_t fill = encoder->block_fill;
+
+    if (fill == 0) {
+        return 0;
+    }
+
+    // Header plus enough bytes for the remaining nibbles, an odd one out leaves a zero high nibble
+    size_t bytes = 4 + fill / 2;
+    memcpy(out, encoder->block, bytes);
+    encoder->block_fill = 0;
+
+    return bytes;
+}
+
+/**
+ * @brief Encode one sample to a 4 bit code, keeping the predictor in step with what the decoder will produce.
+ */
+static uint8_t encode_sample(ima_adpcm_encoder_t *encoder, int32_t sample) {
+    int32_t step = step_table[encoder->index];
+    int32_t diff = sample - encoder->predictor;
+    int32_t delta = step >> 3;
+    uint8_t code = 0;
+
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        delta += step;
+    }
+
+    int32_t predictor = (code & 8) ? encoder->predictor - delta : encoder->predictor + delta;
+    if (predictor > 32767) {
+        predictor = 32767;
+    } else if (predictor < -32768) {
+        predictor = -32768;
+    }
+    encoder->predictor = predictor;
+
+    int32_t index = encoder->index + index_table[code];
+    if (index < 0) {
+        index = 0;
+    } else if (index > 88) {
+        index = 88;
+    }
+    encoder->index = index;
+
+    return code;
+}
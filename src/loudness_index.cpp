@@ -0,0 +1,71 @@
+/**
+ * Sidecar index of the levels of every recording, see loudness_index.h.
+ */
+#include "loudness_index.h"
+#include "disk_space.h"
+
+// Records read at a time when listing
+#define LIST_RECORDS 64
+
+/**
+ * @brief Append the levels of a recording to the index, creating it if need be.
+ */
+bool loudness_index_append(const loudness_record_t *record) {
+    FsFile file = SD.sdfs.open(LOUDNESS_INDEX_FILE, O_RDWR | O_CREAT);
+    if (!file) {
+        return false;
+    }
+
+    uint64_t old_size = file.fileSize();
+    if (old_size < sizeof(loudness_index_header_t)) {
+        // New, or a power cut before the header was all written, start it afresh
+        loudness_index_header_t header = {LOUDNESS_INDEX_MAGIC, sizeof(loudness_record_t), LOUDNESS_INDEX_VERSION};
+        file.truncate(0);
+        file.write(&header, sizeof header);
+    } else {
+        // Leave out any part record left by a power cut mid-append
+        uint64_t records = (old_size - sizeof(loudness_index_header_t)) / sizeof(loudness_record_t);
+        file.seekSet(sizeof(loudness_index_header_t) + records * sizeof(loudness_record_t));
+    }
+
+    bool ok = file.write(record, sizeof *record) == sizeof *record;
+    uint64_t new_size = file.fileSize();
+    file.close();
+
+    disk_space_file_grew(old_size, new_size);
+    return ok;
+}
+
+/**
+ * @brief Call 'visit' for each record in the index, oldest first.
+ */
+uint32_t loudness_index_list(loudness_index_visit_fn visit) {
+    loudness_index_header_t header;
+    loudness_record_t records[LIST_RECORDS];
+    uint32_t visited = 0;
+
+    FsFile file = SD.sdfs.open(LOUDNESS_INDEX_FILE, O_RDONLY);
+    if (!file) {
+        return 0;
+    }
+
+    if (file.read(&header, sizeof header) != sizeof header || header.magic != LOUDNESS_INDEX_MAGIC ||
+        header.record_bytes != sizeof(loudness_record_t)) {
+        file.close();
+        return 0;
+    }
+
+    int length;
+    while ((length = file.read(records, sizeof records)) >= (int)sizeof(loudness_record_t)) {
+        for (uint32_t i = 0; i < length / sizeof(loudness_record_t); i++) {
+            visited++;
+            if (!visit(&records[i])) {
+                file.close();
+                return visited;
+            }
+        }
+    }
+    file.close();
+
+    return visited;
+}
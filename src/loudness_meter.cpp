@@ -0,0 +1,165 @@
+/**
+ * Streaming level analysis of recordings, see loudness_meter.h.
+ */
+#include "loudness_meter.h"
+#include <math.h>
+#include <string.h>
+
+// K-weighting filter parameters from BS.1770, as analogue prototypes so they can be designed for any sample rate
+#define SHELF_HZ 1681.974450955533
+#define SHELF_GAIN_DB 3.999843853973347
+#define SHELF_Q 0.7071752369554196
+#define SHELF_VB_EXPONENT 0.4996667741545416
+#define HIGH_PASS_HZ 38.13547087602444
+#define HIGH_PASS_Q 0.5003270373238773
+
+static void design_shelf(loudness_biquad_t *filter, uint32_t sample_rate);
+static void design_high_pass(loudness_biquad_t *filter, uint32_t sample_rate);
+static int16_t to_cb(double db);
+
+/**
+ * @brief Reset the meter and design the K-weighting filters for 'sample_rate'.
+ */
+void loudness_init(loudness_meter_t *meter, uint32_t sample_rate) {
+    memset(meter, 0, sizeof *meter);
+    meter->sample_rate = sample_rate;
+    meter->step_samples = sample_rate / 10;
+    design_shelf(&meter->shelf, sample_rate);
+    design_high_pass(&meter->high_pass, sample_rate);
+}
+
+/**
+ * @brief Measure the next 'samples' samples.
+ */
+void loudness_block(loudness_meter_t *meter, const int16_t *pcm, uint32_t samples) {
+    loudness_biquad_t *s = &meter->shelf;
+    loudness_biquad_t *h = &meter->high_pass;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        int32_t x = pcm[i];
+        uint16_t magnitude = (x < 0) ? -x : x;
+
+        meter->sum_squares += x * x;
+        if (magnitude > meter->peak) {
+            meter->peak = magnitude;
+        }
+        if (magnitude >= LOUDNESS_CLIP_LEVEL) {
+            meter->clipped++;
+        }
+
+        // K-weighting, two biquads in transposed direct form II
+        float in = x * (1.0f / 32768.0f);
+        float y = s->b0 * in + s->z1;
+        s->z1 = s->b1 * in - s->a1 * y + s->z2;
+        s->z2 = s->b2 * in - s->a2 * y;
+        float k = h->b0 * y + h->z1;
+        h->z1 = h->b1 * y - h->a1 * k + h->z2;
+        h->z2 = h->b2 * y - h->a2 * k;
+        meter->step_energy += k * k;
+
+        if (++meter->step_fill < meter->step_samples) {
+            continue;
+        }
+
+        // Every 100ms the newest 400ms gating block is complete
+        meter->steps[meter->step_count++ & 3] = meter->step_energy / meter->step_samples;
+        meter->step_fill = 0;
+        meter->step_energy = 0.0f;
+        if (meter->step_count < 4) {
+            continue;
+        }
+
+        float z = (meter->steps[0] + meter->steps[1] + meter->steps[2] + meter->steps[3]) * 0.25f;
+        float lufs = -0.691f + 10.0f * log10f(z + 1e-20f);
+        if (lufs > LOUDNESS_FLOOR_LUFS) {
+            int32_t bin = (int32_t)((lufs - LOUDNESS_FLOOR_LUFS) * LOUDNESS_BINS_PER_LU);
+            bin = (bin >= LOUDNESS_BINS) ? LOUDNESS_BINS - 1 : bin;
+            if (meter->histogram[bin] < UINT16_MAX) {
+                meter->histogram[bin]++;
+            }
+        }
+    }
+    meter->samples += samples;
+}
+
+/**
+ * @brief Levels of everything measured since loudness_init().
+ */
+void loudness_result(const loudness_meter_t *meter, loudness_t *result) {
+    double power[LOUDNESS_BINS];
+    double total = 0.0;
+    uint32_t count = 0;
+
+    result->clipped = meter->clipped;
+    result->peak_cb = to_cb(20.0 * log10((meter->peak + 1e-9) / 32768.0));
+    result->rms_cb = (meter->samples > 0)
+                         ? to_cb(10.0 * log10((double)meter->sum_squares / meter->samples / (32768.0 * 32768.0) + 1e-20))
+                         : LOUDNESS_SILENT_CB;
+
+    // Blocks above the absolute gate, each bin stands for blocks at its centre loudness
+    for (uint32_t i = 0; i < LOUDNESS_BINS; i++) {
+        double lufs = LOUDNESS_FLOOR_LUFS + (i + 0.5) / LOUDNESS_BINS_PER_LU;
+        power[i] = pow(10.0, (lufs + 0.691) / 10.0);
+        total += power[i] * meter->histogram[i];
+        count += meter->histogram[i];
+    }
+    if (count == 0) {
+        result->lufs_cb = LOUDNESS_SILENT_CB;
+        return;
+    }
+
+    // Then only those within 10 LU of the loudness of the blocks above the absolute gate
+    double relative_gate = -0.691 + 10.0 * log10(total / count) - 10.0;
+    uint32_t first = (relative_gate > LOUDNESS_FLOOR_LUFS)
+                         ? (uint32_t)((relative_gate - LOUDNESS_FLOOR_LUFS) * LOUDNESS_BINS_PER_LU)
+                         : 0;
+    total = 0.0;
+    count = 0;
+    for (uint32_t i = first; i < LOUDNESS_BINS; i++) {
+        total += power[i] * meter->histogram[i];
+        count += meter->histogram[i];
+    }
+    result->lufs_cb = (count > 0) ? to_cb(-0.691 + 10.0 * log10(total / count)) : LOUDNESS_SILENT_CB;
+}
+
+/**
+ * @brief High shelf with the K-weighting stage 1 response at 'sample_rate', by the bilinear transform so that at 48kHz
+ * it gives the coefficients tabulated in BS.1770.
+ */
+static void design_shelf(loudness_biquad_t *filter, uint32_t sample_rate) {
+    double k = tan(M_PI * SHELF_HZ / sample_rate);
+    double vh = pow(10.0, SHELF_GAIN_DB / 20.0);
+    double vb = pow(vh, SHELF_VB_EXPONENT);
+    double a0 = 1.0 + k / SHELF_Q + k * k;
+
+    filter->b0 = (vh + vb * k / SHELF_Q + k * k) / a0;
+    filter->b1 = 2.0 * (k * k - vh) / a0;
+    filter->b2 = (vh - vb * k / SHELF_Q + k * k) / a0;
+    filter->a1 = 2.0 * (k * k - 1.0) / a0;
+    filter->a2 = (1.0 - k / SHELF_Q + k * k) / a0;
+    filter->z1 = filter->z2 = 0.0f;
+}
+
+/**
+ * @brief High pass with the K-weighting stage 2 response at 'sample_rate'.
+ */
+static void design_high_pass(loudness_biquad_t *filter, uint32_t sample_rate) {
+    double k = tan(M_PI * HIGH_PASS_HZ / sample_rate);
+    double a0 = 1.0 + k / HIGH_PASS_Q + k * k;
+
+    // BS.1770 leaves the numerator unnormalised (1, -2, 1), its gain is within 0.01dB of unity
+    filter->b0 = 1.0;
+    filter->b1 = -2.0;
+    filter->b2 = 1.0;
+    filter->a1 = 2.0 * (k * k - 1.0) / a0;
+    filter->a2 = (1.0 - k / HIGH_PASS_Q + k * k) / a0;
+    filter->z1 = filter->z2 = 0.0f;
+}
+
+/**
+ * @brief Decibels to centibels, clamped to what an int16_t holds.
+ */
+static int16_t to_cb(double db) {
+    double cb = db * 100.0;
+    return (cb < LOUDNESS_SILENT_CB) ? LOUDNESS_SILENT_CB : (cb > 32767.0) ? 32767 : (int16_t)lround(cb);
+}
@@ -48,7 +48,21 @@
  *
  */
 
+#include "play_memory_wav.h"
 #include "play_sd_wav.h"
+#include "prompt_cache.h"
+#include "decimator.h"
+#include "disk_space.h"
+#include "record_ring.h"
+#include "recorder.h"
+#include "recording_catalogue.h"
+#include "recording_container.h"
+#include "recording_mirror.h"
+#include "recording_recovery.h"
+#include "flac_encoder.h"
+#include "loudness_index.h"
+#include "ima_adpcm.h"
+#include "wav_header.h"
 #include <Arduino.h>
 #include <Audio.h>
 #include <Bounce.h>
@@ -57,6 +71,12 @@
 #include <SerialFlash.h>
 #include <TimeLib.h>
 #include <Wire.h>
+#if MIRROR_TARGET == MIRROR_QSPI_FLASH
+#include <LittleFS.h>
+#endif
+#if defined(USB_MTPDISK) || defined(USB_MTPDISK_SERIAL)
+#include <MTP_Teensy.h>
+#endif
 
 /* Defines */
 #define DEBUG false       // To print to serial output or not, true == print
@@ -68,9 +88,11 @@
 
 #define HANDSET_PIN 41      // Handset switch
 #define PRESS_PIN 40        // PRESS switch
-#define WARNING_DELAY 1000  // Play a warning sound every 'n' milliseconds
+#define WARNING_DELAY 1000  // Play a warning sound every 'n' milliseconds of recording
+#define WARNING_BEEP_MS 50  // Length of each warning sound
 #define LED_BLINK_DELAY 1000 // Blink LED every 'n' milliseconds
 #define UPDATE_DELAY 60000   // Send message to admin monitor application (ESP32) via UART every 'n' milliseconds
+#define RECORDING_OPEN_TRIES 100 // Recording numbers to try when the next one is already on the card
 
 // set this to the hardware serial port we are going to use to connect to ESP32. Needs to be a
 // higher serial port due to the audio shield taking up all the lower pins. 
@@ -81,6 +103,8 @@ static const uint8_t morse_time_unit = 80;         // Morse code time unit, leng
 static const uint32_t max_recording_time = 180'000; // Recording time limit (milliseconds) 
 // Recording time limit (milliseconds) warning, will start to sound a beep in users ear.
 static const uint32_t max_recording_time_warning = 10'000;
+// Sounds played from memory rather than the card, loaded at boot
+static const char *const cached_prompts[] = {"record.wav"};
 
 // 60000 = 1 min
 // 120000 =  2 mins
@@ -89,28 +113,105 @@ static const uint32_t max_recording_time_warning = 10'000;
 // 600000 = 10 mins
 
 /* Globals */
-AudioPlaySdWav wave_file;              // Play 44.1kHz 16-bit PCM .WAV files
+AudioPlaySdWavX wave_file;             // Play 8-48kHz 8/16-bit PCM .WAV files, read ahead from loop()
+AudioPlayMemoryWav prompt_player;      // Play sounds cached in memory at boot
 AudioInputI2S audio_input;             // I2S input from microphone on Teensy 4.0 Audio shield
 AudioMixer4 mixer;                     // Allows merging several inputs to same output
-AudioRecordQueue queue1;               // Create an audio buffer in memory before saving to SD
+AudioMixer4 prompt_mixer;              // Prompt from the card or from memory
+AudioRecordRing record_ring;           // Lock-free ring of audio blocks drained to SD by the recorder
 AudioSynthWaveform synth_waveform;     // To create the "beep" sound effect
 AudioSynthWaveform synth_waveform_350; // To create UK dial tone
 AudioSynthWaveform synth_waveform_450; // To create UK dial tone
 AudioOutputI2S audio_output;           // I2S output to Speaker Out on Teensy 4.0 Audio shield
 AudioConnection patchCord1(synth_waveform, 0, mixer, 0);
-AudioConnection patchCord2(wave_file, 0, mixer, 1);
+AudioConnection patchCord2(prompt_mixer, 0, mixer, 1);
 AudioConnection patchCord3(mixer, 0, audio_output, 0); // mixer output to speaker (L)
 AudioConnection patchCord4(mixer, 0, audio_output, 1); // mixer output to speaker (R)
 AudioConnection patchCord5(synth_waveform_350, 0, mixer, 2);
 AudioConnection patchCord6(synth_waveform_450, 0, mixer, 3);
-AudioConnection patchCord7(audio_input, 0, queue1, 0); // mic input to queue (L)
+AudioDecimator decimator;              // Resample the mic down to RECORDER_SAMPLE_RATE for recording
+AudioConnection patchCord7(audio_input, 0, decimator, 0); // mic input to recording (L)
+AudioConnection patchCord8(decimator, 0, record_ring, 0);
+AudioConnection patchCord9(wave_file, 0, prompt_mixer, 0);
+AudioConnection patchCord10(prompt_player, 0, prompt_mixer, 1);
 AudioControlSGTL5000 audio_shield;
 
+#if MIRROR_TARGET == MIRROR_SPI_SD
+SDClass mirror_fs; // Audio board SD card, recordings are copied here between calls
+#elif MIRROR_TARGET == MIRROR_QSPI_FLASH
+LittleFS_QSPIFlash mirror_fs;
+#endif
+
+// Format of the recordings, RECORDER_SAMPLE_RATE mono, 16-bit PCM, or 4-bit IMA ADPCM or FLAC encoded on the fly by
+// the recorder
+static_assert(AudioDecimator::phases_for(RECORDER_SAMPLE_RATE) > 0, "RECORDER_SAMPLE_RATE not supported");
+#if RECORDER_FORMAT == RECORDER_FORMAT_FLAC
+static flac_encoder_t flac_encoder;
+static void flac_reset(void) { flac_init(&flac_encoder, RECORDER_SAMPLE_RATE); }
+static size_t flac_encode_samples(const int16_t *pcm, uint32_t samples, uint8_t *out) {
+    return flac_encode(&flac_encoder, pcm, samples, out);
+}
+static size_t flac_flush(uint8_t *out) { (void)out; return 0; } // Every frame is a whole audio block, none held back
+static void flac_header(uint8_t *sector, uint32_t data_bytes, const char *comment) {
+    (void)data_bytes; // The frame sizes come from the encoder
+    // Only count the frames in the file, a checkpoint can come while the encoder has more waiting for a whole sector
+    flac_encoder_t saved = flac_encoder;
+    saved.total_samples = recorder_samples_saved();
+    flac_build_header(&saved, sector, comment);
+}
+static void flac_trim(uint32_t samples) { flac_encoder.total_samples = samples; }
+static const recorder_format_t recording_format = {FLAC_HEADER_BYTES, RECORDER_SAMPLE_RATE,
+                                                   FLAC_MAX_FRAME_BYTES * RECORDER_SAMPLE_RATE / FLAC_BLOCK_SAMPLES,
+                                                   FLAC_BLOCK_SAMPLES, "flac",
+                                                   flac_header, flac_reset, flac_encode_samples, flac_flush,
+                                                   flac_trim};
+#elif RECORDER_FORMAT == RECORDER_FORMAT_IMA_ADPCM
+typedef WavHeader<1, RECORDER_SAMPLE_RATE, 4, WAV_FORMAT_IMA_ADPCM> recording_wav_t;
+static ima_adpcm_encoder_t adpcm_encoder;
+static void adpcm_reset(void) { ima_adpcm_init(&adpcm_encoder); }
+static size_t adpcm_encode(const int16_t *pcm, uint32_t samples, uint8_t *out) {
+    return ima_adpcm_encode(&adpcm_encoder, pcm, samples, out);
+}
+static size_t adpcm_flush(uint8_t *out) { return ima_adpcm_flush(&adpcm_encoder, out); }
+static const recorder_format_t recording_format = {recording_wav_t::header_bytes, recording_wav_t::sample_rate,
+                                                   recording_wav_t::byte_rate, recording_wav_t::samples_per_block,
+                                                   "wav", recording_wav_t::build, adpcm_reset, adpcm_encode,
+                                                   adpcm_flush, NULL};
+#else
+typedef WavHeader<1, RECORDER_SAMPLE_RATE, 16> recording_wav_t;
+static const recorder_format_t recording_format = {recording_wav_t::header_bytes, recording_wav_t::sample_rate,
+                                                   recording_wav_t::byte_rate, recording_wav_t::samples_per_block,
+                                                   "wav", recording_wav_t::build, NULL, NULL, NULL, NULL};
+#endif
+
+#if RECORDER_CONTAINER
+// Stored as a segment of the container, the segment header sector goes in front of the recording's own header and is
+// kept up to date by the recorder's checkpoints along with it
+static void segment_header(uint8_t *header, uint32_t data_bytes, const char *comment) {
+    container_segment_header(header, recording_format.header_bytes, data_bytes);
+    recording_format.build_header(header + CONTAINER_SECTOR_BYTES, data_bytes, comment);
+}
+static const recorder_format_t stored_format = {CONTAINER_SECTOR_BYTES + recording_format.header_bytes,
+                                                recording_format.sample_rate, recording_format.byte_rate,
+                                                recording_format.block_samples, recording_format.extension,
+                                                segment_header, recording_format.reset, recording_format.encode,
+                                                recording_format.flush, recording_format.trim};
+#else
+static const recorder_format_t &stored_format = recording_format;
+#endif
+
 // Structure for sending data to ESP32 monitor application
 typedef struct __attribute__ ((packed, aligned(1))) {
     uint8_t mode;
     uint16_t recordings;
     uint64_t disk_remaining;
+    uint16_t repaired;        // Recordings repaired at boot after a power cut
+    uint32_t recovery_millis; // Time taken by the boot catalogue/recovery pass
+    uint16_t last_number;     // Levels of the last recording made, dB/LUFS x 100
+    int16_t last_rms;
+    int16_t last_peak;
+    int16_t last_loudness;
+    uint32_t last_clipped;    // Samples at full scale
 } status_data_t;
 
 status_data_t audio_guestbook_data;
@@ -137,13 +238,24 @@ dial_tone_state_t dial_tone = OFF;
 float beep_volume = 0.9f; // not too loud
 int led_state = LOW;      // LED state, LOW or HIGH
 // static int one_second = 1000;
-char filename[15]; // Filename to save audio recording on SD card
-File file_object;  // The file object itself
+char filename[CATALOGUE_PATH_BYTES]; // Path to save audio recording on SD card
+FsFile file_object; // The file object itself
 unsigned long record_bytes_saved = 0L;
 uint32_t wait_start = 0;
-elapsedMillis recording_timer = 0;  // Recording timer to prevent long messages
-uint16_t number_of_recordings = 0;  // Number of recordings since last started
+uint32_t next_warning_samples = 0; // Length of the recording at which the next warning beep is due
+elapsedMillis warning_beep_timer;   // Time the warning beep has been sounding
+bool warning_beep_on = false;
+uint8_t header_sector[RECORDER_MAX_HEADER_BYTES] __attribute__((aligned(4))); // Header reserved at start of file
+uint64_t recording_start = 0;       // Where the recording starts in file_object, 0 unless in the container
+uint16_t recording_number = 0;      // Number of the recording in progress, from the catalogue
+uint32_t recording_timestamp = 0;   // FAT date and time the recording in progress started
+uint8_t recording_flags = 0;        // Catalogue flags for the recording in progress
+bool recording_closing = false;     // Recording stopped but still being flushed to the card (RECORDER_RAM_MODE)
+bool prompt_cached = false;         // Prompt playing is from the prompt cache rather than the SD card
 uint64_t total_disk_size = 0;       // SD Card disk size
+#if defined(USB_MTPDISK) || defined(USB_MTPDISK_SERIAL)
+uint32_t mtp_store = 0;             // The SD card's MTP store
+#endif
 
 // Debounce on switches
 Bounce phone_handset = Bounce(HANDSET_PIN, 40);
@@ -158,16 +270,19 @@ static void sd_card_error(void);
 static void blink_led(void);
 static void update_admin_monitor(bool mode_changed);
 static time_t get_teensy_three_time(void);
+static void fat_date_time(uint16_t *date, uint16_t *time, uint8_t *ms10);
+static bool make_recording_directories(void);
 // static void print_digits(int digits);
 // static void digital_clock_display(void);
 // static void print_time(void);
 static void sound_warning(void);
 static void start_recording(void);
-static void continue_recording(void);
 static void stop_recording(void);
-static void write_out_wav_header(void);
+static void close_recording(void);
+static void write_out_header(void);
 #if DEBUG
 static void print_mode(void); // for debugging only
+static bool print_levels(const loudness_record_t *record);
 #endif
 static void dialing_tone(dial_tone_state_t on_or_off);
 
@@ -199,6 +314,7 @@ void setup() {
 #endif
 
     setSyncProvider(get_teensy_three_time); // the function to get the time from the RTC
+    FsDateTime::setCallback(fat_date_time);  // and stamp files and directories with it
     if (timeStatus() != timeSet) {
 #if DEBUG
         Serial.println("Unable to sync with the RTC");
@@ -233,6 +349,17 @@ void setup() {
     // audio samples, or approx 5.8 ms of sound.
     AudioMemory(100);
 
+    // SD writes happen in the recorder's own low priority context, not in loop()
+    recorder_init(&record_ring);
+    // Messages are cut off after exactly this much audio, however busy loop() is
+    recorder_set_limit(max_recording_time);
+    decimator.begin(RECORDER_SAMPLE_RATE);
+
+#if DEBUG
+    Serial.printf("Recording buffer: %lu blocks in %s\n", recorder_capacity(),
+                  (external_psram_size > 0) ? "PSRAM" : "internal RAM");
+#endif
+
     // Comment these out if not using the audio adaptor board.
     audio_shield.enable();
     audio_shield.volume(0.6);
@@ -287,12 +414,103 @@ void setup() {
     #endif
     
     if (b_sd_card) {
-        total_disk_size = SD.totalSize();
+        // One pass over the card to find all the existing recordings, repairing any left unfinalised by a power cut
+        elapsedMillis recovery_timer = 0;
+        recovery_begin();
+        if (!catalogue_build(recovery_visit)) {
+            #if DEBUG
+                Serial.println("Unable to build recording catalogue");
+            #endif
+        }
+        #if RECORDER_CONTAINER
+            // Recordings from now on go in to the container, which stays open. The ones already in it are added to
+            // the catalogue, and if a recording was cut short its index is rebuilt from the segment headers
+            if (!container_open(&file_object)) {
+                #if DEBUG
+                    Serial.println("Unable to open recording container");
+                #endif
+            }
+            #if DEBUG
+                Serial.printf("Recording container: %lu recordings%s\n", container_count(),
+                              container_rebuilt() ? ", index rebuilt" : "");
+            #endif
+        #endif
+        audio_guestbook_data.repaired = recovery_repaired() + (container_rebuilt() ? 1 : 0);
+        audio_guestbook_data.recovery_millis = recovery_timer;
+        #if DEBUG
+            Serial.print("Recordings on SD card: "); Serial.println(catalogue_count());
+            Serial.printf("Recovery: %u repaired, %u unrepairable in %lu ms\n", recovery_repaired(),
+                          recovery_unrepairable(), (uint32_t)recovery_timer);
+            elapsedMicros list_timer = 0;
+            #if RECORDER_CONTAINER
+                uint32_t listed = container_list_levels(&file_object, print_levels);
+            #else
+                uint32_t listed = loudness_index_list(print_levels);
+            #endif
+            Serial.printf("Loudness index: %lu recordings in %lu us\n", listed, (uint32_t)list_timer);
+        #endif
+
+        // The only full count of the free space, from here on each recording's clusters are taken off as it closes
+        elapsedMillis disk_space_timer = 0;
+        disk_space_begin(&SD.sdfs);
+        total_disk_size = disk_space_total();
         #if DEBUG
             Serial.print("SD card size: "); Serial.println(total_disk_size);
-            Serial.print("SD space used: "); Serial.println(SD.usedSize());
+            Serial.print("SD space free: "); Serial.println(disk_space_free());
+            Serial.printf("Free space counted in %lu ms\n", (uint32_t)disk_space_timer);
+        #endif
+        audio_guestbook_data.disk_remaining = RECORDER_CONTAINER ? container_free() : disk_space_free();
+
+        // Recordings copied off over USB, the computer is given the same free space count and MTP keeps it up to date
+        #if defined(USB_MTPDISK) || defined(USB_MTPDISK_SERIAL)
+            MTP.begin();
+            mtp_store = MTP.addFilesystem(SD, "Guestbook");
+            MTP.storage()->setSpaceCallbacks(mtp_store, disk_space_free, disk_space_file_grew);
+        #endif
+
+        #if MIRROR_TARGET == MIRROR_SPI_SD
+            bool mirror_ok = mirror_fs.begin(MIRROR_SD_CS_PIN);
+        #elif MIRROR_TARGET == MIRROR_QSPI_FLASH
+            bool mirror_ok = mirror_fs.begin();
+        #endif
+        #if MIRROR_TARGET != MIRROR_NONE
+            if (mirror_ok) {
+                mirror_begin(&mirror_fs);
+            }
+            #if DEBUG
+                Serial.printf("Mirror: %s, %u recordings to copy\n", mirror_ok ? "ok" : "failed",
+                              mirror_ok ? mirror_pending() : 0);
+            #endif
+        #endif
+
+        // Prompts in to memory, so they start as soon as the handset is lifted and leave the card to the recorder.
+        // Any that can't be cached still play from the card.
+        elapsedMillis prompt_timer = 0;
+        for (const char *name : cached_prompts) {
+            if (!prompt_cache_load(name)) {
+                #if DEBUG
+                    Serial.printf("%s not cached, it will play from the SD card\n", name);
+                #endif
+            }
+        }
+        #if DEBUG
+            Serial.printf("Prompt cache: %lu bytes in %s, loaded in %lu ms\n", prompt_cache_bytes(),
+                          (external_psram_size > 0) ? "PSRAM" : "internal RAM", (uint32_t)prompt_timer);
+
+            // Time from play() to the first block going out, muted
+            prompt_mixer.gain(1, 0.0f);
+            elapsedMicros latency_timer = 0;
+            if (prompt_player.play(cached_prompts[0])) {
+                while (prompt_player.positionMillis() == 0 && latency_timer < 100'000) {
+                }
+                uint32_t latency = latency_timer;
+                prompt_player.stop();
+                Serial.printf("Prompt latency: %lu us from play() (one audio block is %.0f us)\n", latency,
+                              AUDIO_BLOCK_SAMPLES * 1'000'000.0f / AUDIO_SAMPLE_RATE_EXACT);
+            }
+            delay(10);
+            prompt_mixer.gain(1, 1.0f);
         #endif
-        audio_guestbook_data.disk_remaining = total_disk_size - SD.usedSize();
     }
 
     update_admin_monitor(true);
@@ -313,6 +531,12 @@ void loop() {
     phone_handset.update();
     press_button.update();
 
+    // Close the last recording once the background flush of a record to RAM call has finished
+    if (recording_closing && recorder_poll()) {
+        close_recording();
+        update_admin_monitor(true);
+    }
+
     switch (mode) {
     case LEFT_OFF_HOOK:
         // Error - Phone was left off hook for too long to get here
@@ -370,6 +594,15 @@ void loop() {
             #if DEBUG
                 print_mode();
             #endif
+        } else if (!recording_closing) {
+            // Idle, copy a little more to the mirror (nothing if there isn't one)
+            mirror_poll();
+
+            // The computer only gets the card between calls. SdFat isn't re-entrant and the recorder's writer
+            // interrupts loop() to write, so MTP must never be part way through a card operation when it does.
+            #if defined(USB_MTPDISK) || defined(USB_MTPDISK_SERIAL)
+                MTP.loop();
+            #endif
         }
 
         break;
@@ -377,12 +610,38 @@ void loop() {
     case RECORDMESSAGEPROMPT:
         // Play message to record after the beep
         delay(250); // Wait a second for handset to be brought up to ear
-        wave_file.play("record.wav");
-        while (!wave_file.isStopped()) {
+
+        // A cached prompt plays from memory straight away, whatever the card is doing
+        prompt_cached = prompt_player.play("record.wav");
+
+        // The last guest's call may still be going on to the card and the next recording needs the ring, so let that
+        // finish first (before reading the prompt from the card if it isn't cached).
+        while (recording_closing && !recorder_poll()) {
+            yield();
+        }
+        if (recording_closing) {
+            close_recording();
+        }
+
+        // Capture from now on in to the pre-roll, so nothing said over the end of the prompt is lost
+        recorder_preroll();
+        if (!prompt_cached) {
+            #if DEBUG
+                wave_file.resetStats();
+                wave_file.processorUsageMaxReset();
+            #endif
+            wave_file.play("record.wav");
+        }
+        while (prompt_cached ? !prompt_player.isStopped() : !wave_file.isStopped()) {
+            // Keep the read ahead topped up, the audio interrupt only copies from it
+            wave_file.fill();
+
             // Check if handset has been replaced
             phone_handset.update();
             if (phone_handset.risingEdge()) {
+                prompt_player.stop();
                 wave_file.stop();
+                recorder_cancel();
                 #if DEBUG
                     Serial.println("In message prompt, set mode to ready");
                 #endif
@@ -395,6 +654,7 @@ void loop() {
                 #endif
             }
         }
+        wave_file.fill(); // Played to the end, close the file before recording starts
 
         // Check handset was not replaced above
         if (mode == RECORDMESSAGEPROMPT) {
@@ -410,10 +670,24 @@ void loop() {
 
             #if DEBUG
                 Serial.println("record.wav ended, start recording message");
+                if (!prompt_cached) {
+                    // Worst case time in the player's update() (% of an audio block, and cycles against the budget
+                    // for resampling) against the slowest SD read, which would have been inside it without the read
+                    // ahead (PLAY_SD_WAV_READ_AHEAD false)
+                    Serial.printf("Prompt playback: worst update %.2f%% (%.0f us, %lu/%lu cycles, average %lu), "
+                                  "worst SD read %lu us, %lu underruns\n",
+                                  wave_file.processorUsageMax(),
+                                  wave_file.processorUsageMax() * AUDIO_BLOCK_SAMPLES * 10000.0f /
+                                      AUDIO_SAMPLE_RATE_EXACT,
+                                  wave_file.maxUpdateCycles(), PLAY_SD_WAV_UPDATE_BUDGET_CYCLES,
+                                  wave_file.avgUpdateCycles(),
+                                  wave_file.maxReadMicros(), wave_file.underruns());
+                }
             #endif
 
-            delay(250);                  // Delay so the message start beep is not recorded - something to look at
-
+            // No delay for the beep, the recording starts RECORDER_PREROLL_MS before this point with the prompt turned
+            // down, and nothing is lost while the file is opened
+            recorder_hold();
             start_recording();
 
             // Important mode change, update admin monitor
@@ -426,7 +700,6 @@ void loop() {
         if (phone_handset.risingEdge()) {
             stop_recording();
             end_beep();
-            number_of_recordings++;
             mode = READY;
 
             // Important mode change, update admin monitor
@@ -435,15 +708,14 @@ void loop() {
             #if DEBUG
                 print_mode();
             #endif
-        } else if (recording_timer >= max_recording_time) {
+        } else if (recorder_limit_reached()) {
             #if DEBUG
                 Serial.print("MAX recording time exceeded: ");
-                Serial.println(recording_timer);
+                Serial.println((uint64_t)recorder_samples() * 1000 / RECORDER_SAMPLE_RATE);
             #endif
 
             stop_recording();
             end_beep();
-            number_of_recordings++;
 
             mode = LEFT_OFF_HOOK;
 
@@ -455,13 +727,30 @@ void loop() {
 
             // Important mode change, update admin monitor
             update_admin_monitor(true);
-        } else {
-            // Check for coming near to end of max recording, sound a beep 'n' seconds before the end
-            if (recording_timer > (max_recording_time - max_recording_time_warning)) {
-                sound_warning();
-            }
+        } else if (VAD_SILENCE_SECONDS > 0 && recorder_silent_ms() >= VAD_SILENCE_SECONDS * 1000UL) {
+            // Nobody has spoken for a while, the handset has been left off the hook. Trailing silence is trimmed
+            // from the file when it is closed.
+            #if DEBUG
+                Serial.print("No voice for (ms): ");
+                Serial.println(recorder_silent_ms());
+            #endif
+
+            stop_recording();
+            end_beep();
+
+            mode = LEFT_OFF_HOOK;
+
+            #if DEBUG
+                print_mode();
+            #endif
+
+            dialing_tone(ON);
 
-            continue_recording();
+            // Important mode change, update admin monitor
+            update_admin_monitor(true);
+        } else {
+            // Sound a beep every so often over the last 'n' seconds of the max recording time
+            sound_warning();
         }
         break;
 
@@ -514,6 +803,20 @@ void loop() {
 //     }
 // }
 
+/**
+ * @brief For debugging only, print out a recording from the loudness index (or the container) if it is clipped or
+ * nearly silent.
+ */
+#if DEBUG
+static bool print_levels(const loudness_record_t *record) {
+    if (record->levels.clipped > 0 || record->levels.lufs_cb < -5000) {
+        Serial.printf("    %05u: loudness %.1f LUFS, peak %.1f dBFS, %lu samples clipped\n", record->number,
+                      record->levels.lufs_cb / 100.0, record->levels.peak_cb / 100.0, record->levels.clipped);
+    }
+    return true;
+}
+#endif
+
 /**
  * @brief For debugging only, print out what mode we are set to.
  */
@@ -594,20 +897,23 @@ static void wait(unsigned int milliseconds) {
 }
 
 /**
- * @brief Play a warning to the user that recording time is coming to the end
+ * @brief Play a warning to the user that recording time is coming to the end, timed by the audio actually recorded.
+ * Never waits, a beep started on one call is silenced on a later one.
  */
 static void sound_warning(void) {
-    static unsigned long previousWarningMillis;
-    unsigned long timeNow = millis();
+    if (warning_beep_on && warning_beep_timer >= WARNING_BEEP_MS) {
+        synth_waveform_450.amplitude(0); // silence beep
+        warning_beep_on = false;
+    }
 
-    if (timeNow - previousWarningMillis >= WARNING_DELAY) {
-        previousWarningMillis = timeNow;
+    if (recorder_samples() >= next_warning_samples) {
+        next_warning_samples += (uint64_t)WARNING_DELAY * RECORDER_SAMPLE_RATE / 1000;
 
         // Play very short warning beep
         synth_waveform_450.frequency(450);
         synth_waveform_450.amplitude(0.3);
-        delay(50);
-        synth_waveform_450.amplitude(0); // silence beep
+        warning_beep_on = true;
+        warning_beep_timer = 0;
     }
 }
 
@@ -771,7 +1077,7 @@ static void update_admin_monitor(bool mode_changed) {
         }
 
         audio_guestbook_data.mode = mode;
-        audio_guestbook_data.recordings = number_of_recordings;
+        audio_guestbook_data.recordings = catalogue_count();
         
         ESP32SERIAL.write(sizeof audio_guestbook_data);     // number of bytes in the structure
         
@@ -780,6 +1086,10 @@ static void update_admin_monitor(bool mode_changed) {
             Serial.print("    Mode: "); Serial.println(audio_guestbook_data.mode);
             Serial.print("    Recordings: "); Serial.println(audio_guestbook_data.recordings);
             Serial.print("    Disk Remaining: "); Serial.println(audio_guestbook_data.disk_remaining);
+            Serial.print("    Repaired: "); Serial.println(audio_guestbook_data.repaired);
+            Serial.printf("    Last recording %u: loudness %d, peak %d, clipped %lu\n", audio_guestbook_data.last_number,
+                          audio_guestbook_data.last_loudness, audio_guestbook_data.last_peak,
+                          audio_guestbook_data.last_clipped);
         #endif
 
         ESP32SERIAL.write((byte*)&audio_guestbook_data, sizeof audio_guestbook_data);
@@ -791,37 +1101,107 @@ static void update_admin_monitor(bool mode_changed) {
  */
 static time_t get_teensy_three_time(void) { return Teensy3Clock.get(); }
 
+/**
+ * @brief Called by the filesystem for the create and modify times of files and directories, from the RTC.
+ */
+static void fat_date_time(uint16_t *date, uint16_t *time, uint8_t *ms10) {
+    time_t t = now();
+
+    *date = FS_DATE(year(t), month(t), day(t));
+    *time = FS_TIME(hour(t), minute(t), second(t));
+    *ms10 = (second(t) & 1) ? 100 : 0; // FAT times are to 2 seconds
+}
 
-// NEED TO HANDLE ERROR - SET MODE - TODO
 /**
- * @brief Start recording voice to the SD card in .wav format.
+ * @brief Create the day and hour directories for 'filename' if this is the first recording in them.
  */
-static void start_recording(void) {
-    // Find the first available file number
-    for (uint16_t i = 0; i < 9999; i++) {
-        // Format the counter as a five-digit number with leading zeroes, followed by file extension
-        snprintf(filename, 11, " %05d.wav", i);
-        // Create if does not exist, do not open existing, write, sync after write
-        if (!SD.exists(filename)) {
-            break;
+static bool make_recording_directories(void) {
+    bool ok = true;
+
+    // Day then hour, so each new one can be taken off the free space
+    for (char *slash = strchr(filename + 1, '/'); slash != NULL && ok; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (!SD.sdfs.exists(filename)) {
+            ok = SD.sdfs.mkdir(filename, false);
+            if (ok) {
+                disk_space_file_grew(0, 1); // A directory takes a cluster
+                #if defined(USB_MTPDISK) || defined(USB_MTPDISK_SERIAL)
+                    MTP.send_addObjectEvent(mtp_store, filename);
+                #endif
+            }
         }
+        *slash = '/';
     }
+    return ok;
+}
+
+
+// NEED TO HANDLE ERROR - SET MODE - TODO
+/**
+ * @brief Start recording voice to the SD card in .wav (or .flac) format.
+ */
+static void start_recording(void) {
+    // Next file number comes straight from the catalogue built at boot, no searching the card
+    recording_number = catalogue_next_number();
+    recording_timestamp = ((uint32_t)FS_DATE(year(), month(), day()) << 16) | FS_TIME(hour(), minute(), second());
+    recording_flags = (strcmp(recording_format.extension, "flac") == 0) ? CATALOGUE_FLAC : 0;
+#if RECORDER_CONTAINER
+    recording_flags |= CATALOGUE_CONTAINER;
+#elif RECORDING_DATE_DIRECTORIES
+    recording_flags |= CATALOGUE_DATED;
+#endif
+    // Five-digit number with leading zeroes, in the directory for the day and hour it was started
+    catalogue_path(recording_number, recording_timestamp, recording_flags, filename, sizeof filename);
+
+    // Room for the longest recording allowed (plus a write's worth of slack)
+    uint64_t max_bytes = stored_format.header_bytes + (uint64_t)max_recording_time * recording_format.byte_rate / 1000 +
+                         RECORDER_WRITE_BLOCKS * AUDIO_BLOCK_SAMPLES * sizeof(int16_t);
 
+#if RECORDER_CONTAINER
+    // Appended to the container, there is no file to create
+    bool opened = container_begin_segment(&file_object, recording_number, recording_timestamp, max_bytes);
+#else
     #if DEBUG
         Serial.print("start recording to file: '");
         Serial.print(filename);
         Serial.println("'");
     #endif
 
-    file_object = SD.open(filename, FILE_WRITE);
-    if (file_object) {
+    #if RECORDING_DATE_DIRECTORIES
+        if (!make_recording_directories()) {
+            #if DEBUG
+                Serial.println("Unable to create the recording's directory");
+            #endif
+        }
+    #endif
+    // Never write over a recording, the catalogue's number can be behind the card if it couldn't be built at boot
+    file_object = SD.sdfs.open(filename, O_RDWR | O_CREAT | O_EXCL);
+    for (int tries = 1; !file_object && tries < RECORDING_OPEN_TRIES && SD.sdfs.exists(filename); tries++) {
+        recording_number++;
+        catalogue_path(recording_number, recording_timestamp, recording_flags, filename, sizeof filename);
+        file_object = SD.sdfs.open(filename, O_RDWR | O_CREAT | O_EXCL);
+    }
+    bool opened = file_object;
+    #if RECORDER_PREALLOCATE
+        // One contiguous extent so the card never has to allocate clusters while we are recording
+        if (opened && !file_object.preAllocate(max_bytes)) {
+            #if DEBUG
+                Serial.println("Unable to preallocate file, it will grow as it is written");
+            #endif
+        }
+    #endif
+#endif
+
+    if (opened) {
         #if DEBUG
             Serial.print("RECORDING to ");
             Serial.println(filename);
         #endif
 
-        queue1.begin();
-        recording_timer = 0; // Reset timer to capture long recordings
+        recording_start = file_object.curPosition();
+        recorder_begin(&file_object, &stored_format);
+        next_warning_samples = (uint64_t)(max_recording_time - max_recording_time_warning) * RECORDER_SAMPLE_RATE /
+                               1000;
         mode = RECORDING;
 
         #if DEBUG
@@ -830,36 +1210,13 @@ static void start_recording(void) {
 
         record_bytes_saved = 0L;
     } else {
+        recorder_cancel();
         #if DEBUG
             Serial.println("Couldn't open file to record!");
         #endif
     }
 }
 
-// HAVE CHANGED AUDIO_BLOCK_SAMPLES TO 256, DO WE NEED TO CHANGE ANYTHING HERE? - TODO
-/**
- * @brief Continue recording voice to the SD card.
- */
-static void continue_recording(void) {
-#define NBLOX 16
-    // Check if there is data in the queue
-    if (queue1.available() >= NBLOX) {
-        byte buffer[NBLOX * AUDIO_BLOCK_SAMPLES * sizeof(int16_t)];
-        // Fetch 2 blocks from the audio library and copy
-        // into a 512 byte buffer.  The Arduino SD library
-        // is most efficient when full 512 byte sector size
-        // writes are used.
-        for (int i = 0; i < NBLOX; i++) {
-            memcpy(buffer + i * AUDIO_BLOCK_SAMPLES * sizeof(int16_t), queue1.readBuffer(),
-                   AUDIO_BLOCK_SAMPLES * sizeof(int16_t));
-            queue1.freeBuffer();
-        }
-        // Write all 512 bytes to the SD card
-        file_object.write(buffer, sizeof buffer);
-        record_bytes_saved += sizeof buffer;
-    }
-}
-
 // NEED TO HANDLE ERROR - TODO
 /**
  * @brief Stop recording voice, write out any remaining data to the SD card.
@@ -869,30 +1226,92 @@ static void stop_recording(void) {
         Serial.println("stopRecording");
     #endif
 
-    // Stop adding any new data to the queue
-    queue1.end();
-    // Flush all existing remaining data from the queue
-    while (queue1.available() > 0) {
-        // Save to open file
-        file_object.write((byte *)queue1.readBuffer(), AUDIO_BLOCK_SAMPLES * sizeof(int16_t));
-        queue1.freeBuffer();
-        record_bytes_saved += AUDIO_BLOCK_SAMPLES * sizeof(int16_t);
-        
-        #if DEBUG
-            Serial.println("Flushed audio to file");
-        #endif
+    // Stop adding any new data to the ring and let the writer flush what is left to the file. In record to RAM mode
+    // that happens in the background and the file is closed from loop() when it is done.
+    recorder_end();
+    recording_closing = true;
+
+    if (warning_beep_on) {
+        synth_waveform_450.amplitude(0);
+        warning_beep_on = false;
+    }
+    if (recorder_poll()) {
+        close_recording();
     }
+}
 
-    write_out_wav_header();
+/**
+ * @brief Finish the file once all the audio is in it: trim, final header, close and add it to the catalogue.
+ */
+static void close_recording(void) {
+    recording_closing = false;
+    record_bytes_saved = recorder_bytes_saved();
+
+#if !RECORDER_CONTAINER
+    // Give back any of the preallocated extent we didn't use
+    file_object.truncate(recording_format.header_bytes + record_bytes_saved);
+#endif
 
+    #if DEBUG
+        Serial.printf("Recording length: %lu ms\n",
+                      (uint32_t)((uint64_t)recorder_samples() * 1000 / RECORDER_SAMPLE_RATE));
+        Serial.print("Flushed audio to file, blocks dropped: ");
+        Serial.println(recorder_dropped_blocks());
+        Serial.print("Worst case SD write (us): ");
+        Serial.println(recorder_max_write_us());
+        Serial.print("Worst case header checkpoint (us): ");
+        Serial.println(recorder_max_checkpoint_us());
+        // Peak fill of the elastic buffer, how close a slow SD card came to losing audio
+        Serial.printf("Recording buffer peak fill: %lu of %lu blocks (%lu ms)\n", recorder_peak_fill(),
+                      recorder_capacity(), recorder_peak_fill() * AUDIO_BLOCK_SAMPLES * 1000 / RECORDER_SAMPLE_RATE);
+    #endif
+
+#if RECORDER_CONTAINER
+    // The levels are kept in the segment header rather than the loudness index, the final header written now has them
+    container_segment_levels(recorder_samples(), recorder_loudness());
+#endif
+    write_out_header();
+
+#if RECORDER_CONTAINER
+    // The container stays open, the index after the new segment and the container header are all that change
+    container_end_segment(&file_object, recording_format.header_bytes + record_bytes_saved);
+#else
     file_object.close(); // Close the file
+#endif
+
+    catalogue_add(recording_number, recording_format.header_bytes + record_bytes_saved, recording_timestamp,
+                  recording_flags);
+
+    // Levels in the sidecar index and to the admin monitor, so clipped or silent messages show up straight away
+    const loudness_t *levels = recorder_loudness();
+#if !RECORDER_CONTAINER
+    loudness_record_t record = {recording_number, recorder_samples(), recording_timestamp, *levels};
+    loudness_index_append(&record);
+#endif
+    audio_guestbook_data.last_number = recording_number;
+    audio_guestbook_data.last_rms = levels->rms_cb;
+    audio_guestbook_data.last_peak = levels->peak_cb;
+    audio_guestbook_data.last_loudness = levels->lufs_cb;
+    audio_guestbook_data.last_clipped = levels->clipped;
 
     #if DEBUG
         Serial.println("Closed file");
     #endif
 
-    // Get disk space left on SD card
-    audio_guestbook_data.disk_remaining = total_disk_size - SD.usedSize();
+#if RECORDER_CONTAINER
+    // Space left for recordings is what's left in the container
+    audio_guestbook_data.disk_remaining = container_free();
+#else
+    // Disk space left on SD card, kept up to date rather than recounted
+    disk_space_file_grew(0, recording_format.header_bytes + record_bytes_saved);
+    audio_guestbook_data.disk_remaining = disk_space_free();
+
+    // Tell the computer about the new recording.  MTP only looks for it in directories the computer has listed, one
+    // it hasn't opened yet is read when it is
+    #if defined(USB_MTPDISK) || defined(USB_MTPDISK_SERIAL)
+        MTP.send_addObjectEvent(mtp_store, filename);
+    #endif
+#endif
 
     #if DEBUG
         print_mode();
@@ -900,94 +1319,25 @@ static void stop_recording(void) {
 }
 
 /**
- * @brief Update WAV header with final filesize/datasize variables for writing to WAV file
+ * @brief Update the header (WAV or FLAC) with the final sizes of the recording
  */
-static void write_out_wav_header(void) {
-    unsigned long ChunkSize = 0L;
-    unsigned long Subchunk1Size = 16;
-    unsigned int AudioFormat = 1;
-    unsigned int numChannels = 1;
-    unsigned long sampleRate = 44100;
-    unsigned int bitsPerSample = 16;
-    unsigned long byteRate =
-        sampleRate * numChannels * (bitsPerSample / 8); // samplerate x channels x (bitspersample / 8)
-    unsigned int blockAlign = numChannels * bitsPerSample / 8;
-    unsigned long Subchunk2Size = 0L;
-    byte byte1, byte2, byte3, byte4;
-
-    // NumSamples = (recByteSaved*8)/bitsPerSample/numChannels;
-    // Subchunk2Size = NumSamples*numChannels*bitsPerSample/8;
-    //                 number of samples x number of channels x number of bytes per sample
-    Subchunk2Size =
-        record_bytes_saved - 42;    // because we didn't make space for the header to start with! Lose 21 samples...
-    ChunkSize = Subchunk2Size + 34; // was 36;
-    file_object.seek(0);
-    file_object.write("RIFF");
-    byte1 = ChunkSize & 0xff;
-    byte2 = (ChunkSize >> 8) & 0xff;
-    byte3 = (ChunkSize >> 16) & 0xff;
-    byte4 = (ChunkSize >> 24) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    file_object.write(byte3);
-    file_object.write(byte4);
-    file_object.write("WAVE");
-    file_object.write("fmt ");
-    byte1 = Subchunk1Size & 0xff;
-    byte2 = (Subchunk1Size >> 8) & 0xff;
-    byte3 = (Subchunk1Size >> 16) & 0xff;
-    byte4 = (Subchunk1Size >> 24) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    file_object.write(byte3);
-    file_object.write(byte4);
-    byte1 = AudioFormat & 0xff;
-    byte2 = (AudioFormat >> 8) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    byte1 = numChannels & 0xff;
-    byte2 = (numChannels >> 8) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    byte1 = sampleRate & 0xff;
-    byte2 = (sampleRate >> 8) & 0xff;
-    byte3 = (sampleRate >> 16) & 0xff;
-    byte4 = (sampleRate >> 24) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    file_object.write(byte3);
-    file_object.write(byte4);
-    byte1 = byteRate & 0xff;
-    byte2 = (byteRate >> 8) & 0xff;
-    byte3 = (byteRate >> 16) & 0xff;
-    byte4 = (byteRate >> 24) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    file_object.write(byte3);
-    file_object.write(byte4);
-    byte1 = blockAlign & 0xff;
-    byte2 = (blockAlign >> 8) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    byte1 = bitsPerSample & 0xff;
-    byte2 = (bitsPerSample >> 8) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    file_object.write("data");
-    byte1 = Subchunk2Size & 0xff;
-    byte2 = (Subchunk2Size >> 8) & 0xff;
-    byte3 = (Subchunk2Size >> 16) & 0xff;
-    byte4 = (Subchunk2Size >> 24) & 0xff;
-    file_object.write(byte1);
-    file_object.write(byte2);
-    file_object.write(byte3);
-    file_object.write(byte4);
-    file_object.close();
-    
+static void write_out_header(void) {
+    char health[WAV_HEADER_MAX_COMMENT + 1];
+
+    // Every recording carries its own capture health (queue depth, dropped blocks, SD write latency) in a LIST/INFO
+    // chunk (a Vorbis comment for FLAC) so we can tell after the event whether any audio was lost
+    recorder_format_stats(health, sizeof health);
+
+    // Whole header sector in one write, the space for it was reserved when the recording started so no audio is lost
+    stored_format.build_header(header_sector, record_bytes_saved, health);
+    file_object.seekSet(recording_start);
+    file_object.write(header_sector, stored_format.header_bytes);
+
     #if DEBUG
         Serial.println("header written");
         Serial.print("Subchunk2: ");
-        Serial.println(Subchunk2Size);
+        Serial.println(record_bytes_saved);
+        Serial.println(health);
     #endif
 }
 
@@ -0,0 +1,71 @@
+/**
+ * Player for sounds held in the prompt cache, see play_memory_wav.h.
+ */
+#include "play_memory_wav.h"
+
+/**
+ * @brief Start playing a cached sound.
+ */
+bool AudioPlayMemoryWav::play(const prompt_t *prompt) {
+    if (prompt == NULL) {
+        return false;
+    }
+
+    __disable_irq();
+    next = prompt->samples;
+    length = prompt->length;
+    remaining = prompt->length;
+    __enable_irq();
+
+    return true;
+}
+
+/**
+ * @brief Stop playing, silence from the next audio update.
+ */
+void AudioPlayMemoryWav::stop(void) { remaining = 0; }
+
+/**
+ * @brief Time since the start of the sound playing.
+ */
+uint32_t AudioPlayMemoryWav::positionMillis(void) const {
+    __disable_irq();
+    uint32_t played = length - remaining;
+    __enable_irq();
+
+    return (uint64_t)played * 1000 / AUDIO_SAMPLE_RATE_EXACT;
+}
+
+/**
+ * @brief Length of the sound playing.
+ */
+uint32_t AudioPlayMemoryWav::lengthMillis(void) const { return (uint64_t)length * 1000 / AUDIO_SAMPLE_RATE_EXACT; }
+
+/**
+ * @brief Send the next block of the sound, the last one padded with silence.
+ */
+void AudioPlayMemoryWav::update(void) {
+    uint32_t n = remaining;
+    if (n == 0) {
+        return;
+    }
+
+    audio_block_t *block = allocate();
+    if (block == NULL) {
+        return;
+    }
+
+    const int16_t *samples = next;
+    if (n > AUDIO_BLOCK_SAMPLES) {
+        n = AUDIO_BLOCK_SAMPLES;
+    }
+    memcpy(block->data, samples, n * sizeof(int16_t));
+    if (n < AUDIO_BLOCK_SAMPLES) {
+        memset(&block->data[n], 0, (AUDIO_BLOCK_SAMPLES - n) * sizeof(int16_t));
+    }
+    next = samples + n;
+    remaining -= n;
+
+    transmit(block);
+    release(block);
+}
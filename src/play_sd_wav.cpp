@@ -44,12 +44,54 @@
 #define STATE_PARSE5			12 // ignoring unknown chunk before "fmt "
 #define STATE_PAUSED			13
 #define STATE_STOP			14
+#define STATE_NEXT			15 // skipping to the next item queued
+
+#define RING_START	0x01	// first chunk of a queued item
+#define RING_CLIP	0x02	// memory clip, 16-bit mono at the native rate
+
+static_assert((PLAY_SD_WAV_READ_AHEAD_CHUNKS & (PLAY_SD_WAV_READ_AHEAD_CHUNKS - 1)) == 0,
+	"PLAY_SD_WAV_READ_AHEAD_CHUNKS must be a power of 2");
+static_assert((PLAY_SD_WAV_QUEUE_LENGTH & (PLAY_SD_WAV_QUEUE_LENGTH - 1)) == 0,
+	"PLAY_SD_WAV_QUEUE_LENGTH must be a power of 2");
+
+// The chunk has to be in the ring before update() can see the new head
+#ifndef RING_BARRIER
+#define RING_BARRIER() asm volatile("dmb" ::: "memory")
+#endif
+
+#if PLAY_SD_WAV_READ_AHEAD
+// update() never touches the card, so SPI transactions don't need to hold off the audio interrupt
+#define START_USING_SPI()
+#define STOP_USING_SPI()
+#elif defined(HAS_KINETIS_SDHC)
+#define START_USING_SPI() if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStartUsingSPI()
+#define STOP_USING_SPI() if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStopUsingSPI()
+#else
+#define START_USING_SPI() AudioStartUsingSPI()
+#define STOP_USING_SPI() AudioStopUsingSPI()
+#endif
 
 void AudioPlaySdWavX::begin(void)
 {
 	state = STATE_STOP;
 	state_play = STATE_STOP;
 	data_length = 0;
+	ring_head = 0;
+	ring_tail = 0;
+	ring_eof = true;
+	file_start = false;
+	queue_head = 0;
+	queue_tail = 0;
+	buffer = NULL;
+	buffer_length = 0;
+	buffer_offset = 0;
+	max_read_us = 0;
+	underrun_count = 0;
+	max_update_cycles = 0;
+	total_update_cycles = 0;
+	update_count = 0;
+	tail_frames = 0;
+	resampler_mode = RESAMPLER_DEFAULT_MODE;
 	if (block_left) {
 		release(block_left);
 		block_left = NULL;
@@ -64,36 +106,163 @@ void AudioPlaySdWavX::begin(void)
 bool AudioPlaySdWavX::play(const char *filename)
 {
 	stop();
+	return queue(filename);
+}
+
+// Play 'filename' after everything already queued, or now if nothing is
+// playing.  Returns false if the queue is full, or if it was to be played
+// now and couldn't be opened.
+bool AudioPlaySdWavX::queue(const char *filename)
+{
+	if (strlen(filename) >= PLAY_SD_WAV_NAME_BYTES) return false;
+	return add(filename, NULL, 0);
+}
+
+// Queue 'length' samples of 16-bit mono audio at the native rate in memory
+// (a prompt_cache.h sound, say), played from where they are.
+bool AudioPlaySdWavX::queue(const int16_t *samples, uint32_t length)
+{
+	if (samples == NULL || length == 0) return false;
+	return add("", samples, length);
+}
+
+bool AudioPlaySdWavX::add(const char *filename, const int16_t *samples, uint32_t length)
+{
+	uint32_t head = queue_head;
+	if (head - queue_tail >= PLAY_SD_WAV_QUEUE_LENGTH) return false;
+	strcpy(queue_items[head & (PLAY_SD_WAV_QUEUE_LENGTH - 1)].name, filename);
+	queue_items[head & (PLAY_SD_WAV_QUEUE_LENGTH - 1)].samples = samples;
+	queue_items[head & (PLAY_SD_WAV_QUEUE_LENGTH - 1)].length = length;
+	RING_BARRIER();
+	queue_head = head + 1;
 	bool irq = false;
 	if (NVIC_IS_ENABLED(IRQ_SOFTWARE)) {
 		NVIC_DISABLE_IRQ(IRQ_SOFTWARE);
 		irq = true;
 	}
-#if defined(HAS_KINETIS_SDHC)
-	if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStartUsingSPI();
-#else
-	AudioStartUsingSPI();
-#endif
-	wavfile = SD.open(filename);
-	if (!wavfile) {
-#if defined(HAS_KINETIS_SDHC)
-		if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStopUsingSPI();
-#else
-		AudioStopUsingSPI();
-#endif
-		if (irq) NVIC_ENABLE_IRQ(IRQ_SOFTWARE);
-		return false;
+	// update() can't reach the end while this is decided
+	bool stopped = (state == STATE_STOP);
+	if (!stopped) {
+		// fill() may have run out of things to read
+		ring_eof = false;
+	}
+	if (irq) NVIC_ENABLE_IRQ(IRQ_SOFTWARE);
+	if (stopped) return start();
+	return true;
+}
+
+// Start playing the queue from the first item that can be opened
+bool AudioPlaySdWavX::start(void)
+{
+	// the filter table is built here rather than when update() finds a
+	// file needs converting, it takes too long for the audio interrupt
+	if (resampler_mode == RESAMPLER_POLYPHASE) resampler_design();
+	bool irq = false;
+	if (NVIC_IS_ENABLED(IRQ_SOFTWARE)) {
+		NVIC_DISABLE_IRQ(IRQ_SOFTWARE);
+		irq = true;
 	}
+	START_USING_SPI();
+	ring_head = 0;
+	ring_tail = 0;
+	ring_eof = false;
+	buffer = NULL;
 	buffer_length = 0;
 	buffer_offset = 0;
+	tail_frames = 0;
 	state_play = STATE_STOP;
-	data_length = 20;
-	header_offset = 0;
-	state = STATE_PARSE1;
+	// fill the ring now so the first update() has the header and audio to
+	// hand, update() starts on the first item when it gets to its chunk
+	while (ring_head == 0 && read_chunk()) ;
+	if (ring_head == 0) {
+		queue_tail = queue_head;
+		STOP_USING_SPI();
+		if (irq) NVIC_ENABLE_IRQ(IRQ_SOFTWARE);
+		return false;
+	}
+	state = STATE_NEXT;
 	if (irq) NVIC_ENABLE_IRQ(IRQ_SOFTWARE);
+	fill();
 	return true;
 }
 
+// Read ahead of playback until the ring is full, called from loop() (never
+// from an interrupt) as often as possible while playing.  Also closes the
+// file once update() has reached the end of everything queued.
+void AudioPlaySdWavX::fill(void)
+{
+	if (state == STATE_STOP) {
+		if (wavfile) wavfile.close();
+		return;
+	}
+#if PLAY_SD_WAV_READ_AHEAD
+	while (!ring_eof && ring_head - ring_tail < PLAY_SD_WAV_READ_AHEAD_CHUNKS) {
+		read_chunk();
+	}
+#endif
+}
+
+// Read the next chunk of the file in to the ring, opening the next item
+// queued at the end of each one.  Returns false once everything queued has
+// been read.
+bool AudioPlaySdWavX::read_chunk(void)
+{
+	uint32_t head = ring_head;
+	uint32_t index = head & (PLAY_SD_WAV_READ_AHEAD_CHUNKS - 1);
+	if (!wavfile && !open_next()) {
+		ring_eof = true;
+		return false;
+	}
+	if (!wavfile) {
+		// a memory clip, all of it is one chunk
+		return true;
+	}
+	uint32_t start = micros();
+	int n = wavfile.read(ring[index], PLAY_SD_WAV_CHUNK_BYTES);
+	uint32_t us = micros() - start;
+	if (us > max_read_us) max_read_us = us;
+	if (n <= 0) {
+		wavfile.close();
+		return true;
+	}
+	ring_data[index] = ring[index];
+	ring_length[index] = n;
+	ring_flags[index] = file_start ? RING_START : 0;
+	file_start = false;
+	RING_BARRIER();
+	ring_head = head + 1;
+	if (n < PLAY_SD_WAV_CHUNK_BYTES) wavfile.close();
+	return true;
+}
+
+// Open the next item queued, skipping any that can't be.  A memory clip goes
+// straight in to the ring.  Returns false if there's nothing left queued.
+bool AudioPlaySdWavX::open_next(void)
+{
+	while (queue_tail != queue_head) {
+		uint32_t tail = queue_tail;
+		uint32_t index = ring_head & (PLAY_SD_WAV_READ_AHEAD_CHUNKS - 1);
+		const int16_t *samples = queue_items[tail & (PLAY_SD_WAV_QUEUE_LENGTH - 1)].samples;
+		uint32_t length = queue_items[tail & (PLAY_SD_WAV_QUEUE_LENGTH - 1)].length;
+		if (samples) {
+			ring_data[index] = (const uint8_t *)samples;
+			ring_length[index] = length * 2;
+			ring_flags[index] = RING_START | RING_CLIP;
+			RING_BARRIER();
+			ring_head = ring_head + 1;
+			queue_tail = tail + 1;
+			return true;
+		}
+		wavfile = SD.open(queue_items[tail & (PLAY_SD_WAV_QUEUE_LENGTH - 1)].name);
+		queue_tail = tail + 1;
+		if (wavfile) {
+			file_start = true;
+			return true;
+		}
+	}
+	return false;
+}
+
 void AudioPlaySdWavX::stop(void)
 {
 	bool irq = false;
@@ -109,13 +278,11 @@ void AudioPlaySdWavX::stop(void)
 		state = STATE_STOP;
 		if (b1) release(b1);
 		if (b2) release(b2);
-		wavfile.close();
-#if defined(HAS_KINETIS_SDHC)
-		if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStopUsingSPI();
-#else
-		AudioStopUsingSPI();
-#endif
+		STOP_USING_SPI();
 	}
+	queue_tail = queue_head;
+	// update() may have finished before fill() got to close the file
+	if (wavfile) wavfile.close();
 	if (irq) NVIC_ENABLE_IRQ(IRQ_SOFTWARE);
 }
 
@@ -134,6 +301,20 @@ void AudioPlaySdWavX::togglePlayPause(void) {
 }
 
 void AudioPlaySdWavX::update(void)
+{
+	if (state == STATE_STOP || state == STATE_PAUSED) return;
+
+	// time every update while playing, resampling makes the worst case
+	// depend on the file
+	uint32_t cycles = ARM_DWT_CYCCNT;
+	play_block();
+	cycles = ARM_DWT_CYCCNT - cycles;
+	if (cycles > max_update_cycles) max_update_cycles = cycles;
+	total_update_cycles += cycles;
+	update_count++;
+}
+
+void AudioPlaySdWavX::play_block(void)
 {
 	int32_t n;
 
@@ -160,38 +341,55 @@ void AudioPlaySdWavX::update(void)
 
 	//Serial.println("update");
 
-	// is there buffered data?
-	n = buffer_length - buffer_offset;
-	if (n > 0) {
-		// we have buffered data
-		if (consume(n)) return; // it was enough to transmit audio
-	}
+	while (1) {
+		// is there buffered data?
+		n = buffer_length - buffer_offset;
+		if (n > 0 || tail_frames > 0) {
+			// we have buffered data, or the end of it to get out of the
+			// resampler
+			if (consume(n)) {
+				// it was enough to transmit audio
+				if (state != STATE_STOP) return;
+				goto end;
+			}
+		}
+		if (state == STATE_STOP) goto end;
+		if (state == STATE_NEXT) {
+			// the rest of this chunk belongs to the item that ended
+			buffer_offset = buffer_length;
+		}
 
-	// we only get to this point when buffer[] is empty
-	if (state != STATE_STOP && wavfile.available()) {
-		// we can read more data from the file...
-		readagain:
-		buffer_length = wavfile.read(buffer, sizeof buffer);
-		if (buffer_length == 0) goto end;
-		buffer_offset = 0;
-		bool parsing = (state >= 8);
-		bool txok = consume(buffer_length);
-		if (txok) {
-			if (state != STATE_STOP) return;
-		} else {
-			if (state != STATE_STOP) {
-				if (parsing && state < 8) goto readagain;
-				else goto cleanup;
+		// this chunk is used up (consume() doesn't always update buffer_offset
+		// when it is), move on to the next one read ahead
+		if (buffer) {
+			buffer = NULL;
+			buffer_length = 0;
+			buffer_offset = 0;
+			ring_tail = ring_tail + 1;
+		}
+		if (ring_tail == ring_head) {
+#if !PLAY_SD_WAV_READ_AHEAD
+			while (!ring_eof && ring_tail == ring_head) read_chunk();
+#endif
+			if (ring_tail == ring_head) {
+				if (ring_eof) goto end;
+				// fill() hasn't kept up, this block is lost
+				underrun_count++;
+				goto cleanup;
 			}
 		}
+		uint32_t index = ring_tail & (PLAY_SD_WAV_READ_AHEAD_CHUNKS - 1);
+		buffer = ring_data[index];
+		buffer_length = ring_length[index];
+		buffer_offset = 0;
+		// straight on to the next item, in the same audio block
+		if (ring_flags[index] & RING_START) start_item(ring_flags[index]);
 	}
-end:	// end of file reached or other reason to stop
+end:	// end of file reached or other reason to stop, fill() closes the file
+#if !PLAY_SD_WAV_READ_AHEAD
 	wavfile.close();
-#if defined(HAS_KINETIS_SDHC)
-	if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStopUsingSPI();
-#else
-	AudioStopUsingSPI();
 #endif
+	STOP_USING_SPI();
 	state_play = STATE_STOP;
 	state = STATE_STOP;
 cleanup:
@@ -201,7 +399,8 @@ cleanup:
 				block_left->data[i] = 0;
 			}
 			transmit(block_left, 0);
-			if (state < 8 && (state & 1) == 0) {
+			// mono (state is already STATE_STOP at the end of the file)
+			if (block_right == NULL) {
 				transmit(block_left, 1);
 			}
 		}
@@ -227,12 +426,11 @@ cleanup:
 bool AudioPlaySdWavX::consume(uint32_t size)
 {
 	uint32_t len;
-	uint8_t lsb, msb;
 	const uint8_t *p;
 
 	p = buffer + buffer_offset;
 start:
-	if (size == 0) return false;
+	if (size == 0 && tail_frames == 0) return false;
 #if 0
 	Serial.print("AudioPlaySdWavX consume, ");
 	Serial.print("size = ");
@@ -331,16 +529,20 @@ start:
 		if (header[0] == 0x61746164) {
 			//Serial.print("wav: found data chunk, len=");
 			//Serial.println(data_length);
-			// TODO: verify offset in file is an even number
-			// as required by WAV format.  abort if odd.  Code
-			// below will depend upon this and fail if not even.
+			// the data can start at an odd offset (after a chunk
+			// missing its pad byte), every state puts a sample
+			// split across two chunks together in header[]
 			leftover_bytes = 0;
 			state = state_play;
-			if (state & 1) {
+			tail_frames = (state & 4) ? resampler.delay : 0;
+			if ((state & 1) && !block_right) {
 				// if we're going to start stereo
-				// better allocate another output block
+				// better allocate another output block,
+				// with anything from a mono item before
+				// this one in the block on both sides
 				block_right = allocate();
 				if (!block_right) return false;
+				memcpy(block_right->data, block_left->data, block_offset * 2);
 			}
 			total_length = data_length;
 		} else {
@@ -390,60 +592,82 @@ start:
 		if (size > data_length) size = data_length;
 		data_length -= size;
 		while (1) {
-			lsb = *p++;
-			msb = *p++;
-			size -= 2;
-			block_left->data[block_offset++] = (msb << 8) | lsb;
+			if (leftover_bytes) {
+				// sample split across two chunks
+				len = 2;
+				block_left->data[block_offset] = (*p++ << 8) | (header[0] & 0xFF);
+				size--;
+				leftover_bytes = 0;
+			} else {
+				// the file is little endian like the M7, so copy as
+				// many whole samples as fit straight in to the block
+				len = (AUDIO_BLOCK_SAMPLES - block_offset) * 2;
+				if (len > size) len = size & ~1;
+				memcpy(&block_left->data[block_offset], p, len);
+				p += len;
+				size -= len;
+			}
+			if (block_right) {
+				// a stereo item ended earlier in this block
+				memcpy(&block_right->data[block_offset], &block_left->data[block_offset], len);
+			}
+			block_offset += len / 2;
 			if (block_offset >= AUDIO_BLOCK_SAMPLES) {
 				transmit(block_left, 0);
-				transmit(block_left, 1);
+				if (block_right) {
+					transmit(block_right, 1);
+					release(block_right);
+					block_right = NULL;
+				} else {
+					transmit(block_left, 1);
+				}
 				release(block_left);
 				block_left = NULL;
 				data_length += size;
 				buffer_offset = p - buffer;
-				if (block_right) release(block_right);
-				if (data_length == 0) state = STATE_STOP;
+				if (data_length == 0) state = STATE_NEXT;
 				return true;
 			}
-			if (size == 0) {
+			if (size < 2) {
 				if (data_length == 0) break;
+				if (size == 1) {
+					header[0] = *p;
+					leftover_bytes = 1;
+				}
 				return false;
 			}
 		}
 		//Serial.println("end of file reached");
 		// end of file reached
-		if (block_offset > 0) {
-			// TODO: fill remainder of last block with zero and transmit
-		}
-		state = STATE_STOP;
+		state = STATE_NEXT;
 		return false;
 
 	  // playing stereo at native sample rate
 	  case STATE_DIRECT_16BIT_STEREO:
 		if (size > data_length) size = data_length;
 		data_length -= size;
-		if (leftover_bytes) {
-			block_left->data[block_offset] = header[0];
-//PAH fix problem with left+right channels being swapped
-			leftover_bytes = 0;
-			goto right16;
-		}
 		while (1) {
-			lsb = *p++;
-			msb = *p++;
-			size -= 2;
-			if (size == 0) {
-				if (data_length == 0) break;
-				header[0] = (msb << 8) | lsb;
-				leftover_bytes = 2;
-				return false;
+			const uint8_t *frame;
+			if (leftover_bytes == 0 && size >= 4) {
+				frame = p;
+				p += 4;
+				size -= 4;
+			} else {
+				// frame split across two chunks, put it
+				// together in header[]
+				while (leftover_bytes < 4 && size > 0) {
+					((uint8_t *)header)[leftover_bytes++] = *p++;
+					size--;
+				}
+				if (leftover_bytes < 4) {
+					if (data_length == 0) break;
+					return false;
+				}
+				leftover_bytes = 0;
+				frame = (const uint8_t *)header;
 			}
-			block_left->data[block_offset] = (msb << 8) | lsb;
-			right16:
-			lsb = *p++;
-			msb = *p++;
-			size -= 2;
-			block_right->data[block_offset++] = (msb << 8) | lsb;
+			block_left->data[block_offset] = frame[0] | (frame[1] << 8);
+			block_right->data[block_offset++] = frame[2] | (frame[3] << 8);
 			if (block_offset >= AUDIO_BLOCK_SAMPLES) {
 				transmit(block_left, 0);
 				release(block_left);
@@ -453,41 +677,98 @@ start:
 				block_right = NULL;
 				data_length += size;
 				buffer_offset = p - buffer;
-				if (data_length == 0) state = STATE_STOP;
+				if (data_length == 0) state = STATE_NEXT;
 				return true;
 			}
 			if (size == 0) {
 				if (data_length == 0) break;
-				leftover_bytes = 0;
 				return false;
 			}
 		}
-		// end of file reached
-		if (block_offset > 0) {
-			// TODO: fill remainder of last block with zero and transmit
-		}
-		state = STATE_STOP;
+		// end of file reached, as for mono the next item queued
+		// carries on in this block, or play_block() zeros the rest
+		// of both channels and transmits them
+		state = STATE_NEXT;
 		return false;
 
-	  // playing mono, converting sample rate
-	  case STATE_CONVERT_8BIT_MONO :
-		return false;
-
-	  // playing stereo, converting sample rate
+	  // playing mono or stereo, converting sample rate (8-bit files at
+	  // the native rate come here too, passed straight through)
+	  case STATE_CONVERT_8BIT_MONO:
 	  case STATE_CONVERT_8BIT_STEREO:
-		return false;
-
-	  // playing mono, converting sample rate
 	  case STATE_CONVERT_16BIT_MONO:
+	  case STATE_CONVERT_16BIT_STEREO: {
+		const uint8_t *frame;
+		int16_t left, right = 0;
+		if (size > data_length) size = data_length;
+		data_length -= size;
+		len = ((state & 2) ? 2 : 1) << (state & 1);	// bytes per frame
+		while (1) {
+			// every output sample due before the next input frame
+			while (resampler_ready(&resampler)) {
+				resampler_output(&resampler, &left, &right);
+				block_left->data[block_offset] = left;
+				// (mono may follow a stereo item in this block)
+				if (block_right) block_right->data[block_offset] = (state & 1) ? right : left;
+				if (++block_offset >= AUDIO_BLOCK_SAMPLES) {
+					transmit(block_left, 0);
+					if (block_right) {
+						transmit(block_right, 1);
+						release(block_right);
+						block_right = NULL;
+					} else {
+						transmit(block_left, 1);
+					}
+					release(block_left);
+					block_left = NULL;
+					data_length += size;
+					buffer_offset = p - buffer;
+					if (data_length == 0 && tail_frames == 0 &&
+					    !resampler_ready(&resampler)) state = STATE_NEXT;
+					return true;
+				}
+			}
+			if (size == 0) {
+				if (data_length > 0) return false;
+				// end of file reached, push silence through
+				// until the last of it is out of the filter
+				if (tail_frames == 0) break;
+				tail_frames--;
+				resampler_push(&resampler, 0, 0);
+				continue;
+			}
+			if (leftover_bytes == 0 && size >= len) {
+				frame = p;
+				p += len;
+				size -= len;
+			} else {
+				// frame split across two chunks, put it
+				// together in header[]
+				while (leftover_bytes < len && size > 0) {
+					((uint8_t *)header)[leftover_bytes++] = *p++;
+					size--;
+				}
+				if (leftover_bytes < len) continue;
+				leftover_bytes = 0;
+				frame = (const uint8_t *)header;
+			}
+			if (state & 2) {
+				left = frame[0] | (frame[1] << 8);
+				if (state & 1) right = frame[2] | (frame[3] << 8);
+			} else {
+				// 8-bit WAV is unsigned
+				left = (frame[0] - 128) * 256;
+				if (state & 1) right = (frame[1] - 128) * 256;
+			}
+			resampler_push(&resampler, left, right);
+		}
+		state = STATE_NEXT;
 		return false;
-
-	  // playing stereo, converting sample rate
-	  case STATE_CONVERT_16BIT_STEREO:
-		return false;
+	  }
 
 	  // ignore any extra data after playing
 	  // or anything following any error
 	  case STATE_STOP:
+	  case STATE_NEXT:
 		return false;
 
 	  // this is not supposed to happen!
@@ -495,7 +776,7 @@ start:
 		//Serial.println("AudioPlaySdWavX, unknown state");
 	}
 	state_play = STATE_STOP;
-	state = STATE_STOP;
+	state = STATE_NEXT;
 	return false;
 }
 
@@ -522,8 +803,6 @@ start:
 //  512 byte chunks, speed is 468023 bytes/sec
 
 #define B2M_44100 (uint32_t)((double)4294967296000.0 / AUDIO_SAMPLE_RATE_EXACT) // 97352592
-#define B2M_22050 (uint32_t)((double)4294967296000.0 / AUDIO_SAMPLE_RATE_EXACT * 2.0)
-#define B2M_11025 (uint32_t)((double)4294967296000.0 / AUDIO_SAMPLE_RATE_EXACT * 4.0)
 
 bool AudioPlaySdWavX::parse_format(void)
 {
@@ -543,11 +822,8 @@ bool AudioPlaySdWavX::parse_format(void)
 	//Serial.println(rate);
 	if (rate == 44100) {
 		b2m = B2M_44100;
-	} else if (rate == 22050) {
-		b2m = B2M_22050;
-		num |= 4;
-	} else if (rate == 11025) {
-		b2m = B2M_11025;
+	} else if (rate >= RESAMPLER_MIN_RATE && rate <= RESAMPLER_MAX_RATE) {
+		b2m = 4294967296000ULL / rate;
 		num |= 4;
 	} else {
 		return false;
@@ -568,6 +844,9 @@ bool AudioPlaySdWavX::parse_format(void)
 	//Serial.print("  bits = ");
 	//Serial.println(bits);
 	if (bits == 8) {
+		// there's no direct 8-bit playing, the converter passes
+		// it through at the native rate
+		num |= 4;
 	} else if (bits == 16) {
 		b2m >>= 1;
 		num |= 2;
@@ -579,6 +858,10 @@ bool AudioPlaySdWavX::parse_format(void)
 	//Serial.print("  bytes2millis = ");
 	//Serial.println(b2m);
 
+	if ((num & 4) && !resampler_init(&resampler, rate, 44100, channels, resampler_mode)) {
+		return false;
+	}
+
 	// we're not checking the byte rate and block align fields
 	// if they're not the expected values, all we could do is
 	// return false.  Do any real wav files have unexpected
@@ -588,6 +871,27 @@ bool AudioPlaySdWavX::parse_format(void)
 }
 
 
+// Start on the item whose first chunk is "buffer"
+void AudioPlaySdWavX::start_item(uint8_t flags)
+{
+	tail_frames = 0;
+	leftover_bytes = 0;
+	if (flags & RING_CLIP) {
+		// no header, 16-bit mono at the native rate
+		bytes2millis = B2M_44100 >> 1;
+		data_length = buffer_length;
+		total_length = buffer_length;
+		state_play = STATE_DIRECT_16BIT_MONO;
+		state = state_play;
+	} else {
+		state_play = STATE_STOP;
+		data_length = 20;
+		header_offset = 0;
+		state = STATE_PARSE1;
+	}
+}
+
+
 bool AudioPlaySdWavX::isPlaying(void)
 {
 	uint8_t s = *(volatile uint8_t *)&state;
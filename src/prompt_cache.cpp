@@ -0,0 +1,234 @@
+/**
+ * Prompts and other fixed sounds held in memory, see prompt_cache.h.
+ */
+#include "prompt_cache.h"
+#include "resampler.h"
+#include <SD.h>
+
+// Bytes of the file converted at a time while loading
+#define LOAD_CHUNK_BYTES 512
+
+// Rate the sounds are cached at, the audio library's
+#define CACHE_RATE 44100
+
+typedef struct {
+    uint16_t channels;
+    uint16_t bits;
+    uint32_t rate;
+    uint32_t data_bytes;
+} wav_format_t;
+
+static prompt_t prompts[PROMPT_CACHE_MAX];
+static uint32_t prompt_count = 0;
+static uint32_t cached_bytes = 0;
+static resampler_t resampler;
+
+static bool read_format(FsFile *file, wav_format_t *format);
+static void convert(const uint8_t *in, uint32_t frames, const wav_format_t *format, int16_t *out);
+static uint32_t resample_frames(const int16_t *in, uint32_t frames, int16_t *out, uint32_t space);
+
+/**
+ * @brief Load a .wav file in to the cache.
+ */
+bool prompt_cache_load(const char *filename) {
+    wav_format_t format;
+    uint8_t chunk[LOAD_CHUNK_BYTES] __attribute__((aligned(4)));
+    int16_t mono[LOAD_CHUNK_BYTES];
+
+    if (prompt_count >= PROMPT_CACHE_MAX || strlen(filename) >= sizeof prompts[0].name) {
+        return false;
+    }
+    if (prompt_cache_find(filename) != NULL) {
+        return true;
+    }
+
+    FsFile file = SD.sdfs.open(filename, O_RDONLY);
+    if (!file) {
+        return false;
+    }
+    if (!read_format(&file, &format)) {
+        file.close();
+        return false;
+    }
+
+    // Other rates are resampled as they are loaded, so the cached sound is always at the playing rate
+    bool resample = format.rate != CACHE_RATE;
+    if (resample) {
+        resampler_design();
+        if (!resampler_init(&resampler, format.rate, CACHE_RATE, 1, RESAMPLER_DEFAULT_MODE)) {
+            file.close();
+            return false;
+        }
+    }
+
+    uint32_t frame_bytes = format.channels * format.bits / 8;
+    uint32_t frames = format.data_bytes / frame_bytes;
+    uint32_t length = resample ? (uint64_t)frames * CACHE_RATE / format.rate + 2 : frames;
+    if (frames == 0 || length * sizeof(int16_t) > PROMPT_CACHE_MAX_BYTES) {
+        file.close();
+        return false;
+    }
+    int16_t *samples = (int16_t *)extmem_malloc(length * sizeof(int16_t));
+    if (samples == NULL) {
+        file.close();
+        return false;
+    }
+
+    // Whole frames at a time, 16-bit mono at the playing rate is already what is wanted so goes straight in
+    uint32_t loaded = 0;
+    uint32_t output = 0;
+    uint32_t chunk_frames = LOAD_CHUNK_BYTES / frame_bytes;
+    while (loaded < frames) {
+        uint32_t n = (frames - loaded < chunk_frames) ? frames - loaded : chunk_frames;
+        if (!resample && format.channels == 1 && format.bits == 16) {
+            if (file.read(&samples[loaded], n * frame_bytes) != (int)(n * frame_bytes)) {
+                break;
+            }
+            output += n;
+        } else {
+            if (file.read(chunk, n * frame_bytes) != (int)(n * frame_bytes)) {
+                break;
+            }
+            if (!resample) {
+                convert(chunk, n, &format, &samples[loaded]);
+                output += n;
+            } else {
+                convert(chunk, n, &format, mono);
+                output += resample_frames(mono, n, &samples[output], length - output);
+            }
+        }
+        loaded += n;
+    }
+    file.close();
+
+    if (loaded < frames) {
+        extmem_free(samples);
+        return false;
+    }
+    if (resample) {
+        // The end of the sound is still in the filter
+        int16_t silence[RESAMPLER_TAPS] = {0};
+        output += resample_frames(silence, resampler.delay, &samples[output], length - output);
+    }
+
+    prompt_t *prompt = &prompts[prompt_count++];
+    snprintf(prompt->name, sizeof prompt->name, "%s", filename);
+    prompt->samples = samples;
+    prompt->length = output;
+    cached_bytes += length * sizeof(int16_t);
+
+    return true;
+}
+
+/**
+ * @brief The cached sound loaded from 'filename'.
+ */
+const prompt_t *prompt_cache_find(const char *filename) {
+    for (uint32_t i = 0; i < prompt_count; i++) {
+        if (strcmp(prompts[i].name, filename) == 0) {
+            return &prompts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Memory taken by the cached sounds.
+ */
+uint32_t prompt_cache_bytes(void) { return cached_bytes; }
+
+/**
+ * @brief Read the RIFF header and chunks up to the audio, checking it is a format that can be cached.  The file is
+ * left at the start of the audio.
+ */
+static bool read_format(FsFile *file, wav_format_t *format) {
+    uint32_t riff[3];
+    uint32_t chunk[2]; // ID and size
+    uint16_t fmt[8];
+    bool have_format = false;
+
+    if (file->read(riff, sizeof riff) != sizeof riff || riff[0] != 0x46464952 || riff[2] != 0x45564157) {
+        return false; // Not "RIFF" ... "WAVE"
+    }
+
+    while (file->read(chunk, sizeof chunk) == sizeof chunk) {
+        uint64_t next = file->curPosition() + chunk[1] + (chunk[1] & 1); // Chunks are padded to an even size
+
+        if (chunk[0] == 0x20746D66) {
+            // "fmt ", only plain PCM
+            if (chunk[1] < sizeof fmt || file->read(fmt, sizeof fmt) != sizeof fmt || fmt[0] != 1) {
+                return false;
+            }
+            format->channels = fmt[1];
+            format->rate = fmt[2] | ((uint32_t)fmt[3] << 16);
+            format->bits = fmt[7];
+            have_format = true;
+        } else if (chunk[0] == 0x61746164) {
+            // "data", the audio is from here on
+            if (!have_format || (format->channels != 1 && format->channels != 2) ||
+                (format->bits != 8 && format->bits != 16)) {
+                return false;
+            }
+            uint64_t left = file->fileSize() - file->curPosition();
+            format->data_bytes = (chunk[1] < left) ? chunk[1] : left;
+            return true;
+        }
+
+        if (!file->seekSet(next)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Convert 'frames' of 8 or 16-bit, mono or stereo PCM to 16-bit mono.
+ */
+static void convert(const uint8_t *in, uint32_t frames, const wav_format_t *format, int16_t *out) {
+    for (uint32_t i = 0; i < frames; i++) {
+        int32_t sample;
+
+        if (format->bits == 16) {
+            sample = (int16_t)(in[0] | (in[1] << 8));
+            in += 2;
+            if (format->channels == 2) {
+                sample = (sample + (int16_t)(in[0] | (in[1] << 8))) >> 1;
+                in += 2;
+            }
+        } else {
+            // 8-bit WAV is unsigned
+            sample = (in[0] - 128) * 256;
+            in++;
+            if (format->channels == 2) {
+                sample = (sample + (in[0] - 128) * 256) >> 1;
+                in++;
+            }
+        }
+        out[i] = sample;
+    }
+}
+
+/**
+ * @brief Push 'frames' of mono samples through the resampler, writing up to 'space' samples out.
+ *
+ * @return Samples written.
+ */
+static uint32_t resample_frames(const int16_t *in, uint32_t frames, int16_t *out, uint32_t space) {
+    uint32_t written = 0;
+
+    for (uint32_t i = 0; i <= frames; i++) {
+        while (resampler_ready(&resampler)) {
+            if (written == space) {
+                return written;
+            }
+            resampler_output(&resampler, &out[written++], NULL);
+        }
+        if (i < frames) {
+            resampler_push(&resampler, in[i], 0);
+        }
+    }
+
+    return written;
+}
@@ -0,0 +1,178 @@
+/**
+ * Lock-free single producer/single consumer ring of audio blocks for recording, see record_ring.h.
+ */
+#include "record_ring.h"
+
+// Make sure the block is in the ring before the index is published (and the other way round for the consumer).
+// Single core so a data memory barrier that also stops the compiler reordering is all that is needed.
+#ifndef RING_BARRIER
+#define RING_BARRIER() asm volatile("dmb" ::: "memory")
+#endif
+
+#define BLOCK_BYTES (AUDIO_BLOCK_SAMPLES * sizeof(int16_t))
+
+/**
+ * @brief Switch the ring over to an elastic buffer of copied blocks.
+ */
+uint32_t AudioRecordRing::use_elastic(uint32_t blocks) {
+    clear();
+
+    // Without PSRAM only take a fixed share of internal RAM, the rest is needed for the tables allocated after this
+    if (external_psram_size == 0 && blocks > RECORD_RING_INTERNAL_BLOCKS) {
+        blocks = RECORD_RING_INTERNAL_BLOCKS;
+    }
+
+    // Try for the requested size then keep halving, in case even that isn't free
+    while (blocks >= RECORD_RING_BLOCKS) {
+        int16_t *buffer = (int16_t *)extmem_malloc(blocks * BLOCK_BYTES);
+        if (buffer != NULL) {
+            elastic = buffer;
+            mask = blocks - 1;
+            return blocks;
+        }
+        blocks >>= 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Start accepting blocks from the audio library.
+ */
+void AudioRecordRing::begin(EventResponder *writer, uint32_t trigger_blocks) {
+    writer_event = writer;
+    trigger = (trigger_blocks > 0) ? trigger_blocks : 1;
+    preroll_held = 0;
+    enabled = true;
+}
+
+/**
+ * @brief Start capturing, keeping only the newest 'blocks' blocks until hold().
+ */
+void AudioRecordRing::preroll(uint32_t blocks) {
+    clear();
+    writer_event = NULL;
+    preroll_limit = (blocks == 0) ? 1 : (blocks > capacity()) ? capacity() : blocks;
+    enabled = true;
+}
+
+/**
+ * @brief Keep everything captured from here on (and the pre-roll before it) for the writer.
+ */
+uint32_t AudioRecordRing::hold(void) {
+    // The audio interrupt owns the tail while pre-rolling, so switch over with it held off
+    __disable_irq();
+    preroll_limit = 0;
+    preroll_held = head - tail;
+    dropped_blocks = 0;
+    max_depth = preroll_held;
+    __enable_irq();
+
+    return preroll_held;
+}
+
+/**
+ * @brief Discard anything still in the ring and reset the counters.
+ */
+void AudioRecordRing::clear(void) {
+    enabled = false;
+    draining = false;
+    preroll_limit = 0;
+    preroll_held = 0;
+    while (head != tail) {
+        if (elastic == NULL) {
+            release(ring[tail & mask]);
+        }
+        tail = tail + 1;
+    }
+    dropped_blocks = 0;
+    max_depth = 0;
+}
+
+/**
+ * @brief Copy out and remove the oldest blocks, consumer side only.
+ */
+uint32_t AudioRecordRing::read(void *dst, uint32_t max_blocks) {
+    uint32_t t = tail;
+    uint32_t count = head - t;
+    uint8_t *out = (uint8_t *)dst;
+
+    if (count > max_blocks) {
+        count = max_blocks;
+    }
+    RING_BARRIER();
+
+    for (uint32_t i = 0; i < count; i++, t++) {
+        if (elastic != NULL) {
+            memcpy(out, elastic + (t & mask) * AUDIO_BLOCK_SAMPLES, BLOCK_BYTES);
+        } else {
+            audio_block_t *block = ring[t & mask];
+            memcpy(out, block->data, BLOCK_BYTES);
+            release(block);
+        }
+        out += BLOCK_BYTES;
+    }
+
+    RING_BARRIER();
+    tail = t;
+
+    return count;
+}
+
+/**
+ * @brief Audio library update, runs in the audio interrupt every AUDIO_BLOCK_SAMPLES samples.
+ */
+void AudioRecordRing::update(void) {
+    audio_block_t *block = receiveReadOnly();
+
+    if (draining && writer_event != NULL) {
+        writer_event->triggerEvent();
+    }
+
+    if (block == NULL) {
+        return;
+    }
+
+    if (!enabled) {
+        release(block);
+        return;
+    }
+
+    uint32_t h = head;
+    uint32_t depth = h - tail;
+
+    if (preroll_limit > 0 && depth >= preroll_limit) {
+        // Pre-rolling, nobody is reading yet so the producer drops the oldest block itself
+        uint32_t t = tail;
+        if (elastic == NULL) {
+            release(ring[t & mask]);
+        }
+        tail = t + 1;
+        depth--;
+    }
+
+    if (depth > mask) {
+        // Writer has fallen too far behind, drop the newest block rather than block the audio interrupt
+        release(block);
+        dropped_blocks = dropped_blocks + 1;
+    } else {
+        if (elastic != NULL) {
+            // Copy and give the block straight back so the audio library never runs short
+            memcpy(elastic + (h & mask) * AUDIO_BLOCK_SAMPLES, block->data, BLOCK_BYTES);
+            release(block);
+        } else {
+            ring[h & mask] = block;
+        }
+        RING_BARRIER();
+        head = h + 1;
+        depth++;
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+
+    // Wake the writer once there is a full SD write worth of audio waiting
+    if (writer_event != NULL && preroll_limit == 0 && depth >= trigger) {
+        writer_event->triggerEvent();
+    }
+}
@@ -0,0 +1,547 @@
+/**
+ * SD card writer for recordings, see recorder.h.
+ */
+#include "recorder.h"
+
+static AudioRecordRing *record_ring = NULL;
+static FsFile *record_file = NULL;
+static uint64_t record_start = 0; // Where in the file the recording (its header) starts
+static const recorder_format_t *record_format = NULL;
+static EventResponder writer_event;
+
+static volatile bool flushing = false;   // Write out partial buffers, recording is ending
+static volatile bool flushed = false;    // Everything, including any encoder remainder, is in the file
+static volatile bool background = false; // Flushing a RAM mode recording one write at a time, after the call
+static bool streaming = false;           // Writing while recording, always unless a RAM mode recording fits in RAM
+static uint32_t analysed_blocks = 0;     // Blocks the voice detector has seen, ahead of the writer in RAM mode
+static volatile uint32_t blocks_taken = 0; // Blocks read out of the ring since recorder_begin(), kept or not
+static uint32_t limit_ms = 0;
+static uint32_t limit_blocks = 0;        // Most blocks a recording can have, 0 for no limit
+static volatile uint32_t bytes_saved = 0;
+static recorder_stats_t stats;                 // Health of the recording in progress
+static const uint32_t histogram_limits_ms[RECORDER_HISTOGRAM_BUCKETS] = RECORDER_HISTOGRAM_LIMITS_MS;
+static uint32_t checkpoint_seconds = RECORDER_CHECKPOINT_SECONDS;
+static uint32_t samples_captured = 0; // Samples given to the writer since recorder_begin()
+static uint32_t next_checkpoint = 0;  // samples_captured at which the next checkpoint is due
+static voice_detector_t vad;
+static loudness_meter_t meter;         // Levels of the audio written
+static loudness_t levels;              // and the result, once the recording is finished
+static uint32_t voice_end_bytes = 0;   // Encoded/written bytes up to the end of the block holding the last voice
+static uint32_t voice_end_samples = 0; // and the samples they hold
+static uint32_t bleed_blocks = 0;      // Pre-roll blocks at the start of the recording
+static uint32_t bleed_remaining = 0;   // of which still to be turned down
+static uint32_t samples_saved = 0;     // Samples whose encoded audio is all in the file
+
+// Encodes whose output isn't all in the file yet, the bytes to the end of each and the samples they hold, so a
+// checkpoint only counts audio that is on the card.  When it fills up the newest mark is moved on instead.
+#define RECORDER_PENDING_MARKS 64
+static struct {
+    uint32_t bytes;
+    uint32_t samples;
+} pending_marks[RECORDER_PENDING_MARKS];
+static uint32_t pending_head = 0; // Free running
+static uint32_t pending_tail = 0;
+
+// The SD library is most efficient with large writes that are a multiple of the 512 byte sector size
+static uint8_t write_buffer[RECORDER_WRITE_BLOCKS * AUDIO_BLOCK_SAMPLES * sizeof(int16_t)];
+// Encoded audio waiting to be written, only whole sectors are written until the recording ends
+static uint8_t encoded_buffer[2 * sizeof write_buffer + 1024] __attribute__((aligned(4)));
+static uint32_t encoded_fill = 0;
+static uint8_t header_buffer[RECORDER_MAX_HEADER_BYTES] __attribute__((aligned(4)));
+
+static void writer(EventResponderRef event);
+static void checkpoint(void);
+static void mark_voice(uint32_t bytes, uint32_t samples);
+static void mark_pending(uint32_t bytes, uint32_t samples);
+static void saved_up_to(uint32_t bytes);
+static void suppress_bleed(int16_t *samples, uint32_t blocks);
+static void analyse(const int16_t *block);
+static void finish(void);
+
+/**
+ * @brief Attach the writer to the ring, call once from setup().
+ */
+void recorder_init(AudioRecordRing *ring) {
+    record_ring = ring;
+    if (RECORDER_ELASTIC_BLOCKS > 0) {
+        record_ring->use_elastic(RECORDER_ELASTIC_BLOCKS);
+    }
+    writer_event.attachInterrupt(writer);
+}
+
+/**
+ * @brief Start capturing in to the ring before the recording proper.
+ */
+void recorder_preroll(void) {
+    uint32_t samples = RECORDER_PREROLL_MS * RECORDER_SAMPLE_RATE / 1000;
+    uint32_t blocks = (samples + AUDIO_BLOCK_SAMPLES - 1) / AUDIO_BLOCK_SAMPLES;
+
+    // Blocks held in the ring come out of AudioMemory() unless the elastic buffer is in use
+    if (!record_ring->is_elastic() && blocks > RECORD_RING_BLOCKS / 4) {
+        blocks = RECORD_RING_BLOCKS / 4;
+    }
+    record_ring->preroll(blocks);
+}
+
+/**
+ * @brief Keep the pre-roll and everything captured from now on for recorder_begin().
+ */
+void recorder_hold(void) { record_ring->hold(); }
+
+/**
+ * @brief Throw away the pre-roll.
+ */
+void recorder_cancel(void) { record_ring->clear(); }
+
+/**
+ * @brief Start capturing audio in to the (already open, empty) file.
+ */
+void recorder_begin(FsFile *file, const recorder_format_t *format) {
+    // Anything held since recorder_hold() is the start of the recording
+    bleed_blocks = record_ring->held();
+    bleed_remaining = bleed_blocks;
+    if (bleed_blocks == 0) {
+        record_ring->clear();
+    }
+    record_file = file;
+    record_format = format;
+    bytes_saved = 0;
+    samples_saved = 0;
+    pending_head = 0;
+    pending_tail = 0;
+    memset(&stats, 0, sizeof stats);
+    stats.min_write_us = UINT32_MAX;
+    encoded_fill = 0;
+    flushed = false;
+    if (format->reset != NULL) {
+        format->reset();
+    }
+
+    // Reserve the header space up front, the audio then starts on a sector boundary
+    record_start = file->curPosition();
+    if (format->header_bytes <= sizeof header_buffer) {
+        format->build_header(header_buffer, 0, NULL);
+        file->write(header_buffer, format->header_bytes);
+    }
+
+    samples_captured = 0;
+    blocks_taken = 0;
+    limit_blocks = ((uint64_t)limit_ms * format->sample_rate / 1000 + AUDIO_BLOCK_SAMPLES - 1) / AUDIO_BLOCK_SAMPLES;
+    next_checkpoint = checkpoint_seconds * format->sample_rate;
+    vad_init(&vad, format->sample_rate);
+    loudness_init(&meter, format->sample_rate);
+    analysed_blocks = 0;
+    streaming = !RECORDER_RAM_MODE;
+    background = false;
+    voice_end_bytes = 0;
+    voice_end_samples = 0;
+    flushing = false;
+    record_ring->begin(&writer_event, RECORDER_WRITE_BLOCKS);
+}
+
+/**
+ * @brief Set how often the header is checkpointed, in seconds of audio (0 for never).
+ */
+void recorder_set_checkpoint_interval(uint32_t seconds) { checkpoint_seconds = seconds; }
+
+/**
+ * @brief Limit recordings to 'milliseconds' of audio, takes effect from the next recorder_begin().
+ */
+void recorder_set_limit(uint32_t milliseconds) { limit_ms = milliseconds; }
+
+/**
+ * @brief Samples captured for the recording so far, or in the file once it has been finished.
+ */
+uint32_t recorder_samples(void) {
+    uint32_t taken;
+    uint32_t waiting;
+
+    if (record_file == NULL) {
+        return stats.samples;
+    }
+
+    // The writer pre-empts us, so if blocks_taken didn't change it didn't run in between and the two add up
+    do {
+        taken = blocks_taken;
+        waiting = record_ring->available();
+    } while (taken != blocks_taken);
+
+    uint32_t blocks = taken + waiting;
+    if (limit_blocks > 0 && blocks > limit_blocks) {
+        blocks = limit_blocks;
+    }
+    return blocks * AUDIO_BLOCK_SAMPLES;
+}
+
+/**
+ * @brief Whether the recording has captured as much audio as recorder_set_limit() allows.
+ */
+bool recorder_limit_reached(void) {
+    return limit_blocks > 0 && record_file != NULL && recorder_samples() >= limit_blocks * AUDIO_BLOCK_SAMPLES;
+}
+
+/**
+ * @brief Stop capturing and have the writer save everything still in the ring.
+ */
+void recorder_end(void) {
+    flushing = true;
+
+    if (RECORDER_RAM_MODE) {
+        // Up to the whole call is still in RAM, the ring wakes the writer for one write every audio update until it
+        // is all on the card, see recorder_poll()
+        background = true;
+        record_ring->drain();
+        return;
+    }
+
+    record_ring->end();
+
+    // The writer runs at a higher priority than us so once triggered it will have emptied the ring by the time
+    // triggerEvent() returns, loop just in case it was already running and missed the flush request.
+    while (!flushed) {
+        writer_event.triggerEvent();
+        yield();
+    }
+
+    finish();
+}
+
+/**
+ * @brief Whether the recording ended by recorder_end() is all in the file (and the writer detached from it).
+ */
+bool recorder_poll(void) {
+    if (record_file == NULL) {
+        return true;
+    }
+    if (!flushed) {
+        return false;
+    }
+
+    finish();
+    return true;
+}
+
+/**
+ * @brief Detach from the file once the writer has flushed everything, and settle the stats and trim.
+ */
+static void finish(void) {
+    record_ring->end();
+    flushing = false;
+    background = false;
+    record_file = NULL;
+
+#if VAD_TRIM
+    // Cut the silence after the last voice, unless there was never any voice (better a quiet message than none)
+    if (vad_heard_voice(&vad) && voice_end_bytes < bytes_saved) {
+        stats.trimmed_samples = samples_captured - voice_end_samples;
+        bytes_saved = voice_end_bytes;
+        if (record_format->trim != NULL) {
+            record_format->trim(voice_end_samples);
+        }
+    }
+#endif
+
+    stats.samples = samples_captured - stats.trimmed_samples;
+    samples_saved = stats.samples;
+    loudness_result(&meter, &levels);
+    stats.peak_depth = record_ring->peak_depth();
+    stats.capacity = record_ring->capacity();
+    stats.dropped_blocks = record_ring->overruns();
+}
+
+/**
+ * @brief How long the recording has been silent (no voice), in milliseconds.
+ */
+uint32_t recorder_silent_ms(void) {
+    if (record_format == NULL) {
+        return 0;
+    }
+    return (uint64_t)vad_silent_samples(&vad) * 1000 / record_format->sample_rate;
+}
+
+/**
+ * @brief Levels of the last recording, valid once it has been finished.
+ */
+const loudness_t *recorder_loudness(void) { return &levels; }
+
+/**
+ * @brief Number of bytes of audio written to the file since recorder_begin().
+ */
+uint32_t recorder_bytes_saved(void) { return bytes_saved; }
+
+/**
+ * @brief Samples in the audio written to the file since recorder_begin(), only those whose encoded audio is all there.
+ */
+uint32_t recorder_samples_saved(void) { return samples_saved; }
+
+/**
+ * @brief Peak number of blocks waiting for the writer since recorder_begin().
+ */
+uint32_t recorder_peak_fill(void) { return record_ring->peak_depth(); }
+
+/**
+ * @brief Number of blocks the ring (or elastic buffer) can hold.
+ */
+uint32_t recorder_capacity(void) { return record_ring->capacity(); }
+
+/**
+ * @brief Longest single SD write since recorder_begin(), in microseconds.
+ */
+uint32_t recorder_max_write_us(void) { return stats.max_write_us; }
+
+/**
+ * @brief Longest header checkpoint (write and sync) since recorder_begin(), in microseconds.
+ */
+uint32_t recorder_max_checkpoint_us(void) { return stats.max_checkpoint_us; }
+
+/**
+ * @brief Capture health counters for the current (or last) recording.
+ */
+const recorder_stats_t *recorder_stats(void) { return &stats; }
+
+/**
+ * @brief Format the capture health counters as text for the file's LIST/INFO chunk.
+ */
+size_t recorder_format_stats(char *text, size_t size) {
+    uint32_t min_us = (stats.writes > 0) ? stats.min_write_us : 0;
+    uint32_t avg_us = (stats.writes > 0) ? (uint32_t)(stats.total_write_us / stats.writes) : 0;
+
+    int length = snprintf(text, size,
+                          "queue peak=%lu/%lu dropped=%lu; sd writes=%lu min=%luus avg=%luus max=%luus "
+                          "checkpoint max=%luus; latency ms <1:%lu <2:%lu <5:%lu <10:%lu <20:%lu <50:%lu "
+                          "<100:%lu >=100:%lu; encode cycles/block avg=%lu max=%lu; length=%lums silence trimmed=%lums; "
+                          "rms=%.1fdB peak=%.1fdB loudness=%.1fLUFS clipped=%lu",
+                          stats.peak_depth, stats.capacity, stats.dropped_blocks, stats.writes, min_us, avg_us,
+                          stats.max_write_us, stats.max_checkpoint_us, stats.histogram[0], stats.histogram[1],
+                          stats.histogram[2], stats.histogram[3], stats.histogram[4], stats.histogram[5],
+                          stats.histogram[6], stats.histogram[7],
+                          (stats.encoded_blocks > 0) ? (uint32_t)(stats.total_encode_cycles / stats.encoded_blocks) : 0,
+                          stats.max_encode_cycles,
+                          (record_format != NULL)
+                              ? (uint32_t)((uint64_t)stats.samples * 1000 / record_format->sample_rate)
+                              : 0,
+                          (record_format != NULL)
+                              ? (uint32_t)((uint64_t)stats.trimmed_samples * 1000 / record_format->sample_rate)
+                              : 0,
+                          levels.rms_cb / 100.0, levels.peak_cb / 100.0, levels.lufs_cb / 100.0, levels.clipped);
+
+    if (length < 0) {
+        return 0;
+    }
+    return ((size_t)length < size) ? length : size - 1;
+}
+
+/**
+ * @brief Number of audio blocks lost because the ring was full since recorder_begin().
+ */
+uint32_t recorder_dropped_blocks(void) { return record_ring->overruns(); }
+
+/**
+ * @brief Writer, runs as a low priority interrupt and owns all SD writes while recording.
+ */
+static void writer(EventResponderRef event) {
+    (void)event;
+
+    if (record_file == NULL) {
+        return;
+    }
+
+    // Voice detection sees every block as it arrives, even those left in RAM until the call ends
+    uint32_t waiting = record_ring->available();
+    for (uint32_t i = analysed_blocks - blocks_taken; i < waiting; i++) {
+        analyse(record_ring->peek(i));
+    }
+
+    // RAM mode recordings only start writing (and then carry on streaming) if the call outgrows RAM
+    if (!streaming && waiting >= record_ring->capacity() * 3 / 4) {
+        streaming = true;
+    }
+
+    while ((streaming && record_ring->available() >= RECORDER_WRITE_BLOCKS) || (flushing && !flushed)) {
+        uint32_t blocks = record_ring->read(write_buffer, RECORDER_WRITE_BLOCKS);
+        // Blocks that arrived during a slow write since the analysis above haven't been seen by the voice detection
+        for (uint32_t i = analysed_blocks - blocks_taken; i < blocks; i++) {
+            analyse((const int16_t *)write_buffer + i * AUDIO_BLOCK_SAMPLES);
+        }
+        blocks_taken += blocks;
+        if (limit_blocks > 0 && blocks_taken > limit_blocks) {
+            // Past the time limit, loop() is about to stop the recording and anything after the limit is dropped
+            uint32_t over = blocks_taken - limit_blocks;
+            blocks = (over < blocks) ? blocks - over : 0;
+        }
+        samples_captured += blocks * AUDIO_BLOCK_SAMPLES;
+        if (bleed_remaining > 0) {
+            suppress_bleed((int16_t *)write_buffer, blocks);
+        }
+        loudness_block(&meter, (const int16_t *)write_buffer, blocks * AUDIO_BLOCK_SAMPLES);
+        bool last = flushing && record_ring->available() == 0;
+        const uint8_t *data = write_buffer;
+        size_t length = blocks * AUDIO_BLOCK_SAMPLES * sizeof(int16_t);
+
+        if (record_format->encode != NULL) {
+            if (blocks > 0) {
+                uint32_t cycles = ARM_DWT_CYCCNT;
+                encoded_fill += record_format->encode((const int16_t *)write_buffer, blocks * AUDIO_BLOCK_SAMPLES,
+                                                      encoded_buffer + encoded_fill);
+                cycles = (ARM_DWT_CYCCNT - cycles) / blocks;
+                stats.total_encode_cycles += (uint64_t)cycles * blocks;
+                stats.encoded_blocks += blocks;
+                if (cycles > stats.max_encode_cycles) {
+                    stats.max_encode_cycles = cycles;
+                }
+            }
+
+            if (last) {
+                encoded_fill += record_format->flush(encoded_buffer + encoded_fill);
+            }
+            // Everything encoded so far ends on a block/frame boundary, a valid place to cut the file.  The encoder
+            // holds back any samples short of a whole block until it is flushed.
+            uint32_t encoded_samples = last ? samples_captured
+                                            : samples_captured - samples_captured % record_format->block_samples;
+            mark_voice(bytes_saved + encoded_fill, encoded_samples);
+            mark_pending(bytes_saved + encoded_fill, encoded_samples);
+            if (!last && encoded_fill < sizeof write_buffer) {
+                continue; // Keep the writes big
+            }
+
+            // Whole sectors only until the very end, the rest waits for the next write
+            data = encoded_buffer;
+            length = last ? encoded_fill : encoded_fill & ~511UL;
+        } else {
+            mark_voice(bytes_saved + length, samples_captured);
+        }
+
+        if (last) {
+            flushed = true;
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        elapsedMicros write_timer = 0;
+        record_file->write(data, length);
+        uint32_t write_us = write_timer;
+        bytes_saved += length;
+        saved_up_to(bytes_saved);
+
+        if (data == encoded_buffer) {
+            encoded_fill -= length;
+            memmove(encoded_buffer, encoded_buffer + length, encoded_fill);
+        }
+
+        stats.writes++;
+        stats.total_write_us += write_us;
+        if (write_us < stats.min_write_us) {
+            stats.min_write_us = write_us;
+        }
+        if (write_us > stats.max_write_us) {
+            stats.max_write_us = write_us;
+        }
+        for (int i = 0; i < RECORDER_HISTOGRAM_BUCKETS; i++) {
+            if (write_us < histogram_limits_ms[i] * 1000ULL) {
+                stats.histogram[i]++;
+                break;
+            }
+        }
+
+        if (checkpoint_seconds > 0 && samples_captured >= next_checkpoint) {
+            checkpoint();
+            next_checkpoint = samples_captured + checkpoint_seconds * record_format->sample_rate;
+        }
+
+        if (background) {
+            break; // One write per audio update so loop() still gets to run
+        }
+    }
+}
+
+/**
+ * @brief The first 'bytes' of audio hold 'samples' samples, move the trim point up to there if the voice heard so far
+ * (and its hangover) goes past it.  So the trim point ends up at the first block boundary after the last voice.
+ */
+static void mark_voice(uint32_t bytes, uint32_t samples) {
+    if (vad.last_voice_samples > voice_end_samples) {
+        voice_end_bytes = bytes;
+        voice_end_samples = samples;
+    }
+}
+
+/**
+ * @brief Note that the first 'bytes' of encoded audio hold 'samples' samples.
+ */
+static void mark_pending(uint32_t bytes, uint32_t samples) {
+    if (pending_head - pending_tail == RECORDER_PENDING_MARKS) {
+        pending_head--;
+    }
+    pending_marks[pending_head % RECORDER_PENDING_MARKS].bytes = bytes;
+    pending_marks[pending_head % RECORDER_PENDING_MARKS].samples = samples;
+    pending_head++;
+}
+
+/**
+ * @brief The first 'bytes' of audio are in the file, move samples_saved up to the last whole encode they hold.
+ */
+static void saved_up_to(uint32_t bytes) {
+    if (record_format->encode == NULL) {
+        samples_saved = samples_captured; // PCM is written as it is captured
+        return;
+    }
+    while (pending_tail != pending_head && pending_marks[pending_tail % RECORDER_PENDING_MARKS].bytes <= bytes) {
+        samples_saved = pending_marks[pending_tail % RECORDER_PENDING_MARKS].samples;
+        pending_tail++;
+    }
+}
+
+/**
+ * @brief Give the next block to the voice detection.  The pre-roll is mostly the prompt bleeding in to the microphone,
+ * at full gain as it hasn't been turned down yet, so it is skipped rather than taken for the guest's voice.
+ */
+static void analyse(const int16_t *block) {
+    if (analysed_blocks < bleed_blocks) {
+        vad_skip(&vad, AUDIO_BLOCK_SAMPLES);
+    } else {
+        vad_block(&vad, block, AUDIO_BLOCK_SAMPLES);
+    }
+    analysed_blocks++;
+}
+
+/**
+ * @brief Turn down the pre-roll blocks among the 'blocks' just read, mostly the prompt picked up by the microphone,
+ * ramping back up to full gain over the last one.
+ */
+static void suppress_bleed(int16_t *samples, uint32_t blocks) {
+    const int32_t bleed_gain = RECORDER_PREROLL_BLEED_GAIN * 32768;
+
+    for (uint32_t i = 0; i < blocks && bleed_remaining > 0; i++, bleed_remaining--) {
+        int16_t *block = samples + i * AUDIO_BLOCK_SAMPLES;
+        for (uint32_t j = 0; j < AUDIO_BLOCK_SAMPLES; j++) {
+            int32_t gain = bleed_gain;
+            if (bleed_remaining == 1) {
+                gain += (32768 - bleed_gain) * (int32_t)j / AUDIO_BLOCK_SAMPLES;
+            }
+            block[j] = (block[j] * gain) >> 15;
+        }
+    }
+}
+
+/**
+ * @brief Make the file valid up to what has been written so far: rewrite the header with the current sizes and
+ * sync so the directory entry is updated too.  If the power goes now only audio since this point is lost.
+ */
+static void checkpoint(void) {
+    elapsedMicros checkpoint_time = 0;
+
+    if (record_format->header_bytes > sizeof header_buffer) {
+        return;
+    }
+
+    record_format->build_header(header_buffer, bytes_saved, NULL);
+    record_file->seekSet(record_start);
+    record_file->write(header_buffer, record_format->header_bytes);
+    record_file->seekSet(record_start + record_format->header_bytes + bytes_saved);
+    record_file->sync();
+
+    if (checkpoint_time > stats.max_checkpoint_us) {
+        stats.max_checkpoint_us = checkpoint_time;
+    }
+}
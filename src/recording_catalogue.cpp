@@ -0,0 +1,270 @@
+/**
+ * In RAM catalogue of the recordings on the SD card, see recording_catalogue.h.
+ */
+#include "recording_catalogue.h"
+#include <SD.h>
+
+static recording_entry_t *entries = NULL;
+static uint16_t entry_count = 0;
+
+static bool scan_directory(FsFile *directory, uint32_t date, int hour, catalogue_visit_fn visit, bool *sorted);
+static void add_found(FsFile *directory, FsFile *file, uint16_t number, uint32_t timestamp, uint8_t flags,
+                      catalogue_visit_fn visit, bool *sorted);
+static bool parse_digits(const char *text, int count, uint32_t *value);
+static int parse_extension(const char *extension);
+static int compare_entries(const void *a, const void *b);
+static int find_entry(uint16_t number);
+
+/**
+ * @brief Scan the SD card root and date directories once and build the catalogue.
+ */
+bool catalogue_build(catalogue_visit_fn visit) {
+    bool sorted = true;
+
+    if (entries == NULL) {
+        entries = (recording_entry_t *)extmem_malloc(CATALOGUE_MAX_RECORDINGS * sizeof(recording_entry_t));
+        if (entries == NULL) {
+            return false;
+        }
+    }
+    entry_count = 0;
+
+    FsFile root = SD.sdfs.open("/");
+    if (!root) {
+        return false;
+    }
+    bool ok = scan_directory(&root, 0, -1, visit, &sorted);
+    root.close();
+
+    // Directory order is normally creation order so this is rarely needed
+    if (!sorted) {
+        qsort(entries, entry_count, sizeof(recording_entry_t), compare_entries);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Add (or update) a recording after it has been closed.
+ */
+void catalogue_add(uint16_t number, uint32_t size, uint32_t timestamp, uint8_t flags) {
+    if (entries == NULL) {
+        return;
+    }
+
+    int index = find_entry(number);
+    if (index < 0) {
+        if (entry_count >= CATALOGUE_MAX_RECORDINGS) {
+            return;
+        }
+
+        // New recordings are always the highest number so this is an append in practice
+        index = entry_count;
+        while (index > 0 && entries[index - 1].number > number) {
+            entries[index] = entries[index - 1];
+            index--;
+        }
+        entry_count++;
+    }
+
+    entries[index].number = number;
+    entries[index].flags = flags;
+    entries[index].size = size;
+    entries[index].timestamp = timestamp;
+}
+
+/**
+ * @brief Number to use for the next recording, one more than the highest on the card.
+ */
+uint16_t catalogue_next_number(void) { return (entry_count > 0) ? entries[entry_count - 1].number + 1 : 0; }
+
+/**
+ * @brief Total number of recordings on the card.
+ */
+uint16_t catalogue_count(void) { return entry_count; }
+
+/**
+ * @brief Entry 'index' in recording number order.
+ */
+const recording_entry_t *catalogue_entry(uint16_t index) { return (index < entry_count) ? &entries[index] : NULL; }
+
+/**
+ * @brief Path of a recording from its number, start time and format.
+ */
+bool catalogue_path(uint16_t number, uint32_t timestamp, uint8_t flags, char *path, size_t size) {
+    const char *extension = (flags & CATALOGUE_FLAC) ? "flac" : "wav";
+    uint16_t date = timestamp >> 16;
+    uint16_t time = timestamp & 0xFFFF;
+
+    if (flags & CATALOGUE_CONTAINER) {
+        return false;
+    }
+    if (!(flags & CATALOGUE_DATED)) {
+        snprintf(path, size, " %05u.%s", number, extension);
+        return true;
+    }
+
+    snprintf(path, size, "/%04u-%02u-%02u/%02u/%05u-%02u%02u.%s", FS_YEAR(date), FS_MONTH(date), FS_DAY(date),
+             FS_HOUR(time), number, FS_HOUR(time), FS_MINUTE(time), extension);
+    return true;
+}
+
+/**
+ * @brief Recording number from a " NNNNN.wav" (or " NNNNN.flac") filename.
+ */
+bool catalogue_parse_name(const char *name, uint16_t *number) {
+    uint32_t value;
+
+    if (name[0] != ' ' || !parse_digits(&name[1], 5, &value) || parse_extension(&name[6]) < 0 ||
+        value > UINT16_MAX) {
+        return false;
+    }
+
+    *number = value;
+    return true;
+}
+
+/**
+ * @brief Catalogue the recordings in 'directory', and the date directories under it if it is the root.  'date' is
+ * the FAT date of a day directory (0 for the root) and 'hour' the hour of an hour directory (-1 if not one).
+ */
+static bool scan_directory(FsFile *directory, uint32_t date, int hour, catalogue_visit_fn visit, bool *sorted) {
+    char name[16];
+    uint32_t value;
+    uint32_t file_hour;
+    uint32_t minute;
+    uint16_t modify_date;
+    uint16_t modify_time;
+    uint16_t number;
+    int flags;
+
+    // Opened read only as directories can't be opened for writing, recordings are reopened read/write to visit them
+    FsFile file;
+    while (file.openNext(directory, O_RDONLY)) {
+        if (file.getName(name, sizeof name) == 0) {
+            // Name too long to be one of ours
+            file.close();
+            continue;
+        }
+
+        if (file.isDir()) {
+            uint32_t year;
+            uint32_t month;
+            uint32_t day;
+
+            if (date == 0 && hour < 0 && parse_digits(name, 4, &year) && name[4] == '-' &&
+                parse_digits(&name[5], 2, &month) && name[7] == '-' && parse_digits(&name[8], 2, &day) &&
+                name[10] == '\0' && year >= 1980) {
+                // A day
+                scan_directory(&file, FS_DATE(year, month, day), -1, visit, sorted);
+            } else if (date != 0 && hour < 0 && parse_digits(name, 2, &value) && name[2] == '\0' && value < 24) {
+                // An hour of the day
+                scan_directory(&file, date, value, visit, sorted);
+            }
+        } else if (hour >= 0) {
+            // "NNNNN-HHMM.wav", the hour is the directory's
+            if (parse_digits(name, 5, &value) && value <= UINT16_MAX && name[5] == '-' &&
+                parse_digits(&name[6], 2, &file_hour) && file_hour == (uint32_t)hour &&
+                parse_digits(&name[8], 2, &minute) && minute < 60 && (flags = parse_extension(&name[10])) >= 0) {
+                add_found(directory, &file, value, (date << 16) | FS_TIME(hour, minute, 0), flags | CATALOGUE_DATED,
+                          visit, sorted);
+            }
+        } else if (date == 0 && catalogue_parse_name(name, &number)) {
+            // From before the date directories, the only time there is the last modified one
+            uint32_t timestamp = 0;
+            if (file.getModifyDateTime(&modify_date, &modify_time)) {
+                timestamp = ((uint32_t)modify_date << 16) | modify_time;
+            }
+            add_found(directory, &file, number, timestamp, parse_extension(&name[6]), visit, sorted);
+        }
+        file.close();
+    }
+
+    return directory->getError() == 0;
+}
+
+/**
+ * @brief Add a recording found in the scan, visiting it first.
+ */
+static void add_found(FsFile *directory, FsFile *file, uint16_t number, uint32_t timestamp, uint8_t flags,
+                      catalogue_visit_fn visit, bool *sorted) {
+    if (entry_count >= CATALOGUE_MAX_RECORDINGS) {
+        return;
+    }
+
+    uint64_t size = file->fileSize();
+    if (visit != NULL) {
+        // By its directory index, no lookup by name
+        uint32_t index = file->dirIndex();
+        file->close();
+        if (file->open(directory, index, O_RDWR)) {
+            visit(file);
+            size = file->fileSize();
+        } else if (file->open(directory, index, O_RDONLY)) {
+            // Read-only (marked so on a PC perhaps), it can't be repaired but it is still a recording
+            size = file->fileSize();
+        }
+    }
+
+    recording_entry_t *entry = &entries[entry_count];
+    entry->number = number;
+    entry->flags = flags;
+    entry->size = size;
+    entry->timestamp = timestamp;
+    if (entry_count > 0 && entries[entry_count - 1].number > number) {
+        *sorted = false;
+    }
+    entry_count++;
+}
+
+/**
+ * @brief Parse exactly 'count' decimal digits.
+ */
+static bool parse_digits(const char *text, int count, uint32_t *value) {
+    *value = 0;
+    for (int i = 0; i < count; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        *value = *value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief Flags for a recording's extension, ".wav" or ".flac", -1 if it is neither.
+ */
+static int parse_extension(const char *extension) {
+    if (strcasecmp(extension, ".wav") == 0) {
+        return 0;
+    }
+    return (strcasecmp(extension, ".flac") == 0) ? CATALOGUE_FLAC : -1;
+}
+
+/**
+ * @brief qsort() comparison, by recording number.
+ */
+static int compare_entries(const void *a, const void *b) {
+    return (int)((const recording_entry_t *)a)->number - (int)((const recording_entry_t *)b)->number;
+}
+
+/**
+ * @brief Binary search for a recording number, returns its index or -1.
+ */
+static int find_entry(uint16_t number) {
+    int low = 0;
+    int high = (int)entry_count - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (entries[mid].number == number) {
+            return mid;
+        } else if (entries[mid].number < number) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
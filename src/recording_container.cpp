@@ -0,0 +1,340 @@
+/**
+ * Log structured store of recordings in one preallocated container file, see recording_container.h.
+ */
+#include "recording_container.h"
+#include "recording_catalogue.h"
+
+static container_header_t header;
+static container_entry_t *entries = NULL;
+static uint32_t entry_count = 0;
+static uint32_t total_sectors = 0;
+static container_segment_t segment; // Being recorded
+static container_levels_t levels;   // and its levels, once it is closed
+static uint32_t segment_sector = 0;
+static bool rebuilt = false;
+static uint8_t sector[CONTAINER_SECTOR_BYTES] __attribute__((aligned(4)));
+
+static bool create(FsFile *file);
+static bool read_header(FsFile *file);
+static bool read_index(FsFile *file);
+static bool read_segment(FsFile *file, uint32_t at, uint32_t generation);
+static void scan(FsFile *file);
+static bool write_index(FsFile *file);
+static bool seek_sector(FsFile *file, uint32_t at);
+static uint32_t index_sectors(uint32_t count);
+
+/**
+ * @brief Open the container, creating it or rebuilding its index if need be, and catalogue its recordings.
+ */
+bool container_open(FsFile *file) {
+    if (entries == NULL) {
+        entries = (container_entry_t *)extmem_malloc(CONTAINER_MAX_SEGMENTS * sizeof(container_entry_t));
+        if (entries == NULL) {
+            return false;
+        }
+    }
+    entry_count = 0;
+    rebuilt = false;
+
+    *file = SD.sdfs.open(CONTAINER_FILE, O_RDWR | O_CREAT);
+    if (!*file) {
+        return false;
+    }
+
+    if (!read_header(file)) {
+        // No (usable) header, but if the first segment is intact the header sector was all that was lost.  The size
+        // went with it, and on exFAT the file size stops at the last sector written, so take the size it was made at.
+        container_segment_t *first = (container_segment_t *)sector;
+        total_sectors = max(file->fileSize(), (uint64_t)CONTAINER_BYTES) / CONTAINER_SECTOR_BYTES;
+        if (!read_segment(file, 1, 0)) {
+            return create(file);
+        }
+        header.magic = CONTAINER_MAGIC;
+        header.version = CONTAINER_VERSION;
+        header.sector_bytes = CONTAINER_SECTOR_BYTES;
+        header.generation = first->generation;
+        header.total_sectors = total_sectors;
+        scan(file);
+    } else if (!read_index(file)) {
+        // A recording was started over the index and never closed
+        scan(file);
+    }
+
+    for (uint32_t i = 0; i < entry_count; i++) {
+        catalogue_add(entries[i].number, entries[i].bytes, entries[i].timestamp, CATALOGUE_CONTAINER);
+    }
+    return true;
+}
+
+/**
+ * @brief Start a new segment at the end of the log.
+ */
+bool container_begin_segment(FsFile *file, uint16_t number, uint32_t timestamp, uint32_t max_bytes) {
+    uint32_t needed = container_segment_sectors(max_bytes) + index_sectors(entry_count + 1);
+
+    if (entry_count >= CONTAINER_MAX_SEGMENTS || header.end_sector + needed > total_sectors) {
+        return false;
+    }
+
+    memset(&segment, 0, sizeof segment);
+    memset(&levels, 0, sizeof levels);
+    segment.magic = CONTAINER_SEGMENT_MAGIC;
+    segment.generation = header.generation;
+    segment.number = number;
+    segment.timestamp = timestamp;
+    segment_sector = header.end_sector;
+
+    return file->seekSet((uint64_t)segment_sector * CONTAINER_SECTOR_BYTES);
+}
+
+/**
+ * @brief Build the segment header sector for the segment being recorded.
+ */
+void container_segment_header(uint8_t *out, uint32_t header_bytes, uint32_t data_bytes) {
+    segment.header_bytes = header_bytes;
+    segment.data_bytes = data_bytes;
+    segment.crc = container_crc32(0, &segment, offsetof(container_segment_t, crc));
+
+    memset(out, 0, CONTAINER_SECTOR_BYTES);
+    memcpy(out, &segment, sizeof segment);
+    if (segment.flags & CONTAINER_SEGMENT_LEVELS) {
+        memcpy(out + sizeof segment, &levels, sizeof levels);
+    }
+}
+
+/**
+ * @brief Keep the levels of the segment being recorded for its header.
+ */
+void container_segment_levels(uint32_t samples, const loudness_t *loudness) {
+    levels.samples = samples;
+    levels.rms_cb = loudness->rms_cb;
+    levels.peak_cb = loudness->peak_cb;
+    levels.lufs_cb = loudness->lufs_cb;
+    levels.clipped = loudness->clipped;
+    levels.crc = container_crc32(0, &levels, offsetof(container_levels_t, crc));
+    segment.flags |= CONTAINER_SEGMENT_LEVELS;
+}
+
+/**
+ * @brief Close the segment being recorded and rewrite the index after it.
+ */
+bool container_end_segment(FsFile *file, uint32_t bytes) {
+    container_entry_t *entry = &entries[entry_count++];
+
+    entry->number = segment.number;
+    entry->flags = 0;
+    entry->sector = segment_sector;
+    entry->bytes = bytes;
+    entry->timestamp = segment.timestamp;
+    header.end_sector = segment_sector + container_segment_sectors(bytes);
+
+    return write_index(file);
+}
+
+/**
+ * @brief Call 'visit' with the levels from the header of each segment that has them, oldest first.
+ */
+uint32_t container_list_levels(FsFile *file, loudness_index_visit_fn visit) {
+    container_segment_t *s = (container_segment_t *)sector;
+    container_levels_t *l = (container_levels_t *)(sector + sizeof(container_segment_t));
+    uint32_t visited = 0;
+
+    for (uint32_t i = 0; i < entry_count; i++) {
+        if (!read_segment(file, entries[i].sector, header.generation) || !(s->flags & CONTAINER_SEGMENT_LEVELS) ||
+            l->crc != container_crc32(0, l, offsetof(container_levels_t, crc))) {
+            continue;
+        }
+
+        loudness_record_t record = {s->number, l->samples, s->timestamp,
+                                    {l->rms_cb, l->peak_cb, l->lufs_cb, l->clipped}};
+        visited++;
+        if (!visit(&record)) {
+            break;
+        }
+    }
+    return visited;
+}
+
+/**
+ * @brief Number of recordings in the container.
+ */
+uint32_t container_count(void) { return entry_count; }
+
+/**
+ * @brief Whether the index had to be rebuilt from the segment headers at boot.
+ */
+bool container_rebuilt(void) { return rebuilt; }
+
+/**
+ * @brief Bytes left in the container for recordings.
+ */
+uint64_t container_free(void) {
+    uint32_t used = header.end_sector + index_sectors(entry_count + 1) + 1; // Room for the next segment's header
+    return (used < total_sectors) ? (uint64_t)(total_sectors - used) * CONTAINER_SECTOR_BYTES : 0;
+}
+
+/**
+ * @brief Allocate a new, empty, container.
+ */
+static bool create(FsFile *file) {
+    // A container with nothing usable in it, start again from empty
+    if (file->fileSize() > 0 && !file->truncate(0)) {
+        return false;
+    }
+    if (!file->preAllocate(CONTAINER_BYTES)) {
+        return false;
+    }
+    total_sectors = CONTAINER_BYTES / CONTAINER_SECTOR_BYTES;
+
+    header.magic = CONTAINER_MAGIC;
+    header.version = CONTAINER_VERSION;
+    header.sector_bytes = CONTAINER_SECTOR_BYTES;
+    header.generation = ARM_DWT_CYCCNT ^ micros() ^ rtc_get();
+    header.end_sector = 1;
+    header.total_sectors = total_sectors;
+    entry_count = 0;
+
+    return write_index(file);
+}
+
+/**
+ * @brief Read and check the header sector, and take the size of the container from it.
+ */
+static bool read_header(FsFile *file) {
+    if (!file->seekSet(0) || file->read(sector, sizeof sector) != sizeof sector) {
+        return false;
+    }
+    memcpy(&header, sector, sizeof header);
+
+    if (header.magic != CONTAINER_MAGIC || header.version != CONTAINER_VERSION ||
+        header.sector_bytes != CONTAINER_SECTOR_BYTES ||
+        header.crc != container_crc32(0, &header, offsetof(container_header_t, crc)) ||
+        header.end_sector >= header.total_sectors) {
+        return false;
+    }
+
+    total_sectors = header.total_sectors;
+    return true;
+}
+
+/**
+ * @brief Read and check the index at the end of the log.
+ */
+static bool read_index(FsFile *file) {
+    container_index_t index;
+
+    if (!file->seekSet((uint64_t)header.end_sector * CONTAINER_SECTOR_BYTES) ||
+        file->read(&index, sizeof index) != sizeof index || index.magic != CONTAINER_INDEX_MAGIC ||
+        index.generation != header.generation || index.count > CONTAINER_MAX_SEGMENTS) {
+        return false;
+    }
+
+    size_t bytes = index.count * sizeof(container_entry_t);
+    if (file->read(entries, bytes) != (int)bytes || container_crc32(0, entries, bytes) != index.crc) {
+        return false;
+    }
+
+    entry_count = index.count;
+    return true;
+}
+
+/**
+ * @brief Read the segment header at sector 'at' in to the sector buffer and check it belongs to 'generation' (any
+ * generation if 0).
+ */
+static bool read_segment(FsFile *file, uint32_t at, uint32_t generation) {
+    container_segment_t *s = (container_segment_t *)sector;
+
+    if (!file->seekSet((uint64_t)at * CONTAINER_SECTOR_BYTES) || file->read(sector, sizeof sector) != sizeof sector) {
+        return false;
+    }
+
+    return s->magic == CONTAINER_SEGMENT_MAGIC && (generation == 0 || s->generation == generation) &&
+           s->crc == container_crc32(0, s, offsetof(container_segment_t, crc)) &&
+           at + container_segment_sectors(s->header_bytes + s->data_bytes) <= total_sectors;
+}
+
+/**
+ * @brief Rebuild the index by hopping from segment header to segment header from the start of the log, then write
+ * it back.  The last segment is kept up to its last checkpoint, or dropped if it never got to one.
+ */
+static void scan(FsFile *file) {
+    container_segment_t *s = (container_segment_t *)sector;
+    uint32_t at = 1;
+
+    entry_count = 0;
+    while (entry_count < CONTAINER_MAX_SEGMENTS && read_segment(file, at, header.generation)) {
+        if (s->data_bytes == 0) {
+            break;
+        }
+
+        container_entry_t *entry = &entries[entry_count++];
+        entry->number = s->number;
+        entry->flags = 0;
+        entry->sector = at;
+        entry->bytes = s->header_bytes + s->data_bytes;
+        entry->timestamp = s->timestamp;
+        at += container_segment_sectors(entry->bytes);
+    }
+
+    header.end_sector = at;
+    rebuilt = true;
+    write_index(file);
+}
+
+/**
+ * @brief Write the index at the end of the log then point the header at it.  If the power goes in between, the
+ * header still points at the old index which is now the start of a segment, so it is rebuilt at the next boot.
+ */
+static bool write_index(FsFile *file) {
+    container_index_t index = {CONTAINER_INDEX_MAGIC, header.generation, entry_count,
+                               container_crc32(0, entries, entry_count * sizeof(container_entry_t))};
+
+    if (!seek_sector(file, header.end_sector)) {
+        return false;
+    }
+    file->write(&index, sizeof index);
+    file->write(entries, entry_count * sizeof(container_entry_t));
+
+    header.segments = entry_count;
+    header.crc = container_crc32(0, &header, offsetof(container_header_t, crc));
+    memset(sector, 0, sizeof sector);
+    memcpy(sector, &header, sizeof header);
+    file->seekSet(0);
+    bool ok = file->write(sector, sizeof sector) == sizeof sector;
+
+    return file->sync() && ok;
+}
+
+/**
+ * @brief Seek to the start of sector 'at', writing zeros up to it first if it is past the end of what has been written.
+ * On exFAT preallocating doesn't move the file's valid length, and SdFat won't seek past it: a new container is empty
+ * up to its first index, and a segment's last sector is only written as far as the recording goes.
+ */
+static bool seek_sector(FsFile *file, uint32_t at) {
+    uint64_t position = (uint64_t)at * CONTAINER_SECTOR_BYTES;
+    uint64_t size = file->fileSize();
+
+    if (position > size) {
+        if (!file->seekSet(size)) {
+            return false;
+        }
+        memset(sector, 0, sizeof sector);
+        while (size < position) {
+            size_t length = (position - size < sizeof sector) ? position - size : sizeof sector;
+            if (file->write(sector, length) != length) {
+                return false;
+            }
+            size += length;
+        }
+    }
+    return file->seekSet(position);
+}
+
+/**
+ * @brief Sectors the index takes with 'count' entries.
+ */
+static uint32_t index_sectors(uint32_t count) {
+    return (sizeof(container_index_t) + count * sizeof(container_entry_t) + CONTAINER_SECTOR_BYTES - 1) /
+           CONTAINER_SECTOR_BYTES;
+}
@@ -0,0 +1,198 @@
+/**
+ * Background mirroring of finished recordings to a second storage device, see recording_mirror.h.
+ */
+#include "recording_mirror.h"
+#include "recording_catalogue.h"
+#include <SD.h>
+
+static FS *mirror = NULL;
+static uint16_t next_number = 0; // Recordings below this number are all mirrored
+static uint16_t next_index = 0;  // Catalogue index of the next recording to look at
+static bool copying = false;
+static bool full = false;
+static FsFile source;
+static File copy;
+static char name[CATALOGUE_PATH_BYTES];
+static elapsedMillis budget_timer;
+static uint32_t budget = 0;
+static uint8_t buffer[MIRROR_CHUNK_BYTES] __attribute__((aligned(4)));
+
+static bool open_next(void);
+static void make_directories(void);
+static void finish_copy(void);
+static void save_progress(void);
+
+/**
+ * @brief Start mirroring to 'target', reading back how far a previous run got.
+ */
+void mirror_begin(FS *target) {
+    char text[8] = {0};
+
+    mirror = target;
+    next_number = 0;
+    next_index = 0;
+    copying = false;
+    full = false;
+
+    File progress = mirror->open(MIRROR_PROGRESS_FILE, FILE_READ);
+    if (progress) {
+        progress.read(text, sizeof text - 1);
+        next_number = atoi(text);
+        progress.close();
+    }
+
+    budget = 0;
+    budget_timer = 0;
+}
+
+/**
+ * @brief Copy the next chunk if the rate limit allows.
+ */
+void mirror_poll(void) {
+    if (mirror == NULL || full) {
+        return;
+    }
+
+    // Token bucket, never more than one chunk's worth saved up so there are no bursts after a long call
+    budget += (uint32_t)budget_timer * MIRROR_BYTES_PER_SECOND / 1000;
+    budget_timer = 0;
+    if (budget > MIRROR_CHUNK_BYTES) {
+        budget = MIRROR_CHUNK_BYTES;
+    }
+    if (budget < MIRROR_CHUNK_BYTES) {
+        return;
+    }
+
+    if (!copying && !open_next()) {
+        return;
+    }
+
+    int length = source.read(buffer, sizeof buffer);
+    if (length < 0) {
+        // Read error, close up and try this recording again from where the copy got to
+        source.close();
+        copy.close();
+        copying = false;
+        return;
+    }
+
+    if (length > 0 && copy.write(buffer, length) != (size_t)length) {
+        // Out of space, the copy so far is kept and will be carried on if space is made
+        source.close();
+        copy.close();
+        copying = false;
+        full = true;
+        return;
+    }
+    budget -= sizeof buffer;
+
+    if (length < (int)sizeof buffer) {
+        finish_copy();
+    }
+}
+
+/**
+ * @brief Number of recordings in the catalogue not yet (completely) mirrored.
+ */
+uint16_t mirror_pending(void) {
+    uint16_t count = catalogue_count();
+
+    while (next_index < count && catalogue_entry(next_index)->number < next_number) {
+        next_index++;
+    }
+    return count - next_index;
+}
+
+/**
+ * @brief Whether the mirror has run out of space.
+ */
+bool mirror_full(void) { return full; }
+
+/**
+ * @brief Open the next recording that needs mirroring and its copy, positioned to carry on from the copy's size.
+ *
+ * @return false if there is nothing to do (or it couldn't be opened, it is tried again next time).
+ */
+static bool open_next(void) {
+    while (mirror_pending() > 0) {
+        const recording_entry_t *entry = catalogue_entry(next_index);
+
+        // Recordings in the container have no file to copy, and files gone since the catalogue was built are skipped
+        if (!catalogue_path(entry->number, entry->timestamp, entry->flags, name, sizeof name) ||
+            !SD.sdfs.exists(name)) {
+            next_number = entry->number + 1;
+            continue;
+        }
+
+        source = SD.sdfs.open(name, O_RDONLY);
+        if (!source) {
+            return false;
+        }
+
+        // FILE_WRITE appends, so a copy interrupted by a reboot carries on where it stopped
+        uint64_t size = source.fileSize();
+        make_directories();
+        copy = mirror->open(name, FILE_WRITE);
+        if (copy && copy.size() > size) {
+            copy.close();
+            mirror->remove(name);
+            copy = mirror->open(name, FILE_WRITE);
+        }
+        if (!copy) {
+            source.close();
+            return false;
+        }
+
+        if (copy.size() == size) {
+            finish_copy();
+            continue;
+        }
+
+        source.seekSet(copy.size());
+        copying = true;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Create the day and hour directories on the mirror for the recording at 'name', one level at a time as not
+ * every FS creates parents.  Ones that are already there just fail.
+ */
+static void make_directories(void) {
+    for (char *slash = strchr(name + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mirror->mkdir(name);
+        *slash = '/';
+    }
+}
+
+/**
+ * @brief Close the completed copy and move on to the next recording.
+ */
+static void finish_copy(void) {
+    uint16_t number = catalogue_entry(next_index)->number;
+
+    source.close();
+    copy.close();
+    copying = false;
+
+    next_number = number + 1;
+    save_progress();
+}
+
+/**
+ * @brief Record how far mirroring has got on the mirror itself.
+ */
+static void save_progress(void) {
+    char text[8];
+
+    // Fixed width so the file never needs truncating
+    snprintf(text, sizeof text, "%05u\n", next_number);
+    File progress = mirror->open(MIRROR_PROGRESS_FILE, FILE_WRITE_BEGIN);
+    if (progress) {
+        progress.write(text, strlen(text));
+        progress.close();
+    }
+}
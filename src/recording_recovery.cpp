@@ -0,0 +1,292 @@
+/**
+ * Boot time recovery of recordings left unfinalised by a power cut, see recording_recovery.h.
+ */
+#include "recording_recovery.h"
+#include "flac_encoder.h"
+
+#define HEADER_SCAN_BYTES 512 // The header sector of a recording, and the window FLAC frames are read through
+#define LEGACY_HEADER_BYTES 44 // Canonical header written over the start of the audio by the original firmware
+
+static uint16_t repaired = 0;
+static uint16_t unrepairable = 0;
+static uint8_t header[HEADER_SCAN_BYTES] __attribute__((aligned(4)));
+static FsFile *scan_file = NULL;   // File being walked by byte_at()
+static uint32_t scan_size = 0;
+static uint32_t scan_sector = UINT32_MAX; // Sector of it in 'header'
+
+static bool recover_flac(FsFile *file, uint32_t file_size);
+static int byte_at(uint32_t pos);
+static uint32_t frame_header_bytes(uint32_t pos, uint32_t number);
+static uint32_t frame_end(uint32_t pos, uint32_t number, uint32_t max_bytes, bool *more);
+static uint32_t get_be(const uint8_t *p, int bytes);
+static uint32_t get_le32(const uint8_t *p);
+static void put_le32(uint8_t *p, uint32_t value);
+
+/**
+ * @brief Reset the counters, call before the catalogue is built.
+ */
+void recovery_begin(void) {
+    repaired = 0;
+    unrepairable = 0;
+}
+
+/**
+ * @brief Check the header of a recording (opened read/write) and repair it if needed.
+ */
+bool recovery_visit(FsFile *file) {
+    uint32_t file_size = file->fileSize();
+    uint32_t data_offset = 0;
+    uint32_t block_align = 1;
+    uint32_t samples_per_block = 0; // IMA ADPCM only
+    int fact_pos = -1;
+
+    if (file_size == 0) {
+        // Power went before even the header was written, nothing to save
+        unrepairable++;
+        return false;
+    }
+
+    file->seekSet(0);
+    int length = file->read(header, sizeof header);
+    if (length >= 4 && memcmp(header, "fLaC", 4) == 0) {
+        return recover_flac(file, file_size);
+    }
+    if (length < 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        unrepairable++;
+        return false;
+    }
+
+    // Walk the chunks in the header sector to find "fmt " and where the audio starts
+    for (int pos = 12; pos + 8 <= length;) {
+        uint32_t chunk_size = get_le32(header + pos + 4);
+        if (memcmp(header + pos, "fmt ", 4) == 0 && pos + 22 <= length) {
+            block_align = header[pos + 20] | (header[pos + 21] << 8);
+            if ((header[pos + 8] | (header[pos + 9] << 8)) == 0x0011 && chunk_size >= 20 && pos + 28 <= length) {
+                samples_per_block = header[pos + 26] | (header[pos + 27] << 8);
+            }
+        } else if (memcmp(header + pos, "fact", 4) == 0 && pos + 12 <= length) {
+            fact_pos = pos;
+        } else if (memcmp(header + pos, "data", 4) == 0) {
+            data_offset = pos + 8;
+            break;
+        }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (data_offset == 0 || data_offset > file_size || block_align == 0) {
+        unrepairable++;
+        return false;
+    }
+
+    uint32_t riff_bytes = get_le32(header + 4);
+    uint32_t header_data_bytes = get_le32(header + data_offset - 4);
+    uint32_t file_data_bytes = file_size - data_offset;
+
+    // The original firmware's headers claim two bytes more audio than the file holds, that is how they were finalised
+    // and every player copes, so they are left as they are
+    if (data_offset == LEGACY_HEADER_BYTES && riff_bytes == file_size - 8 && header_data_bytes == file_data_bytes + 2) {
+        return false;
+    }
+
+    // The header is rewritten and synced at every checkpoint, so the audio it covers is what is known to be on the
+    // card.  The file's size isn't: a preallocated file is as long as its whole extent, stale sectors and all.
+    uint32_t data_bytes = (header_data_bytes < file_data_bytes) ? header_data_bytes : file_data_bytes;
+    data_bytes -= data_bytes % block_align;
+
+    if (riff_bytes == data_offset - 8 + data_bytes && header_data_bytes == data_bytes &&
+        file_data_bytes == data_bytes) {
+        return false; // Finalised correctly
+    }
+
+    if (riff_bytes != data_offset - 8 + data_bytes || header_data_bytes != data_bytes) {
+        put_le32(header + 4, data_offset - 8 + data_bytes);
+        put_le32(header + data_offset - 4, data_bytes);
+        if (fact_pos >= 0 && samples_per_block > 0) {
+            // Whole ADPCM blocks only (a partial one was dropped above)
+            put_le32(header + fact_pos + 8, data_bytes / block_align * samples_per_block);
+        }
+        file->seekSet(0);
+        file->write(header, data_offset);
+    }
+    // Give back the rest of the extent the recording never got to use
+    file->truncate(data_offset + data_bytes);
+    file->sync();
+
+    repaired++;
+    return true;
+}
+
+/**
+ * @brief Number of recordings repaired since recovery_begin().
+ */
+uint16_t recovery_repaired(void) { return repaired; }
+
+/**
+ * @brief Number of recordings that could not be repaired since recovery_begin().
+ */
+uint16_t recovery_unrepairable(void) { return unrepairable; }
+
+/**
+ * @brief Cut a FLAC recording back to the frames its STREAMINFO (last checkpoint) counts.  The frames are
+ * self-delimiting so a recording that was never finalised plays anyway, but a preallocated one still has the rest of
+ * its extent after them: stale sectors that players would try to decode.
+ *
+ * @return true if the file was cut back.
+ */
+static bool recover_flac(FsFile *file, uint32_t file_size) {
+    // STREAMINFO straight after "fLaC": block size, frame sizes and the total samples in the low 36 of 64 bits
+    uint32_t block_samples = get_be(header + 8, 2);
+    uint32_t max_frame_bytes = get_be(header + 15, 3);
+    uint64_t total_samples = ((uint64_t)(header[21] & 0x0f) << 32) | get_be(header + 22, 4);
+    uint32_t frames = (block_samples > 0) ? total_samples / block_samples : 0;
+
+    // A finalised recording is no longer than its frames can be, only walk the ones that might not be
+    if (file_size <= FLAC_HEADER_BYTES + (uint64_t)frames * max_frame_bytes) {
+        return false;
+    }
+
+    scan_file = file;
+    scan_size = file_size;
+    scan_sector = UINT32_MAX;
+
+    uint32_t end = FLAC_HEADER_BYTES;
+    bool more = frames > 0 && frame_header_bytes(end, 0) > 0;
+    for (uint32_t number = 0; number < frames && more; number++) {
+        uint32_t next = frame_end(end, number, max_frame_bytes, &more);
+        if (next == 0) {
+            break; // Torn frame, everything before it is good
+        }
+        end = next;
+        more = more && number + 1 < frames;
+    }
+
+    file->truncate(end);
+    file->sync();
+    repaired++;
+    return true;
+}
+
+/**
+ * @brief Byte 'pos' of the file being walked, read a sector at a time, -1 past the end.
+ */
+static int byte_at(uint32_t pos) {
+    if (pos >= scan_size) {
+        return -1;
+    }
+    uint32_t sector = pos / HEADER_SCAN_BYTES;
+    if (sector != scan_sector) {
+        scan_file->seekSet((uint64_t)sector * HEADER_SCAN_BYTES);
+        if (scan_file->read(header, HEADER_SCAN_BYTES) <= 0) {
+            return -1;
+        }
+        scan_sector = sector;
+    }
+    return header[pos % HEADER_SCAN_BYTES];
+}
+
+/**
+ * @brief Length of the FLAC frame header at 'pos' (up to and including its CRC-8) if it is frame 'number', else 0.
+ */
+static uint32_t frame_header_bytes(uint32_t pos, uint32_t number) {
+    uint8_t bytes[16];
+    uint32_t length = 5; // Sync, block size/rate, channels/bits and the first byte of the frame number
+    uint8_t crc = 0;
+
+    for (uint32_t i = 0; i < length + 1; i++) {
+        int c = byte_at(pos + i);
+        if (c < 0) {
+            return 0;
+        }
+        bytes[i] = c;
+        if (i == 4) {
+            if (bytes[0] != 0xff || (bytes[1] & 0xfe) != 0xf8) {
+                return 0;
+            }
+            // Frame number (UTF-8 style, leading ones give the extra bytes) then the block size and rate extras
+            uint32_t extra = 0;
+            for (uint8_t lead = c; (lead & 0x80) && extra < 7; lead <<= 1) {
+                extra++;
+            }
+            uint32_t block_code = bytes[2] >> 4;
+            uint32_t rate_code = bytes[2] & 0x0f;
+            length += (extra > 0 ? extra - 1 : 0) + (block_code == 6 ? 1 : block_code == 7 ? 2 : 0) +
+                      (rate_code == 12 ? 1 : (rate_code == 13 || rate_code == 14) ? 2 : 0);
+            if (length + 1 > sizeof bytes) {
+                return 0;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    if (crc != bytes[length]) {
+        return 0;
+    }
+
+    uint32_t extra = length - 5; // Our frames have no block size or rate extras
+    uint32_t value = (extra == 0) ? bytes[4] : bytes[4] & (0x3f >> extra);
+    for (uint32_t i = 0; i < extra; i++) {
+        value = (value << 6) | (bytes[5 + i] & 0x3f);
+    }
+    return (value == number) ? length + 1 : 0;
+}
+
+/**
+ * @brief End of FLAC frame 'number' starting at 'pos': the first place its CRC-16 footer matches, preferring one that
+ * frame 'number' + 1 follows.  'more' is set if it does.
+ *
+ * @return Offset just past the frame, 0 if no footer matched within 'max_bytes' (the frame is torn).
+ */
+static uint32_t frame_end(uint32_t pos, uint32_t number, uint32_t max_bytes, bool *more) {
+    uint32_t limit = (max_bytes > 0) ? pos + max_bytes : scan_size;
+    uint32_t first_match = 0;
+    uint16_t crc = 0;
+
+    *more = false;
+    for (uint32_t end = pos; end + 3 <= limit; end++) {
+        int c = byte_at(end);
+        int footer_high = byte_at(end + 1);
+        int footer_low = byte_at(end + 2);
+        if (c < 0) {
+            break;
+        }
+        crc ^= c << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        }
+        if (footer_low < 0 || (uint16_t)((footer_high << 8) | footer_low) != crc) {
+            continue;
+        }
+        if (frame_header_bytes(end + 3, number + 1) > 0) {
+            *more = true;
+            return end + 3;
+        }
+        if (first_match == 0) {
+            first_match = end + 3;
+        }
+    }
+    return first_match;
+}
+
+static uint32_t get_be(const uint8_t *p, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
@@ -0,0 +1,198 @@
+/**
+ * Streaming sample rate converter for playback, see resampler.h.
+ */
+#include "resampler.h"
+#include <dspinst.h>
+#include <math.h>
+
+#define PHASE_BITS __builtin_ctz(RESAMPLER_PHASES)
+
+// Phase k is the filter for an output sample k / RESAMPLER_PHASES of the way between the two middle samples of the
+// window, oldest sample first.  The extra phase at the end is for interpolating past the last one.
+static int16_t coefficients[RESAMPLER_PHASES + 1][RESAMPLER_TAPS] __attribute__((aligned(4)));
+static bool designed = false;
+
+static int16_t polyphase(const int16_t *window, uint32_t frac);
+static int16_t cubic(const int16_t *window, uint32_t frac);
+static int16_t saturate(int32_t sample);
+static double bessel_i0(double x);
+
+/**
+ * @brief Build the polyphase filter table, once.
+ */
+void resampler_design(void) {
+    double taps[RESAMPLER_TAPS];
+    double half = RESAMPLER_TAPS / 2.0;
+    double window_scale = 1.0 / bessel_i0(RESAMPLER_KAISER_BETA);
+
+    if (designed) {
+        return;
+    }
+
+    for (uint32_t k = 0; k <= RESAMPLER_PHASES; k++) {
+        double frac = (double)k / RESAMPLER_PHASES;
+        double sum = 0.0;
+
+        // Windowed-sinc at the distance of each sample in the window from the output sample
+        for (uint32_t j = 0; j < RESAMPLER_TAPS; j++) {
+            double t = j - half + 1.0 - frac;
+            double sinc = (t == 0.0) ? 2.0 * RESAMPLER_CUTOFF
+                                     : sin(2.0 * M_PI * RESAMPLER_CUTOFF * t) / (M_PI * t);
+            double r = t / half;
+            taps[j] = sinc * bessel_i0(RESAMPLER_KAISER_BETA * sqrt(fmax(0.0, 1.0 - r * r))) * window_scale;
+            sum += taps[j];
+        }
+
+        // Unity gain at DC for every phase, with the rounding taken up by the largest tap so it is exact
+        int32_t total = 0;
+        uint32_t largest = 0;
+        for (uint32_t j = 0; j < RESAMPLER_TAPS; j++) {
+            long tap = lround(taps[j] / sum * 32768.0);
+            coefficients[k][j] = (tap > 32767) ? 32767 : (tap < -32768) ? -32768 : tap;
+            total += coefficients[k][j];
+            if (abs(coefficients[k][j]) > abs(coefficients[k][largest])) {
+                largest = j;
+            }
+        }
+        coefficients[k][largest] += 32768 - total;
+    }
+
+    designed = true;
+}
+
+/**
+ * @brief Reset a resampler for a new sound.
+ */
+bool resampler_init(resampler_t *resampler, uint32_t in_rate, uint32_t out_rate, uint8_t channels, uint8_t mode) {
+    if (in_rate < RESAMPLER_MIN_RATE || in_rate > RESAMPLER_MAX_RATE || out_rate < RESAMPLER_MIN_RATE ||
+        out_rate > RESAMPLER_MAX_RATE || channels < 1 || channels > 2 || (mode == RESAMPLER_POLYPHASE && !designed)) {
+        return false;
+    }
+
+    memset(resampler->history, 0, sizeof resampler->history);
+    resampler->mode = (in_rate == out_rate) ? RESAMPLER_NONE : mode;
+    resampler->channels = channels;
+    resampler->step = ((uint64_t)in_rate << 32) / out_rate;
+    resampler->frac = 0;
+    resampler->write = 0;
+
+    // The first output sample lines up with the first input sample, so nothing is added to the start
+    switch (resampler->mode) {
+    case RESAMPLER_LINEAR:
+        resampler->need = 2;
+        break;
+    case RESAMPLER_CUBIC:
+        resampler->need = 3;
+        break;
+    case RESAMPLER_POLYPHASE:
+        resampler->need = RESAMPLER_TAPS / 2 + 1;
+        break;
+    default:
+        resampler->need = 1;
+        break;
+    }
+    resampler->delay = resampler->need - 1;
+
+    return true;
+}
+
+/**
+ * @brief Take the output sample that is due and move on to the next.
+ */
+void resampler_output(resampler_t *resampler, int16_t *left, int16_t *right) {
+    uint32_t frac = resampler->frac;
+
+    for (uint32_t c = 0; c < resampler->channels; c++) {
+        const int16_t *window = &resampler->history[c][resampler->write];
+        int16_t sample;
+
+        switch (resampler->mode) {
+        case RESAMPLER_LINEAR: {
+            // Between the newest two samples
+            int32_t x0 = window[RESAMPLER_TAPS - 2];
+            int32_t x1 = window[RESAMPLER_TAPS - 1];
+            sample = x0 + (((x1 - x0) * (int32_t)(frac >> 17)) >> 15);
+            break;
+        }
+        case RESAMPLER_CUBIC:
+            sample = cubic(window, frac);
+            break;
+        case RESAMPLER_POLYPHASE:
+            sample = polyphase(window, frac);
+            break;
+        default:
+            sample = window[RESAMPLER_TAPS - 1];
+            break;
+        }
+        *((c == 0) ? left : right) = sample;
+    }
+
+    uint64_t position = (uint64_t)frac + resampler->step;
+    resampler->need = position >> 32;
+    resampler->frac = (uint32_t)position;
+}
+
+/**
+ * @brief Filter the window with the phases either side of 'frac' and interpolate between them.
+ */
+static int16_t polyphase(const int16_t *window, uint32_t frac) {
+    uint32_t k = frac >> (32 - PHASE_BITS);
+    int32_t weight = (frac >> (32 - PHASE_BITS - 15)) & 0x7FFF;
+    const int16_t *c0 = coefficients[k];
+    const int16_t *c1 = coefficients[k + 1];
+    int32_t sum0 = 0;
+    int32_t sum1 = 0;
+
+    // Two taps per SMLAD, unaligned loads are fine on the M7
+    for (uint32_t j = 0; j < RESAMPLER_TAPS; j += 2) {
+        uint32_t samples;
+        uint32_t taps0;
+        uint32_t taps1;
+        memcpy(&samples, window + j, sizeof samples);
+        memcpy(&taps0, c0 + j, sizeof taps0);
+        memcpy(&taps1, c1 + j, sizeof taps1);
+        sum0 = multiply_accumulate_16tx16t_add_16bx16b(sum0, samples, taps0);
+        sum1 = multiply_accumulate_16tx16t_add_16bx16b(sum1, samples, taps1);
+    }
+
+    int32_t sum = sum0 + (int32_t)(((int64_t)(sum1 - sum0) * weight) >> 15);
+    return signed_saturate_rshift(sum + (1 << 14), 16, 15);
+}
+
+/**
+ * @brief Catmull-Rom spline through the newest four samples, between the middle two.
+ */
+static int16_t cubic(const int16_t *window, uint32_t frac) {
+    int64_t p0 = window[RESAMPLER_TAPS - 4];
+    int64_t p1 = window[RESAMPLER_TAPS - 3];
+    int64_t p2 = window[RESAMPLER_TAPS - 2];
+    int64_t p3 = window[RESAMPLER_TAPS - 1];
+    int64_t t = frac >> 17; // Q15
+
+    int64_t v = 3 * (p1 - p2) + p3 - p0;
+    v = 2 * p0 - 5 * p1 + 4 * p2 - p3 + ((v * t) >> 15);
+    v = p2 - p0 + ((v * t) >> 15);
+    return saturate(p1 + ((v * t) >> 16));
+}
+
+/**
+ * @brief Clamp to 16 bits.
+ */
+static int16_t saturate(int32_t sample) { return (sample > 32767) ? 32767 : (sample < -32768) ? -32768 : sample; }
+
+/**
+ * @brief Modified Bessel function of the first kind, order 0, for the Kaiser window.
+ */
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
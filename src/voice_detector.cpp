@@ -0,0 +1,88 @@
+/**
+ * Streaming voice activity detector, see voice_detector.h.
+ */
+#include "voice_detector.h"
+
+/**
+ * @brief Reset the detector ready for a new recording.
+ */
+void vad_init(voice_detector_t *vad, uint32_t sample_rate) {
+    vad->sample_rate = sample_rate;
+    // Until a whole noise window has been heard, assume the quietest background voice is heard over
+    vad->noise_floor = VAD_ENERGY_MIN / VAD_NOISE_RATIO;
+    for (int i = 0; i < VAD_NOISE_WINDOWS; i++) {
+        vad->noise_min[i] = vad->noise_floor;
+    }
+    vad->window_min = UINT32_MAX;
+    vad->window_blocks = 1;
+    vad->window_fill = 0;
+    vad->window_index = 0;
+    vad->zcr_threshold = 0;
+    vad->block_samples = 0;
+    vad->hangover_samples = (uint64_t)VAD_HANGOVER_MS * sample_rate / 1000;
+    vad->samples = 0;
+    vad->last_voice_samples = 0;
+}
+
+/**
+ * @brief Classify the next 'samples' samples (one audio block).
+ */
+bool vad_block(voice_detector_t *vad, const int16_t *pcm, uint32_t samples) {
+    uint32_t energy = 0;
+    uint32_t crossings = 0;
+
+    if (samples == 0) {
+        return false;
+    }
+
+    if (samples != vad->block_samples) {
+        vad->block_samples = samples;
+        vad->zcr_threshold = (uint64_t)2 * VAD_ZCR_HZ * samples / vad->sample_rate;
+        vad->window_blocks = (uint64_t)VAD_NOISE_WINDOW_MS * vad->sample_rate / 1000 / VAD_NOISE_WINDOWS / samples;
+        if (vad->window_blocks == 0) {
+            vad->window_blocks = 1;
+        }
+    }
+
+    // Squares scaled down by 256 so a block of up to 256 full scale samples can't overflow
+    for (uint32_t i = 0; i < samples; i++) {
+        int32_t x = pcm[i];
+        energy += (uint32_t)(x * x) >> 8;
+        if (i > 0 && (pcm[i] ^ pcm[i - 1]) < 0) {
+            crossings++;
+        }
+    }
+    energy = energy / samples << 8;
+
+    uint32_t threshold = (vad->noise_floor < UINT32_MAX / VAD_NOISE_RATIO) ? vad->noise_floor * VAD_NOISE_RATIO
+                                                                            : UINT32_MAX;
+    if (threshold < VAD_ENERGY_MIN) {
+        threshold = VAD_ENERGY_MIN;
+    }
+    bool voice = energy >= threshold || (energy >= threshold / 2 && crossings >= vad->zcr_threshold);
+
+    // Minimum statistics: the floor drops straight away to a quieter block and rises once the quieter blocks have
+    // all aged out of the window
+    if (energy < vad->window_min) {
+        vad->window_min = energy;
+    }
+    if (++vad->window_fill >= vad->window_blocks) {
+        vad->noise_min[vad->window_index] = vad->window_min;
+        vad->window_index = (vad->window_index + 1) % VAD_NOISE_WINDOWS;
+        vad->window_min = UINT32_MAX;
+        vad->window_fill = 0;
+    }
+    uint32_t floor = vad->window_min;
+    for (int i = 0; i < VAD_NOISE_WINDOWS; i++) {
+        if (vad->noise_min[i] < floor) {
+            floor = vad->noise_min[i];
+        }
+    }
+    vad->noise_floor = floor;
+
+    vad->samples += samples;
+    if (voice) {
+        vad->last_voice_samples = vad->samples + vad->hangover_samples;
+    }
+    return voice;
+}
@@ -0,0 +1,96 @@
+/**
+ * Host stand-in for the Teensy core, just enough of it for the modules tested by "pio test -e native".
+ */
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+
+#define DMAMEM
+#define EXTMEM
+#define FASTRUN
+#define PROGMEM
+
+#define F_CPU_ACTUAL 600000000
+
+// Memory barrier for the lock-free rings, the real ones use the M7's "dmb"
+#define RING_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+typedef uint8_t byte;
+
+using std::max;
+using std::min;
+
+class HostSerial {
+public:
+    template <typename... Args> void printf(const char *format, Args... args) { ::printf(format, args...); }
+    void print(const char *text) { fputs(text, stdout); }
+    void println(const char *text = "") { puts(text); }
+};
+inline HostSerial Serial;
+
+inline uint32_t micros(void) {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t millis(void) { return micros() / 1000; }
+inline void delayMicroseconds(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline void delay(uint32_t ms) { delayMicroseconds(ms * 1000); }
+inline void yield(void) { std::this_thread::yield(); }
+inline uint32_t rtc_get(void) { return time(NULL); }
+
+// The cycle counter counts nanoseconds, close enough to 600MHz cycles for budgets and comparisons
+inline uint32_t host_cycle_count(void) {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+#define ARM_DWT_CYCCNT (host_cycle_count())
+
+// MB of PSRAM fitted, tests set it to 0 to see what a stock Teensy 4.1 does
+inline uint8_t external_psram_size = 8;
+inline void *extmem_malloc(size_t size) { return malloc(size); }
+inline void extmem_free(void *ptr) { free(ptr); }
+
+inline void __disable_irq(void) {}
+inline void __enable_irq(void) {}
+
+#define IRQ_SOFTWARE 70
+#define NVIC_IS_ENABLED(irq) (false)
+#define NVIC_DISABLE_IRQ(irq)
+#define NVIC_ENABLE_IRQ(irq)
+
+class elapsedMicros {
+public:
+    elapsedMicros(uint32_t us = 0) : start(micros() - us) {}
+    operator uint32_t() const { return micros() - start; }
+    elapsedMicros &operator=(uint32_t us) {
+        start = micros() - us;
+        return *this;
+    }
+
+private:
+    uint32_t start;
+};
+
+class elapsedMillis {
+public:
+    elapsedMillis(uint32_t ms = 0) : start(millis() - ms) {}
+    operator uint32_t() const { return millis() - start; }
+    elapsedMillis &operator=(uint32_t ms) {
+        start = millis() - ms;
+        return *this;
+    }
+
+private:
+    uint32_t start;
+};
+
+#endif /* ARDUINO_H */
@@ -0,0 +1,65 @@
+/**
+ * Host stand-in for the audio library's AudioStream.  Blocks come from the heap and are counted so tests can check
+ * none leak, the input is whatever the test puts in 'input' before calling update(), and each block transmitted is
+ * passed to 'transmit_hook' (if set) before it is released.
+ */
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define AUDIO_BLOCK_SAMPLES 256 // As set in the installed audio library, see main.cpp
+#define AUDIO_SAMPLE_RATE_EXACT 44100.0f
+#define AUDIO_SAMPLE_RATE AUDIO_SAMPLE_RATE_EXACT
+
+typedef struct audio_block_struct {
+    uint8_t ref_count;
+    uint8_t reserved1;
+    uint16_t memory_pool_index;
+    int16_t data[AUDIO_BLOCK_SAMPLES];
+} audio_block_t;
+
+class AudioStream {
+public:
+    AudioStream(unsigned char inputs, audio_block_t **queue) {
+        (void)inputs;
+        (void)queue;
+    }
+    virtual ~AudioStream() {}
+    virtual void update(void) = 0;
+
+    static audio_block_t *allocate(void) {
+        live_blocks++;
+        // Like the audio library's pool, a block still holds whatever it last carried
+        audio_block_t *block = new audio_block_t();
+        for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+            block->data[i] = 0x5A5A;
+        }
+        return block;
+    }
+    static void release(audio_block_t *block) {
+        live_blocks--;
+        delete block;
+    }
+
+    audio_block_t *input = NULL; // Taken by the next receiveReadOnly()
+    static inline std::atomic<int> live_blocks{0};
+    static inline void (*transmit_hook)(const audio_block_t *block, unsigned char index) = NULL;
+
+protected:
+    audio_block_t *receiveReadOnly(unsigned int index = 0) {
+        (void)index;
+        audio_block_t *block = input;
+        input = NULL;
+        return block;
+    }
+    audio_block_t *receiveWritable(unsigned int index = 0) { return receiveReadOnly(index); }
+    void transmit(audio_block_t *block, unsigned char index = 0) {
+        if (transmit_hook != NULL) {
+            transmit_hook(block, index);
+        }
+    }
+};
+
+#endif /* AUDIOSTREAM_H */
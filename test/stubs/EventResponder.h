@@ -0,0 +1,39 @@
+/**
+ * Host stand-in for EventResponder.  An interrupt event runs straight away when triggered, like the PendSV handler it
+ * is on the Teensy, and a trigger while it is already running runs it again once it returns.
+ */
+#ifndef EVENTRESPONDER_H
+#define EVENTRESPONDER_H
+
+class EventResponder;
+typedef EventResponder &EventResponderRef;
+typedef void (*EventResponderFunction)(EventResponderRef);
+
+class EventResponder {
+public:
+    void attachInterrupt(EventResponderFunction function) { handler = function; }
+    void triggerEvent(int status = 0, void *data = nullptr) {
+        (void)status;
+        (void)data;
+        if (handler == nullptr) {
+            return;
+        }
+        if (running) {
+            pending = true;
+            return;
+        }
+        running = true;
+        do {
+            pending = false;
+            handler(*this);
+        } while (pending);
+        running = false;
+    }
+
+private:
+    EventResponderFunction handler = nullptr;
+    bool running = false;
+    bool pending = false;
+};
+
+#endif /* EVENTRESPONDER_H */
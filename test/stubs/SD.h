@@ -0,0 +1,156 @@
+/**
+ * Host stand-in for the SD library, an FsFile is a file held in memory.  Tests can hook every write to add latency or
+ * to capture more audio part way through one, as the audio interrupt would during a slow SD write.  SD.open() opens a
+ * File on one of 'sd_files', and reads can be hooked for the latency of a slow card too.  SD.sdfs.open() gives a copy
+ * of one of 'sd_fs_files', which a test copies back to have it on the card at the next boot.
+ */
+#ifndef SD_H
+#define SD_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define O_RDONLY 0x00
+#define O_WRONLY 0x01
+#define O_RDWR 0x02
+#define O_CREAT 0x10
+#define O_EXCL 0x20
+#define O_TRUNC 0x40
+
+class FsFile;
+
+// Called before each write with the file, where in it the write goes and how long it is
+typedef void (*sd_write_hook_fn)(FsFile *file, uint64_t position, size_t length);
+inline sd_write_hook_fn sd_write_hook = NULL;
+
+class FsFile {
+public:
+    size_t write(const void *buffer, size_t length) {
+        if (sd_write_hook != NULL) {
+            sd_write_hook(this, position, length);
+        }
+        if (position + length > data.size()) {
+            data.resize(position + length);
+        }
+        memcpy(data.data() + position, buffer, length);
+        position += length;
+        return length;
+    }
+    int read(void *buffer, size_t length) {
+        size_t left = (position < data.size()) ? data.size() - position : 0;
+        if (length > left) {
+            length = left;
+        }
+        if (length > 0) {
+            memcpy(buffer, data.data() + position, length);
+        }
+        position += length;
+        return length;
+    }
+    bool seekSet(uint64_t offset) {
+        if (exfat && offset > data.size()) {
+            return false;
+        }
+        position = offset;
+        return true;
+    }
+    uint64_t curPosition(void) const { return position; }
+    uint64_t fileSize(void) const { return data.size(); }
+    bool preAllocate(uint64_t length) {
+        allocated = length;
+        return true;
+    }
+    bool truncate(uint64_t length) {
+        data.resize(length);
+        return true;
+    }
+    bool truncate(void) { return truncate(position); }
+    bool sync(void) {
+        syncs++;
+        return true;
+    }
+    bool close(void) { return true; }
+    bool isOpen(void) const { return opened; }
+    operator bool() const { return opened; }
+
+    std::vector<uint8_t> data;
+    uint64_t allocated = 0; // Preallocated bytes
+    uint32_t syncs = 0;
+    bool opened = true;
+    // As SdFat on exFAT: the size is the valid length, which preallocating doesn't move, and seekSet() fails past it
+    bool exfat = false;
+
+private:
+    uint64_t position = 0;
+};
+
+class File;
+
+// Called before each read with the file, where in it the read starts and how long it is
+typedef void (*sd_read_hook_fn)(File *file, uint64_t position, size_t length);
+inline sd_read_hook_fn sd_read_hook = NULL;
+
+// The card, by file name
+inline std::map<std::string, std::vector<uint8_t>> sd_files;
+
+class File {
+public:
+    File(std::vector<uint8_t> *data = NULL) : data(data) {}
+    int read(void *buffer, size_t length) {
+        if (data == NULL) {
+            return -1;
+        }
+        if (sd_read_hook != NULL) {
+            sd_read_hook(this, position, length);
+        }
+        size_t left = (position < data->size()) ? data->size() - position : 0;
+        if (length > left) {
+            length = left;
+        }
+        memcpy(buffer, data->data() + position, length);
+        position += length;
+        return length;
+    }
+    int available(void) const { return (data != NULL && position < data->size()) ? data->size() - position : 0; }
+    uint64_t size(void) const { return (data != NULL) ? data->size() : 0; }
+    void close(void) { data = NULL; }
+    operator bool() const { return data != NULL; }
+
+private:
+    std::vector<uint8_t> *data;
+    uint64_t position = 0;
+};
+
+// The card as SD.sdfs sees it, by file name
+inline std::map<std::string, FsFile> sd_fs_files;
+
+class SdFs {
+public:
+    FsFile open(const char *name, int oflag = O_RDONLY) {
+        auto file = sd_fs_files.find(name);
+        if (file == sd_fs_files.end() && !(oflag & O_CREAT)) {
+            FsFile missing;
+            missing.opened = false;
+            return missing;
+        }
+        FsFile opened = sd_fs_files[name];
+        opened.seekSet(0);
+        return opened;
+    }
+};
+
+class SDClass {
+public:
+    File open(const char *name) {
+        auto file = sd_files.find(name);
+        return File((file != sd_files.end()) ? &file->second : NULL);
+    }
+    bool exists(const char *name) { return sd_files.count(name) > 0; }
+
+    SdFs sdfs;
+};
+inline SDClass SD;
+
+#endif /* SD_H */
@@ -0,0 +1,21 @@
+/**
+ * Host versions of the audio library's DSP instruction wrappers.
+ */
+#ifndef DSPINST_H
+#define DSPINST_H
+
+#include <stdint.h>
+
+// SMLAD, sum += top * top + bottom * bottom of two packed 16-bit pairs
+static inline int32_t multiply_accumulate_16tx16t_add_16bx16b(int32_t sum, uint32_t a, uint32_t b) {
+    return sum + (int16_t)(a >> 16) * (int16_t)(b >> 16) + (int16_t)(a & 0xFFFF) * (int16_t)(b & 0xFFFF);
+}
+
+// SSAT with a right shift
+static inline int32_t signed_saturate_rshift(int32_t val, int bits, int rshift) {
+    int32_t max = (1 << (bits - 1)) - 1;
+    int32_t v = val >> rshift;
+    return (v > max) ? max : (v < -max - 1) ? -max - 1 : v;
+}
+
+#endif /* DSPINST_H */
@@ -0,0 +1,10 @@
+/**
+ * Host stand-in for the audio library's spi_interrupt.h, nothing else shares the card on the host.
+ */
+#ifndef SPI_INTERRUPT_H
+#define SPI_INTERRUPT_H
+
+inline void AudioStartUsingSPI(void) {}
+inline void AudioStopUsingSPI(void) {}
+
+#endif /* SPI_INTERRUPT_H */
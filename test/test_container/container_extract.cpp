@@ -0,0 +1,6 @@
+/**
+ * The host extractor from container-extract/, built in to the test with its main() renamed so that the test can run
+ * it on a container it has written.
+ */
+#define main container_extract_main
+#include "../../container-extract/container_extract.cpp"
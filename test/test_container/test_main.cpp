@@ -0,0 +1,346 @@
+/**
+ * The recording container on a card that behaves like FAT32 (the file size covers the preallocated extent) and one
+ * that behaves like exFAT (the file size is the valid length, only as far as has been written, and SdFat won't seek
+ * past it).  Recordings are written in to segments as main.cpp does, and the card is "rebooted" by opening the
+ * container again from what was left on it, after a power cut or a lost header sector too.  What comes back out of
+ * the host extractor has to be the recordings as they were made.
+ */
+#include "wav_header.h"
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <unity.h>
+#include <vector>
+
+// Built in to the test rather than the native env, so the catalogue it fills can be the one below
+#include "../../src/recording_container.cpp"
+
+#define MAX_BYTES (1024 * 1024) // Room asked for each recording
+#define TIMESTAMP 0x5A2F8000UL
+
+typedef WavHeader<1, 16000, 16> test_wav_t;
+
+typedef struct {
+    uint16_t number;
+    uint32_t size;
+    uint32_t timestamp;
+} catalogued_t;
+
+static std::vector<catalogued_t> catalogued;
+static std::vector<loudness_record_t> listed;
+
+int container_extract_main(int argc, char **argv);
+
+void catalogue_add(uint16_t number, uint32_t size, uint32_t timestamp, uint8_t flags) {
+    TEST_ASSERT_EQUAL_UINT8(CATALOGUE_CONTAINER, flags);
+    catalogued.push_back({number, size, timestamp});
+}
+
+static bool keep_levels(const loudness_record_t *record) {
+    listed.push_back(*record);
+    return true;
+}
+
+void setUp(void) {
+    sd_fs_files.clear();
+    catalogued.clear();
+    listed.clear();
+}
+void tearDown(void) {}
+
+/**
+ * @brief A card with no container on it yet.
+ */
+static void new_card(bool exfat) {
+    sd_fs_files[CONTAINER_FILE].exfat = exfat;
+}
+
+/**
+ * @brief Leave 'file' on the card as it is and open the container from it again, as at the next boot.
+ */
+static bool reboot(FsFile *file) {
+    sd_fs_files[CONTAINER_FILE] = *file;
+    catalogued.clear();
+    return container_open(file);
+}
+
+/**
+ * @brief Levels made up for recording 'number'.
+ */
+static loudness_t test_levels(uint16_t number) {
+    return {(int16_t)(-2000 - number), (int16_t)(-300 - number), (int16_t)(-2300 - number), (uint32_t)number * 3};
+}
+
+/**
+ * @brief The segment header sector and WAV header in front of 'data_bytes' of audio.
+ */
+static void build_header(uint8_t *header, uint32_t data_bytes) {
+    container_segment_header(header, test_wav_t::header_bytes, data_bytes);
+    test_wav_t::build(header + CONTAINER_SECTOR_BYTES, data_bytes);
+}
+
+/**
+ * @brief Record 'data_bytes' of audio in to a new segment the way main.cpp and the recorder do, checkpointing the
+ * headers at 'checkpoint_bytes' along the way (if not 0) and closing the segment if 'close'.
+ *
+ * @return The recording as it should come back out of the container, its WAV header and audio up to the end if it
+ * was closed or up to the checkpoint if not.
+ */
+static std::vector<uint8_t> record(FsFile *file, uint16_t number, uint32_t data_bytes, uint32_t checkpoint_bytes,
+                                   bool close) {
+    static uint8_t header[CONTAINER_SECTOR_BYTES + test_wav_t::header_bytes];
+    std::vector<uint8_t> audio(data_bytes);
+
+    for (uint32_t i = 0; i < data_bytes; i++) {
+        audio[i] = number + i * 7;
+    }
+    TEST_ASSERT_TRUE(container_begin_segment(file, number, TIMESTAMP + number, MAX_BYTES));
+    uint64_t start = file->curPosition();
+    build_header(header, 0);
+    file->write(header, sizeof header);
+
+    if (checkpoint_bytes > 0) {
+        file->write(audio.data(), checkpoint_bytes);
+        build_header(header, checkpoint_bytes);
+        TEST_ASSERT_TRUE(file->seekSet(start));
+        file->write(header, sizeof header);
+        file->sync();
+        TEST_ASSERT_TRUE(file->seekSet(start + sizeof header + checkpoint_bytes));
+    }
+    file->write(audio.data() + checkpoint_bytes, data_bytes - checkpoint_bytes);
+
+    uint32_t kept = close ? data_bytes : checkpoint_bytes;
+    if (close) {
+        loudness_t levels = test_levels(number);
+        container_segment_levels(data_bytes / 2, &levels);
+        build_header(header, data_bytes);
+        TEST_ASSERT_TRUE(file->seekSet(start));
+        file->write(header, sizeof header);
+        TEST_ASSERT_TRUE(container_end_segment(file, test_wav_t::header_bytes + data_bytes));
+    }
+
+    std::vector<uint8_t> recording(test_wav_t::header_bytes + kept);
+    test_wav_t::build(recording.data(), kept);
+    memcpy(recording.data() + test_wav_t::header_bytes, audio.data(), kept);
+    return recording;
+}
+
+/**
+ * @brief Check the container holds 'recordings', numbered from 1, each as it was recorded.  At boot they must all
+ * have been catalogued too.
+ */
+static void check_recordings(const FsFile *file, const std::vector<std::vector<uint8_t>> &recordings, bool booted) {
+    TEST_ASSERT_EQUAL_UINT32(recordings.size(), container_count());
+    TEST_ASSERT_EQUAL_UINT32(booted ? recordings.size() : 0, catalogued.size());
+    for (size_t i = 0; i < recordings.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT16(i + 1, entries[i].number);
+        TEST_ASSERT_EQUAL_UINT32(recordings[i].size(), entries[i].bytes);
+        TEST_ASSERT_EQUAL_UINT32(TIMESTAMP + i + 1, entries[i].timestamp);
+        if (booted) {
+            TEST_ASSERT_EQUAL_UINT16(i + 1, catalogued[i].number);
+            TEST_ASSERT_EQUAL_UINT32(recordings[i].size(), catalogued[i].size);
+            TEST_ASSERT_EQUAL_UINT32(TIMESTAMP + i + 1, catalogued[i].timestamp);
+        }
+
+        uint64_t at = ((uint64_t)entries[i].sector + 1) * CONTAINER_SECTOR_BYTES;
+        TEST_ASSERT_LESS_OR_EQUAL(file->data.size(), at + recordings[i].size());
+        TEST_ASSERT_EQUAL_MEMORY(recordings[i].data(), file->data.data() + at, recordings[i].size());
+    }
+}
+
+/**
+ * @brief Create a container, record in to it and open it again through its index.
+ */
+static void create_and_reopen(bool exfat) {
+    static FsFile file;
+    std::vector<std::vector<uint8_t>> recordings;
+
+    new_card(exfat);
+    TEST_ASSERT_TRUE(container_open(&file));
+    TEST_ASSERT_FALSE(container_rebuilt());
+    TEST_ASSERT_EQUAL_UINT32(0, container_count());
+    uint64_t free_bytes = container_free();
+
+    // Audio that doesn't fill its last sector, so the next index is past the end of what was written
+    recordings.push_back(record(&file, 1, 1000, 0, true));
+    recordings.push_back(record(&file, 2, 20000, 8192, true));
+    recordings.push_back(record(&file, 3, 513, 0, true));
+    check_recordings(&file, recordings, false);
+    TEST_ASSERT_LESS_THAN(free_bytes, container_free());
+
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_FALSE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+
+    // And carries on where it left off
+    recordings.push_back(record(&file, 4, 4096, 0, true));
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_FALSE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+}
+
+void test_create_and_reopen_fat32(void) { create_and_reopen(false); }
+
+void test_create_and_reopen_exfat(void) { create_and_reopen(true); }
+
+/**
+ * @brief Lose the power part way through a recording, after it was checkpointed, and boot again.
+ */
+static void crash_after_checkpoint(bool exfat) {
+    static FsFile file;
+    std::vector<std::vector<uint8_t>> recordings;
+
+    new_card(exfat);
+    TEST_ASSERT_TRUE(container_open(&file));
+    recordings.push_back(record(&file, 1, 3000, 0, true));
+    recordings.push_back(record(&file, 2, 50000, 16384, false));
+
+    // Rebuilt from the segment headers, the interrupted recording kept up to its checkpoint
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_TRUE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+
+    // The rebuilt index was written back, the next boot finds it
+    recordings.push_back(record(&file, 3, 7000, 0, true));
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_FALSE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+
+    // Cut short before its first checkpoint, there is nothing of it to keep
+    record(&file, 4, 9000, 0, false);
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_TRUE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+}
+
+void test_crash_after_checkpoint_fat32(void) { crash_after_checkpoint(false); }
+
+void test_crash_after_checkpoint_exfat(void) { crash_after_checkpoint(true); }
+
+void test_lost_header_sector(void) {
+    static FsFile file;
+    std::vector<std::vector<uint8_t>> recordings;
+
+    new_card(true);
+    TEST_ASSERT_TRUE(container_open(&file));
+    recordings.push_back(record(&file, 1, 5000, 0, true));
+    recordings.push_back(record(&file, 2, 6000, 0, true));
+    uint64_t free_bytes = container_free();
+
+    // The recordings and the size of the container come back from the segments
+    memset(file.data.data(), 0, CONTAINER_SECTOR_BYTES);
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_TRUE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+    TEST_ASSERT_EQUAL_UINT64(free_bytes, container_free());
+
+    // With the header written again
+    recordings.push_back(record(&file, 3, 700, 0, true));
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_FALSE(container_rebuilt());
+    check_recordings(&file, recordings, true);
+}
+
+void test_levels_in_segment_headers(void) {
+    static FsFile file;
+
+    new_card(false);
+    TEST_ASSERT_TRUE(container_open(&file));
+    record(&file, 1, 4000, 0, true);
+    record(&file, 2, 8000, 0, true);
+    record(&file, 3, 20000, 8192, false);
+    TEST_ASSERT_TRUE(reboot(&file));
+    TEST_ASSERT_EQUAL_UINT32(3, container_count());
+
+    // The interrupted recording was never closed, so has no levels
+    TEST_ASSERT_EQUAL_UINT32(2, container_list_levels(&file, keep_levels));
+    TEST_ASSERT_EQUAL_UINT32(2, listed.size());
+    for (uint16_t number = 1; number <= 2; number++) {
+        const loudness_record_t &record = listed[number - 1];
+        loudness_t levels = test_levels(number);
+        TEST_ASSERT_EQUAL_UINT16(number, record.number);
+        TEST_ASSERT_EQUAL_UINT32(number * 4000 / 2, record.samples);
+        TEST_ASSERT_EQUAL_UINT32(TIMESTAMP + number, record.timestamp);
+        TEST_ASSERT_EQUAL_INT16(levels.rms_cb, record.levels.rms_cb);
+        TEST_ASSERT_EQUAL_INT16(levels.peak_cb, record.levels.peak_cb);
+        TEST_ASSERT_EQUAL_INT16(levels.lufs_cb, record.levels.lufs_cb);
+        TEST_ASSERT_EQUAL_UINT32(levels.clipped, record.levels.clipped);
+    }
+}
+
+/**
+ * @brief Copy 'file' off the card and split it with the extractor ('scan' to find the recordings from the segment
+ * headers rather than the index), then check it gives back 'recordings', numbered from 1, as .wav files.
+ */
+static void extract(const FsFile *file, const std::vector<std::vector<uint8_t>> &recordings, bool scan) {
+    char directory[] = "/tmp/test_container_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(directory));
+    std::string container = std::string(directory) + "/" + CONTAINER_FILE;
+
+    FILE *out = fopen(container.c_str(), "wb");
+    TEST_ASSERT_NOT_NULL(out);
+    TEST_ASSERT_EQUAL_UINT32(file->data.size(), fwrite(file->data.data(), 1, file->data.size(), out));
+    fclose(out);
+
+    std::vector<char *> argv = {(char *)"container_extract"};
+    if (scan) {
+        argv.push_back((char *)"--scan");
+    }
+    argv.push_back((char *)container.c_str());
+    argv.push_back(directory);
+    TEST_ASSERT_EQUAL_INT(0, container_extract_main(argv.size(), argv.data()));
+
+    for (size_t i = 0; i < recordings.size(); i++) {
+        std::string name = std::string(directory) + "/";
+        name += std::to_string(100000 + i + 1).substr(1) + ".wav";
+        FILE *in = fopen(name.c_str(), "rb");
+        TEST_ASSERT_NOT_NULL(in);
+        std::vector<uint8_t> extracted(recordings[i].size() + 1);
+        TEST_ASSERT_EQUAL_UINT32(recordings[i].size(), fread(extracted.data(), 1, extracted.size(), in));
+        fclose(in);
+        TEST_ASSERT_EQUAL_MEMORY(recordings[i].data(), extracted.data(), recordings[i].size());
+        remove(name.c_str());
+    }
+
+    // Nothing else was written
+    remove(container.c_str());
+    TEST_ASSERT_EQUAL_INT(0, rmdir(directory));
+}
+
+void test_extract_round_trip(void) {
+    static FsFile file;
+    std::vector<std::vector<uint8_t>> recordings;
+
+    new_card(true);
+    TEST_ASSERT_TRUE(container_open(&file));
+    recordings.push_back(record(&file, 1, 12345, 4096, true));
+    recordings.push_back(record(&file, 2, 512, 0, true));
+    recordings.push_back(record(&file, 3, 30001, 0, true));
+    extract(&file, recordings, false);
+    extract(&file, recordings, true);
+}
+
+void test_extract_after_crash(void) {
+    static FsFile file;
+    std::vector<std::vector<uint8_t>> recordings;
+
+    // Copied off before the guestbook booted again, the extractor finds the index gone and scans
+    new_card(true);
+    TEST_ASSERT_TRUE(container_open(&file));
+    recordings.push_back(record(&file, 1, 2000, 0, true));
+    recordings.push_back(record(&file, 2, 40000, 16384, false));
+    extract(&file, recordings, false);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_create_and_reopen_fat32);
+    RUN_TEST(test_create_and_reopen_exfat);
+    RUN_TEST(test_crash_after_checkpoint_fat32);
+    RUN_TEST(test_crash_after_checkpoint_exfat);
+    RUN_TEST(test_lost_header_sector);
+    RUN_TEST(test_levels_in_segment_headers);
+    RUN_TEST(test_extract_round_trip);
+    RUN_TEST(test_extract_after_crash);
+    return UNITY_END();
+}
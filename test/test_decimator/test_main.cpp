@@ -0,0 +1,155 @@
+/**
+ * The recording path's decimator against an ideal reference: the input is a tone at 44.1kHz fed in audio blocks, and
+ * output sample n is the same tone worked out exactly at its time, n x M/L input samples on less the filter's delay
+ * of (L x DECIMATOR_TAPS - 1) / 2 upsampled samples.  The polyphase indexing, the SMLAD packing and carrying the
+ * filter's history and phase over from one block to the next all have to be right to line up with it.
+ */
+#include "decimator.h"
+#include <unity.h>
+#include <vector>
+
+#define TEST_SECONDS 0.5
+#define EDGE_SAMPLES 64 // Left out at the start, while the filter fills
+#define AMPLITUDE 16000.0
+
+static std::vector<int16_t> output;
+
+void setUp(void) {}
+void tearDown(void) { AudioStream::transmit_hook = NULL; }
+
+static void keep_output(const audio_block_t *block, unsigned char index) {
+    (void)index;
+    output.insert(output.end(), block->data, block->data + AUDIO_BLOCK_SAMPLES);
+}
+
+/**
+ * @brief Feed TEST_SECONDS of a tone of 'frequency' Hz through a decimator to 'rate', a block at a time.
+ */
+static void decimate(uint32_t rate, double frequency) {
+    static AudioDecimator decimator;
+    uint32_t blocks = TEST_SECONDS * DECIMATOR_INPUT_RATE / AUDIO_BLOCK_SAMPLES;
+
+    TEST_ASSERT_TRUE(decimator.begin(rate));
+    output.clear();
+    AudioStream::transmit_hook = keep_output;
+    for (uint32_t n = 0; n < blocks; n++) {
+        audio_block_t *block = AudioStream::allocate();
+        for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+            uint32_t t = n * AUDIO_BLOCK_SAMPLES + i;
+            block->data[i] = (int16_t)lround(AMPLITUDE * sin(2.0 * M_PI * frequency * t / DECIMATOR_INPUT_RATE));
+        }
+        decimator.input = block;
+        decimator.update();
+    }
+    AudioStream::transmit_hook = NULL;
+    TEST_ASSERT_EQUAL_UINT32(0, decimator.overruns());
+
+    // Every output sample up to the last full block, ceil(inputs x L / M) of them
+    uint32_t up = AudioDecimator::phases_for(rate);
+    uint32_t down = DECIMATOR_INPUT_RATE / (rate / up);
+    uint64_t expected = ((uint64_t)blocks * AUDIO_BLOCK_SAMPLES * up + down - 1) / down;
+    TEST_ASSERT_EQUAL_UINT32(expected / AUDIO_BLOCK_SAMPLES * AUDIO_BLOCK_SAMPLES, output.size());
+}
+
+/**
+ * @brief Compare the output with the exact tone of 'frequency' Hz at 'rate', giving the gain (the part of the output
+ * that is the tone), the SNR in dB and the largest difference from the tone at that gain.
+ */
+static void measure(uint32_t rate, double frequency, double *gain, double *snr, double *max_error) {
+    uint32_t up = AudioDecimator::phases_for(rate);
+    uint32_t down = DECIMATOR_INPUT_RATE / (rate / up);
+    double delay = (up * DECIMATOR_TAPS - 1) / 2.0;
+    std::vector<double> reference(output.size());
+    double reference_energy = 0.0;
+    double projection = 0.0;
+
+    for (size_t n = EDGE_SAMPLES; n < output.size(); n++) {
+        double t = ((double)n * down - delay) / up; // In input samples
+        reference[n] = AMPLITUDE * sin(2.0 * M_PI * frequency * t / DECIMATOR_INPUT_RATE);
+        reference_energy += reference[n] * reference[n];
+        projection += output[n] * reference[n];
+    }
+    *gain = projection / reference_energy;
+
+    double error_energy = 0.0;
+    *max_error = 0.0;
+    for (size_t n = EDGE_SAMPLES; n < output.size(); n++) {
+        double error = output[n] - *gain * reference[n];
+        error_energy += error * error;
+        *max_error = fmax(*max_error, fabs(error));
+    }
+    *snr = 10.0 * log10(*gain * *gain * reference_energy / error_energy);
+}
+
+/**
+ * @brief Level of whatever comes out for a tone of 'frequency' Hz, in dB relative to the tone going in.
+ */
+static double level(uint32_t rate, double frequency) {
+    double energy = 0.0;
+
+    decimate(rate, frequency);
+    for (size_t n = EDGE_SAMPLES; n < output.size(); n++) {
+        energy += (double)output[n] * output[n];
+    }
+    return 10.0 * log10(energy / (output.size() - EDGE_SAMPLES) / (AMPLITUDE * AMPLITUDE / 2));
+}
+
+void test_passband(void) {
+    static const uint32_t rates[] = {16000, 22050};
+    // Telephone speech band and on to half the 16kHz band, flat to within 0.1dB
+    static const double frequencies[] = {300.0, 1000.0, 2000.0, 3400.0, 4000.0};
+
+    for (uint32_t rate : rates) {
+        printf("44100 to %lu:", (unsigned long)rate);
+        for (double frequency : frequencies) {
+            double gain, snr, max_error;
+
+            decimate(rate, frequency);
+            measure(rate, frequency, &gain, &snr, &max_error);
+            printf(" %.0fHz %+.3fdB SNR %.1fdB max error %.1f,", frequency, 20.0 * log10(gain), snr, max_error);
+            TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, 20.0 * log10(gain));
+            TEST_ASSERT_GREATER_THAN(60.0, snr);
+        }
+        printf("\n");
+    }
+}
+
+void test_stopband(void) {
+    // Above the output's Nyquist frequency, anything that came through would alias back in to the recording
+    static const double frequencies[] = {10000.0, 12000.0, 15000.0, 20000.0};
+
+    printf("44100 to 16000, aliased:");
+    for (double frequency : frequencies) {
+        double db = level(16000, frequency);
+        printf(" %.0fHz %.1fdB", frequency, db);
+        TEST_ASSERT_LESS_THAN(-50.0, db);
+    }
+    printf("\n");
+}
+
+void test_phase_continuous_across_blocks(void) {
+    // Every output sample, through each of the block boundaries and all 160 phases, within a few LSB of the tone
+    double gain, snr, max_error;
+
+    decimate(16000, 1234.5);
+    measure(16000, 1234.5, &gain, &snr, &max_error);
+    printf("44100 to 16000, 1234.5Hz: %lu samples, max error %.1f\n", (unsigned long)output.size(), max_error);
+    TEST_ASSERT_LESS_THAN(AMPLITUDE / 1000.0, max_error);
+}
+
+void test_same_rate_passes_straight_through(void) {
+    decimate(DECIMATOR_INPUT_RATE, 1000.0);
+    for (size_t n = 0; n < output.size(); n++) {
+        TEST_ASSERT_EQUAL_INT16((int16_t)lround(AMPLITUDE * sin(2.0 * M_PI * 1000.0 * n / DECIMATOR_INPUT_RATE)),
+                                output[n]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_passband);
+    RUN_TEST(test_stopband);
+    RUN_TEST(test_phase_continuous_across_blocks);
+    RUN_TEST(test_same_rate_passes_straight_through);
+    return UNITY_END();
+}
@@ -0,0 +1,357 @@
+/**
+ * FLAC encoder: every kind of frame it writes decodes bit-exact (with a decoder written from the FLAC format spec,
+ * checking both CRCs), STREAMINFO describes the stream, and the recorder's checkpoints only count frames that are in
+ * the file.
+ */
+#include "flac_encoder.h"
+#include "recorder.h"
+#include <math.h>
+#include <unity.h>
+#include <vector>
+
+#define TEST_FRAMES 400
+#define TEST_SAMPLES (TEST_FRAMES * FLAC_BLOCK_SAMPLES)
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t bit;
+} bit_reader_t;
+
+static int16_t input[TEST_SAMPLES];
+static int16_t output[TEST_SAMPLES];
+static flac_encoder_t encoder;
+static AudioRecordRing ring;
+
+void setUp(void) {}
+void tearDown(void) { sd_write_hook = NULL; }
+
+/**
+ * @brief Next 'bits' bits (up to 32) MSB first, asserting they are there.
+ */
+static uint32_t get_bits(bit_reader_t *reader, uint32_t bits) {
+    uint32_t value = 0;
+    TEST_ASSERT_TRUE(reader->bit + bits <= reader->size * 8);
+    for (uint32_t i = 0; i < bits; i++, reader->bit++) {
+        value = (value << 1) | ((reader->data[reader->bit / 8] >> (7 - reader->bit % 8)) & 1);
+    }
+    return value;
+}
+
+static int32_t get_signed(bit_reader_t *reader, uint32_t bits) {
+    uint32_t value = get_bits(reader, bits);
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+static uint8_t crc8(const uint8_t *data, size_t length) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t *data, size_t length) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Decode the frame at byte 'pos' of 'data', which must be frame 'number', in to 'pcm'.
+ *
+ * @return Offset just past the frame.
+ */
+static size_t decode_frame(const uint8_t *data, size_t size, size_t pos, uint32_t number, int16_t *pcm) {
+    bit_reader_t reader = {data, size, pos * 8};
+    int32_t samples[FLAC_BLOCK_SAMPLES];
+
+    TEST_ASSERT_EQUAL_UINT32(0x3ffe, get_bits(&reader, 14));         // Sync
+    TEST_ASSERT_EQUAL_UINT32(0, get_bits(&reader, 2));               // Reserved, fixed block size
+    TEST_ASSERT_EQUAL_UINT32(0x08, get_bits(&reader, 4));            // 256 samples
+    TEST_ASSERT_EQUAL_UINT32(0x05, get_bits(&reader, 4));            // 16kHz
+    TEST_ASSERT_EQUAL_UINT32(0x00, get_bits(&reader, 4));            // Mono
+    TEST_ASSERT_EQUAL_UINT32(0x04, get_bits(&reader, 3));            // 16 bits
+    TEST_ASSERT_EQUAL_UINT32(0, get_bits(&reader, 1));
+    uint32_t value = get_bits(&reader, 8);
+    uint32_t extra = 0;
+    while (value & (0x80 >> extra)) {
+        extra++;
+    }
+    if (extra > 0) {
+        value &= 0x7f >> extra;
+        for (uint32_t i = 1; i < extra; i++) {
+            value = (value << 6) | (get_bits(&reader, 8) & 0x3f);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(number, value);
+    size_t header_end = reader.bit / 8;
+    TEST_ASSERT_EQUAL_UINT8(crc8(data + pos, header_end - pos), get_bits(&reader, 8));
+
+    TEST_ASSERT_EQUAL_UINT32(0, get_bits(&reader, 1));
+    uint32_t type = get_bits(&reader, 6);
+    TEST_ASSERT_EQUAL_UINT32(0, get_bits(&reader, 1)); // No wasted bits
+    if (type == 0x00) {
+        int32_t constant = get_signed(&reader, 16);
+        for (int i = 0; i < FLAC_BLOCK_SAMPLES; i++) {
+            samples[i] = constant;
+        }
+    } else if (type == 0x01) {
+        for (int i = 0; i < FLAC_BLOCK_SAMPLES; i++) {
+            samples[i] = get_signed(&reader, 16);
+        }
+    } else {
+        TEST_ASSERT_TRUE(type >= 0x08 && type <= 0x08 + FLAC_MAX_FIXED_ORDER);
+        uint32_t order = type - 0x08;
+        for (uint32_t i = 0; i < order; i++) {
+            samples[i] = get_signed(&reader, 16);
+        }
+        TEST_ASSERT_EQUAL_UINT32(0, get_bits(&reader, 2)); // 4 bit Rice parameters
+        uint32_t partition_order = get_bits(&reader, 4);
+        TEST_ASSERT_LESS_OR_EQUAL(FLAC_MAX_PARTITION_ORDER, partition_order);
+        uint32_t i = order;
+        for (uint32_t partition = 0; partition < (1u << partition_order); partition++) {
+            uint32_t parameter = get_bits(&reader, 4);
+            TEST_ASSERT_TRUE(parameter < 15); // The encoder never escapes
+            for (uint32_t end = (partition + 1) * (FLAC_BLOCK_SAMPLES >> partition_order); i < end; i++) {
+                uint32_t quotient = 0;
+                while (get_bits(&reader, 1) == 0) {
+                    quotient++;
+                }
+                uint32_t folded = (quotient << parameter) | get_bits(&reader, parameter);
+                int32_t residual = (folded >> 1) ^ -(int32_t)(folded & 1);
+                switch (order) {
+                case 0:
+                    samples[i] = residual;
+                    break;
+                case 1:
+                    samples[i] = residual + samples[i - 1];
+                    break;
+                case 2:
+                    samples[i] = residual + 2 * samples[i - 1] - samples[i - 2];
+                    break;
+                case 3:
+                    samples[i] = residual + 3 * samples[i - 1] - 3 * samples[i - 2] + samples[i - 3];
+                    break;
+                default:
+                    samples[i] =
+                        residual + 4 * samples[i - 1] - 6 * samples[i - 2] + 4 * samples[i - 3] - samples[i - 4];
+                    break;
+                }
+            }
+        }
+    }
+
+    reader.bit = (reader.bit + 7) & ~7UL;
+    size_t footer = reader.bit / 8;
+    TEST_ASSERT_EQUAL_UINT16(crc16(data + pos, footer - pos), get_bits(&reader, 16));
+
+    for (int i = 0; i < FLAC_BLOCK_SAMPLES; i++) {
+        TEST_ASSERT_TRUE(samples[i] >= -32768 && samples[i] <= 32767);
+        pcm[i] = samples[i];
+    }
+    return footer + 2;
+}
+
+/**
+ * @brief Encode 'input' an audio block at a time, as the recorder does, and decode it all back.
+ *
+ * @return Bytes in the stream.
+ */
+static size_t round_trip(void) {
+    static std::vector<uint8_t> stream;
+    static uint8_t frame[FLAC_MAX_FRAME_BYTES];
+    uint8_t header[FLAC_HEADER_BYTES];
+
+    flac_init(&encoder, 16000);
+    stream.assign(FLAC_HEADER_BYTES, 0);
+    for (uint32_t n = 0; n < TEST_FRAMES; n++) {
+        size_t bytes = flac_encode(&encoder, input + n * FLAC_BLOCK_SAMPLES, FLAC_BLOCK_SAMPLES, frame);
+        TEST_ASSERT_LESS_OR_EQUAL(FLAC_MAX_FRAME_BYTES, bytes);
+        stream.insert(stream.end(), frame, frame + bytes);
+    }
+    flac_build_header(&encoder, header, "test");
+    memcpy(stream.data(), header, sizeof header);
+
+    // Metadata: STREAMINFO, the comment, then PADDING (last) up to the frames
+    TEST_ASSERT_EQUAL_MEMORY("fLaC", stream.data(), 4);
+    const uint8_t *info = stream.data() + 8;
+    TEST_ASSERT_EQUAL_UINT8(0x00, stream[4]);
+    TEST_ASSERT_EQUAL_UINT32(FLAC_BLOCK_SAMPLES, (info[0] << 8) | info[1]);
+    TEST_ASSERT_EQUAL_UINT32(encoder.min_frame_bytes, (info[4] << 16) | (info[5] << 8) | info[6]);
+    TEST_ASSERT_EQUAL_UINT32(encoder.max_frame_bytes, (info[7] << 16) | (info[8] << 8) | info[9]);
+    TEST_ASSERT_EQUAL_UINT32(16000, (info[10] << 12) | (info[11] << 4) | (info[12] >> 4));
+    TEST_ASSERT_EQUAL_UINT32(0, (info[12] >> 1) & 7); // Channels - 1
+    TEST_ASSERT_EQUAL_UINT32(15, ((info[12] & 1) << 4) | (info[13] >> 4));
+    TEST_ASSERT_EQUAL_UINT32(TEST_SAMPLES, ((uint32_t)info[14] << 24) | (info[15] << 16) | (info[16] << 8) | info[17]);
+    size_t pos = 4;
+    bool last = false;
+    while (!last) {
+        last = stream[pos] & 0x80;
+        pos += 4 + ((stream[pos + 1] << 16) | (stream[pos + 2] << 8) | stream[pos + 3]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(FLAC_HEADER_BYTES, pos);
+
+    for (uint32_t n = 0; n < TEST_FRAMES; n++) {
+        pos = decode_frame(stream.data(), stream.size(), pos, n, output + n * FLAC_BLOCK_SAMPLES);
+    }
+    TEST_ASSERT_EQUAL_UINT32(stream.size(), pos);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(input, output, TEST_SAMPLES);
+    return stream.size();
+}
+
+void test_speech_like(void) {
+    srand(1);
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        double t = i / 16000.0;
+        double pitch = 120 + 30 * sin(2 * M_PI * 3 * t);
+        double value = 0;
+        for (int h = 1; h <= 8; h++) {
+            value += sin(2 * M_PI * pitch * h * t) / h;
+        }
+        input[i] = (int16_t)(9000 * (0.5 + 0.5 * sin(2 * M_PI * 4 * t)) * value + (rand() % 64) - 32);
+    }
+    size_t bytes = round_trip();
+    printf("speech-like %.2f:1\n", (double)TEST_SAMPLES * 2 / (bytes - FLAC_HEADER_BYTES));
+}
+
+void test_silence_and_dc(void) {
+    // Constant subframes
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        input[i] = (i < TEST_SAMPLES / 2) ? 0 : -1234;
+    }
+    round_trip();
+}
+
+void test_white_noise(void) {
+    // Incompressible, verbatim subframes
+    srand(2);
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        input[i] = (int16_t)(rand() & 0xffff);
+    }
+    round_trip();
+}
+
+void test_full_scale_edges(void) {
+    // Largest residuals the fixed predictors can produce, a frame of each extreme and steps between them
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        uint32_t frame = i / FLAC_BLOCK_SAMPLES;
+        switch (frame % 4) {
+        case 0:
+            input[i] = (i & 1) ? 32767 : -32768;
+            break;
+        case 1:
+            input[i] = ((i / 3) & 1) ? 32767 : -32768;
+            break;
+        case 2:
+            input[i] = (int16_t)(i * 97);
+            break;
+        default:
+            input[i] = (i % FLAC_BLOCK_SAMPLES < 5) ? -32768 : 0;
+            break;
+        }
+    }
+    round_trip();
+}
+
+void test_low_level_noise(void) {
+    // Small residuals, low Rice parameters and higher partition orders
+    srand(3);
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        input[i] = (int16_t)((rand() % 7) - 3 + ((i / 2000) & 1) * 40 * sin(i * 0.01));
+    }
+    round_trip();
+}
+
+// As main.cpp does for RECORDER_FORMAT_FLAC
+static flac_encoder_t recorder_encoder;
+static void test_reset(void) { flac_init(&recorder_encoder, RECORDER_SAMPLE_RATE); }
+static size_t test_encode(const int16_t *pcm, uint32_t samples, uint8_t *out) {
+    return flac_encode(&recorder_encoder, pcm, samples, out);
+}
+static size_t test_flush(uint8_t *out) {
+    (void)out;
+    return 0;
+}
+static void test_header(uint8_t *sector, uint32_t data_bytes, const char *comment) {
+    (void)data_bytes;
+    flac_encoder_t saved = recorder_encoder;
+    saved.total_samples = recorder_samples_saved();
+    flac_build_header(&saved, sector, comment);
+}
+static void test_trim(uint32_t samples) { recorder_encoder.total_samples = samples; }
+static const recorder_format_t test_format = {FLAC_HEADER_BYTES, RECORDER_SAMPLE_RATE,
+                                              FLAC_MAX_FRAME_BYTES * RECORDER_SAMPLE_RATE / FLAC_BLOCK_SAMPLES,
+                                              FLAC_BLOCK_SAMPLES, "flac", test_header, test_reset, test_encode,
+                                              test_flush, test_trim};
+static uint32_t checkpoints;
+static uint32_t frames_held_back;
+
+/**
+ * @brief Before each write, check the STREAMINFO of the last checkpoint only counts frames that are in the file.
+ */
+static void check_checkpoint(FsFile *file, uint64_t position, size_t length) {
+    (void)length;
+    const uint8_t *data = file->data.data();
+    if (position == 0 || file->data.size() <= FLAC_HEADER_BYTES) {
+        return;
+    }
+    const uint8_t *info = data + 8;
+    uint32_t frames = (((uint32_t)info[14] << 24) | (info[15] << 16) | (info[16] << 8) | info[17]) / FLAC_BLOCK_SAMPLES;
+    if (frames == 0) {
+        return;
+    }
+
+    static int16_t pcm[FLAC_BLOCK_SAMPLES];
+    size_t pos = FLAC_HEADER_BYTES;
+    for (uint32_t n = 0; n < frames; n++) {
+        pos = decode_frame(data, file->data.size(), pos, n, pcm);
+    }
+    checkpoints++;
+    frames_held_back += recorder_encoder.frame_number - frames;
+}
+
+void test_checkpoints_count_frames_in_file(void) {
+    static FsFile file;
+    file = FsFile();
+    sd_write_hook = check_checkpoint;
+    checkpoints = 0;
+    frames_held_back = 0;
+    recorder_set_checkpoint_interval(1);
+
+    recorder_begin(&file, &test_format);
+    srand(4);
+    for (uint32_t n = 0; n < 10 * RECORDER_SAMPLE_RATE / AUDIO_BLOCK_SAMPLES; n++) {
+        audio_block_t *block = AudioStream::allocate();
+        for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+            block->data[i] = (int16_t)(3000 * sin((n * AUDIO_BLOCK_SAMPLES + i) * 0.07) + (rand() % 50));
+        }
+        ring.input = block;
+        ring.update();
+    }
+    recorder_end();
+
+    TEST_ASSERT_GREATER_THAN(3, checkpoints);
+    TEST_ASSERT_GREATER_THAN(0, frames_held_back); // Some checkpoints came with frames still waiting
+    TEST_ASSERT_EQUAL_UINT32(recorder_encoder.total_samples, recorder_samples_saved());
+}
+
+int main(int argc, char **argv) {
+    recorder_init(&ring);
+    UNITY_BEGIN();
+    RUN_TEST(test_speech_like);
+    RUN_TEST(test_silence_and_dc);
+    RUN_TEST(test_white_noise);
+    RUN_TEST(test_full_scale_edges);
+    RUN_TEST(test_low_level_noise);
+    RUN_TEST(test_checkpoints_count_frames_in_file);
+    return UNITY_END();
+}
@@ -0,0 +1,169 @@
+/**
+ * IMA ADPCM encoder: the blocks it writes decode (with a decoder written from the Microsoft/IMA spec, as players
+ * have) back to the input within the format's error, and how long an audio block takes to encode.
+ */
+#include "ima_adpcm.h"
+#include <chrono>
+#include <math.h>
+#include <string.h>
+#include <unity.h>
+
+#define TEST_SAMPLES (IMA_ADPCM_SAMPLES_PER_BLOCK * 20 + 500) // Ends with a short block
+#define BENCHMARK_BLOCKS 20000
+#define AUDIO_BLOCK 256
+
+static const int16_t step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,
+    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,   337,   371,   408,   449,   494,
+    544,   598,   658,   724,   796,   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,
+    9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+static const int8_t index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static int16_t input[TEST_SAMPLES];
+static int16_t output[TEST_SAMPLES + 1]; // The short last block can end with a padding nibble
+static uint8_t encoded[(TEST_SAMPLES / IMA_ADPCM_SAMPLES_PER_BLOCK + 1) * IMA_ADPCM_BLOCK_BYTES];
+static ima_adpcm_encoder_t encoder;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * @brief Decode one block of 'bytes' bytes (a short one if the last) in to 'pcm'.
+ *
+ * @return Number of samples decoded.
+ */
+static uint32_t decode_block(const uint8_t *block, uint32_t bytes, int16_t *pcm) {
+    int32_t predictor = (int16_t)(block[0] | (block[1] << 8));
+    int32_t index = block[2];
+    uint32_t samples = 1;
+
+    TEST_ASSERT_TRUE(index <= 88);
+    TEST_ASSERT_EQUAL_UINT8(0, block[3]);
+    pcm[0] = predictor;
+    for (uint32_t i = 4; i < bytes; i++) {
+        for (int shift = 0; shift <= 4; shift += 4) {
+            uint8_t code = (block[i] >> shift) & 0x0f;
+            int32_t step = step_table[index];
+            int32_t delta = step >> 3;
+            if (code & 4) {
+                delta += step;
+            }
+            if (code & 2) {
+                delta += step >> 1;
+            }
+            if (code & 1) {
+                delta += step >> 2;
+            }
+            predictor += (code & 8) ? -delta : delta;
+            predictor = (predictor > 32767) ? 32767 : (predictor < -32768) ? -32768 : predictor;
+            index += index_table[code];
+            index = (index < 0) ? 0 : (index > 88) ? 88 : index;
+            pcm[samples++] = predictor;
+        }
+    }
+    return samples;
+}
+
+/**
+ * @brief Encode all of 'input' an audio block at a time, as the recorder does, then decode it again.
+ *
+ * @return Samples decoded.
+ */
+static uint32_t round_trip(uint32_t samples) {
+    size_t bytes = 0;
+    uint32_t decoded = 0;
+
+    ima_adpcm_init(&encoder);
+    for (uint32_t i = 0; i < samples; i += AUDIO_BLOCK) {
+        uint32_t n = (samples - i < AUDIO_BLOCK) ? samples - i : AUDIO_BLOCK;
+        bytes += ima_adpcm_encode(&encoder, input + i, n, encoded + bytes);
+        TEST_ASSERT_EQUAL_UINT32(0, bytes % IMA_ADPCM_BLOCK_BYTES);
+    }
+    bytes += ima_adpcm_flush(&encoder, encoded + bytes);
+
+    for (size_t pos = 0; pos < bytes; pos += IMA_ADPCM_BLOCK_BYTES) {
+        uint32_t block_bytes = (bytes - pos < IMA_ADPCM_BLOCK_BYTES) ? bytes - pos : IMA_ADPCM_BLOCK_BYTES;
+        decoded += decode_block(encoded + pos, block_bytes, output + decoded);
+    }
+    return decoded;
+}
+
+/**
+ * @brief Signal to noise ratio of the decoded output, in dB.
+ */
+static double snr_db(uint32_t samples) {
+    double signal = 0;
+    double noise = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        signal += (double)input[i] * input[i];
+        noise += (double)(output[i] - input[i]) * (output[i] - input[i]);
+    }
+    return 10 * log10(signal / (noise > 0 ? noise : 1));
+}
+
+void test_speech_like_round_trip(void) {
+    // Harmonics of a wandering pitch with a syllable envelope, plus a little noise
+    srand(1);
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        double t = i / 16000.0;
+        double pitch = 120 + 30 * sin(2 * M_PI * 3 * t);
+        double envelope = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+        double value = 0;
+        for (int h = 1; h <= 8; h++) {
+            value += sin(2 * M_PI * pitch * h * t) / h;
+        }
+        input[i] = (int16_t)(9000 * envelope * value + (rand() % 400) - 200);
+    }
+
+    uint32_t decoded = round_trip(TEST_SAMPLES);
+    // The short last block holds the odd sample out plus a padding nibble
+    TEST_ASSERT_GREATER_OR_EQUAL(TEST_SAMPLES, decoded);
+    TEST_ASSERT_LESS_OR_EQUAL(TEST_SAMPLES + 1, decoded);
+    TEST_ASSERT_EQUAL_INT16(encoder.predictor, output[TEST_SAMPLES - 1]); // Encoder tracks the decoder exactly
+    for (uint32_t i = 0; i < TEST_SAMPLES; i += IMA_ADPCM_SAMPLES_PER_BLOCK) {
+        TEST_ASSERT_EQUAL_INT16(input[i], output[i]); // Each block starts with its first sample as is
+    }
+    double snr = snr_db(TEST_SAMPLES);
+    printf("speech-like SNR %.1fdB\n", snr);
+    TEST_ASSERT_GREATER_THAN(20.0, snr); // IMA ADPCM is typically 20-25dB on speech
+}
+
+void test_full_scale_and_silence(void) {
+    // Clipping square wave then silence, the predictor must saturate and the step index come back down
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        input[i] = (i < TEST_SAMPLES / 2) ? (((i / 40) & 1) ? 32767 : -32768) : 0;
+    }
+    round_trip(TEST_SAMPLES);
+    int32_t worst = 0;
+    for (uint32_t i = TEST_SAMPLES - 1000; i < TEST_SAMPLES; i++) {
+        worst = (abs(output[i]) > worst) ? abs(output[i]) : worst;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(8, worst);
+}
+
+void test_encode_benchmark(void) {
+    static int16_t block[AUDIO_BLOCK];
+    static uint8_t out[IMA_ADPCM_BLOCK_BYTES * 2];
+    for (int i = 0; i < AUDIO_BLOCK; i++) {
+        block[i] = (int16_t)(8000 * sin(i * 0.1));
+    }
+
+    ima_adpcm_init(&encoder);
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < BENCHMARK_BLOCKS; n++) {
+        ima_adpcm_encode(&encoder, block, AUDIO_BLOCK, out);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    // On the Teensy the recorder keeps the same figure in CPU cycles (encode cycles/block in the recording's stats)
+    printf("encode %.0fns per %d sample audio block (host)\n", ns / BENCHMARK_BLOCKS, AUDIO_BLOCK);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_speech_like_round_trip);
+    RUN_TEST(test_full_scale_and_silence);
+    RUN_TEST(test_encode_benchmark);
+    return UNITY_END();
+}
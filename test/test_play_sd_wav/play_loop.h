@@ -0,0 +1,54 @@
+/**
+ * Plays a file through either build of the player the way main.cpp does, fill() from loop() between each audio
+ * update, and keeps what it transmits.
+ */
+#ifndef PLAY_LOOP_H
+#define PLAY_LOOP_H
+
+#include <AudioStream.h>
+#include <vector>
+
+// Longest anything played can be, room for it is made before playing so update() isn't timed growing 'played'
+#define PLAYED_MAX_SAMPLES (10 * 44100)
+
+// Blocks transmitted on each channel, in order
+inline std::vector<int16_t> played[2];
+
+// update() is running
+inline bool updating = false;
+
+inline void keep_played(const audio_block_t *block, unsigned char index) {
+    played[index].insert(played[index].end(), block->data, block->data + AUDIO_BLOCK_SAMPLES);
+}
+
+/**
+ * @brief Play 'name' to the end with 'player', and whatever 'queue_more' (if not NULL) queues after it once it has
+ * started, false if it couldn't be started.
+ */
+template <class Player> bool play_to_end(Player *player, const char *name, void (*queue_more)(Player *) = NULL) {
+    for (int channel = 0; channel < 2; channel++) {
+        played[channel].assign(PLAYED_MAX_SAMPLES, 0);
+        played[channel].clear();
+    }
+    AudioStream::transmit_hook = keep_played;
+    player->resetStats();
+
+    if (!player->play(name)) {
+        return false;
+    }
+    if (queue_more != NULL) {
+        queue_more(player);
+    }
+    while (!player->isStopped()) {
+        player->fill();
+        updating = true;
+        player->update();
+        updating = false;
+    }
+    player->fill(); // Closes the file
+
+    AudioStream::transmit_hook = NULL;
+    return true;
+}
+
+#endif /* PLAY_LOOP_H */
@@ -0,0 +1,20 @@
+/**
+ * The player built to read the file from update() as the Audio library's player does (PLAY_SD_WAV_READ_AHEAD false),
+ * under its own name so it can be timed alongside the read ahead one.
+ */
+#define PLAY_SD_WAV_READ_AHEAD false
+#define AudioPlaySdWavX AudioPlaySdWavReadInUpdate
+#include "../../src/play_sd_wav.cpp"
+#include "play_loop.h"
+
+static AudioPlaySdWavReadInUpdate player;
+
+/**
+ * @brief Play 'name' with the file read in update(), see play_to_end().
+ */
+bool play_reading_in_update(const char *name, uint32_t *max_update_cycles, uint32_t *avg_update_cycles) {
+    bool ok = play_to_end(&player, name);
+    *max_update_cycles = player.maxUpdateCycles();
+    *avg_update_cycles = player.avgUpdateCycles();
+    return ok;
+}
@@ -0,0 +1,257 @@
+/**
+ * AudioPlaySdWavX on the host, with the file read ahead from loop() and with it read in update() as the Audio
+ * library's player does, on a model of the card where most 512 byte reads take their transfer time and every so often
+ * one stalls.  What is checked is where the reads happen (none in update() when reading ahead) and that every sample
+ * is played.  The update() times printed depend on the host and are illustrative only, the real figures come from
+ * maxUpdateCycles() and maxReadMicros() on the Teensy.
+ */
+#include "play_loop.h"
+#include "play_sd_wav.h"
+#include <unity.h>
+
+#define PROMPT_SECONDS 2
+#define READ_US 30       // 512 bytes at ~20MB/s
+#define STALL_US 8000    // A read the card takes its time over, every STALL_READS reads
+#define STALL_READS 32
+
+bool play_reading_in_update(const char *name, uint32_t *max_update_cycles, uint32_t *avg_update_cycles);
+
+static AudioPlaySdWavX player;
+static uint32_t reads;
+static uint32_t reads_in_update;
+
+void setUp(void) {}
+void tearDown(void) { sd_read_hook = NULL; }
+
+/**
+ * @brief The card model, runs before each read.
+ */
+static void card_model(File *file, uint64_t position, size_t length) {
+    (void)file;
+    (void)position;
+    (void)length;
+    if (updating) {
+        reads_in_update++;
+    }
+    // Sleep rather than spin, so the host doesn't take the CPU away part way through the next update()
+    delayMicroseconds((++reads % STALL_READS == 0) ? STALL_US : READ_US);
+}
+
+/**
+ * @brief Put a PCM .wav file called 'name' on the card with 'samples' (interleaved if stereo), after an unknown chunk
+ * of 'extra_bytes' (if any) with no pad byte, so an odd size starts the data at an odd offset.
+ */
+static void write_wav(const char *name, uint32_t rate, uint16_t channels, uint16_t bits,
+                      const std::vector<int16_t> &samples, uint32_t extra_bytes = 0) {
+    std::vector<uint8_t> &file = sd_files[name];
+    uint32_t data_bytes = samples.size() * bits / 8;
+    uint16_t block_align = channels * bits / 8;
+    uint32_t extra = (extra_bytes > 0) ? 8 + extra_bytes : 0;
+    uint32_t fields[] = {0x46464952, 36 + extra + data_bytes, 0x45564157, 0x20746D66, 16,
+                         (uint32_t)(channels << 16) | 1, rate, rate * block_align,
+                         (uint32_t)(bits << 16) | block_align};
+    uint32_t chunk[] = {0x61727478, extra_bytes}; // "xtra"
+    uint32_t data[] = {0x61746164, data_bytes};
+
+    file.assign((uint8_t *)fields, (uint8_t *)fields + sizeof fields);
+    if (extra_bytes > 0) {
+        file.insert(file.end(), (uint8_t *)chunk, (uint8_t *)chunk + sizeof chunk);
+        file.insert(file.end(), extra_bytes, 0xA5);
+    }
+    file.insert(file.end(), (uint8_t *)data, (uint8_t *)data + sizeof data);
+    for (int16_t sample : samples) {
+        if (bits == 8) {
+            file.push_back((uint8_t)((sample >> 8) + 128));
+        } else {
+            file.push_back(sample & 0xFF);
+            file.push_back(sample >> 8);
+        }
+    }
+}
+
+/**
+ * @brief The prompt, a sweep so every sample is different.
+ */
+static std::vector<int16_t> prompt(void) {
+    std::vector<int16_t> samples(PROMPT_SECONDS * 44100);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t)(12000 * sin(i * (0.01 + i * 2e-7)));
+    }
+    return samples;
+}
+
+/**
+ * @brief Check the whole of 'samples' was played on both channels, then silence to the end of the last block.
+ */
+static void check_played(const std::vector<int16_t> &samples) {
+    size_t blocks = (samples.size() + AUDIO_BLOCK_SAMPLES - 1) / AUDIO_BLOCK_SAMPLES;
+    for (int channel = 0; channel < 2; channel++) {
+        TEST_ASSERT_EQUAL_UINT32(blocks * AUDIO_BLOCK_SAMPLES, played[channel].size());
+        TEST_ASSERT_EQUAL_INT16_ARRAY(samples.data(), played[channel].data(), samples.size());
+        for (size_t i = samples.size(); i < played[channel].size(); i++) {
+            TEST_ASSERT_EQUAL_INT16(0, played[channel][i]);
+        }
+    }
+}
+
+void test_read_ahead_keeps_reads_out_of_update(void) {
+    std::vector<int16_t> samples = prompt();
+    write_wav("prompt.wav", 44100, 1, 16, samples);
+    reads = 0;
+    reads_in_update = 0;
+    sd_read_hook = card_model;
+
+    TEST_ASSERT_TRUE(play_to_end(&player, "prompt.wav"));
+    printf("read ahead (illustrative): update() max %lu avg %lu cycles, slowest read %lu us, %lu underruns\n",
+           (unsigned long)player.maxUpdateCycles(), (unsigned long)player.avgUpdateCycles(),
+           (unsigned long)player.maxReadMicros(), (unsigned long)player.underruns());
+
+    check_played(samples);
+    TEST_ASSERT_EQUAL_UINT32(0, reads_in_update);
+    TEST_ASSERT_EQUAL_UINT32(0, player.underruns());
+}
+
+void test_read_in_update_waits_for_the_card(void) {
+    std::vector<int16_t> samples = prompt();
+    uint32_t max_cycles, avg_cycles;
+    write_wav("prompt.wav", 44100, 1, 16, samples);
+    reads = 0;
+    reads_in_update = 0;
+    sd_read_hook = card_model;
+
+    TEST_ASSERT_TRUE(play_reading_in_update("prompt.wav", &max_cycles, &avg_cycles));
+    printf("read in update (illustrative): update() max %lu avg %lu cycles\n", (unsigned long)max_cycles,
+           (unsigned long)avg_cycles);
+
+    check_played(samples);
+    TEST_ASSERT_EQUAL_UINT32(reads, reads_in_update + 1); // All but the first, read by play()
+}
+
+void test_stereo_end_is_silent(void) {
+    // Left and right different, and a length that leaves the last block part full
+    std::vector<int16_t> samples(2 * 1000);
+    std::vector<int16_t> left(1000), right(1000);
+    for (size_t i = 0; i < left.size(); i++) {
+        left[i] = samples[2 * i] = (int16_t)(i * 31);
+        right[i] = samples[2 * i + 1] = (int16_t)(-1 - i * 17);
+    }
+    write_wav("stereo.wav", 44100, 2, 16, samples);
+
+    TEST_ASSERT_TRUE(play_to_end(&player, "stereo.wav"));
+    TEST_ASSERT_EQUAL_UINT32(4 * AUDIO_BLOCK_SAMPLES, played[0].size());
+    TEST_ASSERT_EQUAL_UINT32(4 * AUDIO_BLOCK_SAMPLES, played[1].size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(left.data(), played[0].data(), left.size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(right.data(), played[1].data(), right.size());
+    for (size_t i = left.size(); i < played[0].size(); i++) {
+        TEST_ASSERT_EQUAL_INT16(0, played[0][i]);
+        TEST_ASSERT_EQUAL_INT16(0, played[1][i]);
+    }
+}
+
+void test_odd_data_offset(void) {
+    // Every sample straddles a chunk boundary somewhere in 2 seconds, in both the mono and the stereo paths
+    std::vector<int16_t> samples = prompt();
+    write_wav("odd.wav", 44100, 1, 16, samples, 3);
+    TEST_ASSERT_TRUE(play_to_end(&player, "odd.wav"));
+    check_played(samples);
+
+    std::vector<int16_t> stereo(2 * samples.size());
+    std::vector<int16_t> left(samples.size()), right(samples.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+        left[i] = stereo[2 * i] = samples[i];
+        right[i] = stereo[2 * i + 1] = (int16_t)(-samples[i] / 2 + 1);
+    }
+    for (uint32_t extra_bytes : {1, 3, 5}) {
+        write_wav("odd.wav", 44100, 2, 16, stereo, extra_bytes);
+        TEST_ASSERT_TRUE(play_to_end(&player, "odd.wav"));
+        TEST_ASSERT_EQUAL_UINT32(played[0].size(), played[1].size());
+        TEST_ASSERT_GREATER_OR_EQUAL(left.size(), played[0].size());
+        TEST_ASSERT_EQUAL_INT16_ARRAY(left.data(), played[0].data(), left.size());
+        TEST_ASSERT_EQUAL_INT16_ARRAY(right.data(), played[1].data(), right.size());
+    }
+}
+
+// A memory clip, as the prompt cache would queue
+static std::vector<int16_t> clip(333);
+
+/**
+ * @brief Queue the rest of test_gapless_queue()'s items behind the first.
+ */
+static void queue_items(AudioPlaySdWavX *queue_player) {
+    TEST_ASSERT_TRUE(queue_player->queue("stereo.wav"));
+    TEST_ASSERT_TRUE(queue_player->queue("missing.wav"));
+    TEST_ASSERT_TRUE(queue_player->queue("22050.wav"));
+    TEST_ASSERT_TRUE(queue_player->queue(clip.data(), clip.size()));
+    TEST_ASSERT_EQUAL_UINT32(4, queue_player->queued());
+}
+
+void test_gapless_queue(void) {
+    // Lengths that never end on a block boundary, so every switch is part way through an audio block
+    std::vector<int16_t> mono(1000), stereo(2 * 777), slow(1500);
+    for (size_t i = 0; i < mono.size(); i++) {
+        mono[i] = (int16_t)(i * 31 + 1);
+    }
+    for (size_t i = 0; i < stereo.size(); i++) {
+        stereo[i] = (int16_t)((i & 1) ? -1 - (int)i * 13 : (int)i * 11);
+    }
+    for (size_t i = 0; i < slow.size(); i++) {
+        slow[i] = (int16_t)(8000 * sin(i * 0.05));
+    }
+    for (size_t i = 0; i < clip.size(); i++) {
+        clip[i] = (int16_t)(i * 97 - 16000);
+    }
+    write_wav("mono.wav", 44100, 1, 16, mono);
+    write_wav("stereo.wav", 44100, 2, 16, stereo);
+    write_wav("22050.wav", 22050, 1, 16, slow);
+    sd_files.erase("missing.wav");
+
+    // What each should come out as: mono on both sides, the missing file skipped, 22.05kHz through the player's
+    // resampler with its tail
+    std::vector<int16_t> left(mono), right(mono);
+    for (size_t i = 0; i < stereo.size(); i += 2) {
+        left.push_back(stereo[i]);
+        right.push_back(stereo[i + 1]);
+    }
+    resampler_t resampler;
+    resampler_design();
+    TEST_ASSERT_TRUE(resampler_init(&resampler, 22050, 44100, 1, RESAMPLER_DEFAULT_MODE));
+    for (size_t i = 0; i < slow.size() + resampler.delay; i++) {
+        while (resampler_ready(&resampler)) {
+            int16_t sample, unused;
+            resampler_output(&resampler, &sample, &unused);
+            left.push_back(sample);
+            right.push_back(sample);
+        }
+        resampler_push(&resampler, (i < slow.size()) ? slow[i] : 0, 0);
+    }
+    while (resampler_ready(&resampler)) {
+        int16_t sample, unused;
+        resampler_output(&resampler, &sample, &unused);
+        left.push_back(sample);
+        right.push_back(sample);
+    }
+    left.insert(left.end(), clip.begin(), clip.end());
+    right.insert(right.end(), clip.begin(), clip.end());
+
+    TEST_ASSERT_TRUE(play_to_end(&player, "mono.wav", queue_items));
+    TEST_ASSERT_EQUAL_UINT32(0, player.underruns());
+    size_t blocks = (left.size() + AUDIO_BLOCK_SAMPLES - 1) / AUDIO_BLOCK_SAMPLES;
+    TEST_ASSERT_EQUAL_UINT32(blocks * AUDIO_BLOCK_SAMPLES, played[0].size());
+    TEST_ASSERT_EQUAL_UINT32(blocks * AUDIO_BLOCK_SAMPLES, played[1].size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(left.data(), played[0].data(), left.size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(right.data(), played[1].data(), right.size());
+    for (size_t i = left.size(); i < played[0].size(); i++) {
+        TEST_ASSERT_EQUAL_INT16(0, played[0][i]);
+        TEST_ASSERT_EQUAL_INT16(0, played[1][i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_read_ahead_keeps_reads_out_of_update);
+    RUN_TEST(test_read_in_update_waits_for_the_card);
+    RUN_TEST(test_stereo_end_is_silent);
+    RUN_TEST(test_odd_data_offset);
+    RUN_TEST(test_gapless_queue);
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+/**
+ * Host stress test of the SPSC record ring: the producer (audio interrupt) and consumer (SD writer) run flat out on
+ * their own threads, every block is numbered and the consumer checks nothing arrives out of order, twice or torn, and
+ * that everything the producer made was either received or counted as dropped.
+ */
+#include "record_ring.h"
+#include <atomic>
+#include <thread>
+#include <unity.h>
+
+#define STRESS_BLOCKS 200000
+#define READ_BLOCKS 8
+
+static std::atomic<bool> producer_done;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * @brief Feed 'count' numbered blocks through update(), the whole block carries the number so tearing shows up.
+ */
+static void produce(AudioRecordRing *ring, uint32_t count) {
+    for (uint32_t n = 0; n < count; n++) {
+        audio_block_t *block = AudioStream::allocate();
+        for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+            block->data[i] = (int16_t)(n + i);
+        }
+        ring->input = block;
+        ring->update();
+        if ((n & 1023) == 0) {
+            std::this_thread::yield(); // Let the ring fill up now and then so overruns get exercised too
+        }
+    }
+    producer_done = true;
+}
+
+/**
+ * @brief Read blocks until the producer has finished and the ring is empty, checking every one.
+ *
+ * @return Number of blocks received.
+ */
+static uint32_t consume(AudioRecordRing *ring) {
+    static int16_t buffer[READ_BLOCKS][AUDIO_BLOCK_SAMPLES];
+    uint32_t received = 0;
+    int32_t last = -1;
+
+    for (;;) {
+        bool done = producer_done;
+        uint32_t waiting = ring->available();
+        if (waiting > 0) {
+            // Peeking must see the same block read() is about to hand over
+            int16_t first = ring->peek(0)[0];
+            uint32_t blocks = ring->read(buffer, READ_BLOCKS);
+            TEST_ASSERT_TRUE(blocks > 0);
+            TEST_ASSERT_EQUAL_INT16(first, buffer[0][0]);
+            for (uint32_t b = 0; b < blocks; b++) {
+                uint16_t n = (uint16_t)buffer[b][0];
+                for (int i = 1; i < AUDIO_BLOCK_SAMPLES; i++) {
+                    TEST_ASSERT_EQUAL_UINT16((uint16_t)(n + i), (uint16_t)buffer[b][i]);
+                }
+                // Blocks are only ever dropped (newest first), never reordered or repeated
+                TEST_ASSERT_TRUE(last < 0 || (uint16_t)(n - (uint16_t)last) > 0);
+                TEST_ASSERT_TRUE(last < 0 || (uint16_t)(n - (uint16_t)last) < 0x8000);
+                last = n;
+            }
+            received += blocks;
+        } else if (done) {
+            return received;
+        }
+    }
+}
+
+/**
+ * @brief Run the producer and consumer threads against each other.
+ */
+static void stress(AudioRecordRing *ring) {
+    ring->begin(NULL, 1);
+    producer_done = false;
+
+    std::thread producer(produce, ring, STRESS_BLOCKS);
+    uint32_t received = consume(ring);
+    producer.join();
+
+    TEST_ASSERT_EQUAL_UINT32(STRESS_BLOCKS, received + ring->overruns());
+    TEST_ASSERT_TRUE(ring->peak_depth() <= ring->capacity());
+    ring->end();
+    ring->clear();
+    TEST_ASSERT_EQUAL_INT(0, AudioStream::live_blocks.load());
+}
+
+void test_pointer_ring(void) {
+    static AudioRecordRing ring;
+    stress(&ring);
+}
+
+void test_elastic_ring(void) {
+    static AudioRecordRing ring;
+    TEST_ASSERT_EQUAL_UINT32(1024, ring.use_elastic(1024));
+    stress(&ring);
+}
+
+void test_elastic_ring_without_psram(void) {
+    static AudioRecordRing ring;
+    // Internal RAM is shared with the catalogue, container index and prompt cache, so the ring only takes its share
+    external_psram_size = 0;
+    TEST_ASSERT_EQUAL_UINT32(RECORD_RING_INTERNAL_BLOCKS, ring.use_elastic(2048));
+    external_psram_size = 8;
+    TEST_ASSERT_TRUE(ring.is_elastic());
+    stress(&ring);
+}
+
+void test_preroll_hold(void) {
+    static AudioRecordRing ring;
+    ring.preroll(4);
+    for (int n = 0; n < 10; n++) {
+        audio_block_t *block = AudioStream::allocate();
+        block->data[0] = n;
+        ring.input = block;
+        ring.update();
+    }
+    // Only the newest pre-roll blocks are kept, then everything after hold() is too
+    TEST_ASSERT_EQUAL_UINT32(4, ring.hold());
+    TEST_ASSERT_EQUAL_INT16(6, ring.peek(0)[0]);
+    ring.begin(NULL, 1);
+    audio_block_t *block = AudioStream::allocate();
+    block->data[0] = 10;
+    ring.input = block;
+    ring.update();
+    TEST_ASSERT_EQUAL_UINT32(5, ring.available());
+    TEST_ASSERT_EQUAL_INT16(10, ring.peek(4)[0]);
+    ring.end();
+    ring.clear();
+    TEST_ASSERT_EQUAL_INT(0, AudioStream::live_blocks.load());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_pointer_ring);
+    RUN_TEST(test_elastic_ring);
+    RUN_TEST(test_elastic_ring_without_psram);
+    RUN_TEST(test_preroll_hold);
+    return UNITY_END();
+}
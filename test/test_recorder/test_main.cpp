@@ -0,0 +1,193 @@
+/**
+ * Recorder: voice detection and the silence trim, with the audio fed through the ring as the audio interrupt does,
+ * including blocks that arrive while the writer is part way through a slow SD write.
+ */
+#include "ima_adpcm.h"
+#include "recorder.h"
+#include "wav_header.h"
+#include <math.h>
+#include <unity.h>
+
+#define BLOCKS_PER_SECOND (RECORDER_SAMPLE_RATE / AUDIO_BLOCK_SAMPLES)
+#define STALL_BLOCKS 40 // More than a whole write's worth arrive during the slow write
+
+typedef WavHeader<1, RECORDER_SAMPLE_RATE, 16> test_wav_t;
+static const recorder_format_t test_format = {test_wav_t::header_bytes, test_wav_t::sample_rate, test_wav_t::byte_rate,
+                                              test_wav_t::samples_per_block, "wav", test_wav_t::build,
+                                              NULL, NULL, NULL, NULL};
+// As main.cpp does for RECORDER_FORMAT_IMA_ADPCM
+typedef WavHeader<1, RECORDER_SAMPLE_RATE, 4, WAV_FORMAT_IMA_ADPCM> adpcm_wav_t;
+static ima_adpcm_encoder_t adpcm_encoder;
+static void adpcm_reset(void) { ima_adpcm_init(&adpcm_encoder); }
+static size_t adpcm_encode(const int16_t *pcm, uint32_t samples, uint8_t *out) {
+    return ima_adpcm_encode(&adpcm_encoder, pcm, samples, out);
+}
+static size_t adpcm_flush(uint8_t *out) { return ima_adpcm_flush(&adpcm_encoder, out); }
+static const recorder_format_t adpcm_format = {adpcm_wav_t::header_bytes, adpcm_wav_t::sample_rate,
+                                               adpcm_wav_t::byte_rate, adpcm_wav_t::samples_per_block, "wav",
+                                               adpcm_wav_t::build, adpcm_reset, adpcm_encode, adpcm_flush, NULL};
+static AudioRecordRing ring;
+static FsFile file;
+static uint32_t blocks_fed;
+static uint32_t stall_at_write; // Write (counting from 1) that stalls, 0 for none
+static uint32_t writes;
+static bool stalled;
+
+void setUp(void) {
+    file = FsFile();
+    blocks_fed = 0;
+    writes = 0;
+    stall_at_write = 0;
+    stalled = false;
+    sd_write_hook = NULL;
+}
+void tearDown(void) { sd_write_hook = NULL; }
+
+/**
+ * @brief Capture one block, voiced (syllables of 150Hz harmonics, well above the noise) or background noise.
+ */
+static void feed(bool voice) {
+    audio_block_t *block = AudioStream::allocate();
+    for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        uint32_t n = blocks_fed * AUDIO_BLOCK_SAMPLES + i;
+        double value = (rand() % 21) - 10;
+        if (voice) {
+            // Syllables, 4 a second
+            double envelope = 0.5 - 0.5 * cos(2 * M_PI * 4 * n / RECORDER_SAMPLE_RATE);
+            for (int h = 1; h <= 5; h++) {
+                value += envelope * 4000.0 / h * sin(2 * M_PI * 150 * h * n / RECORDER_SAMPLE_RATE);
+            }
+        }
+        block->data[i] = (int16_t)value;
+    }
+    blocks_fed++;
+    ring.input = block;
+    ring.update();
+}
+
+static void feed_seconds(bool voice, uint32_t seconds) {
+    for (uint32_t n = 0; n < seconds * BLOCKS_PER_SECOND; n++) {
+        feed(voice);
+    }
+}
+
+/**
+ * @brief SD write hook: the chosen write is slow enough for STALL_BLOCKS of voice to be captured during it.
+ */
+static void stall(FsFile *f, uint64_t position, size_t length) {
+    (void)f;
+    (void)length;
+    if (position == 0 || ++writes != stall_at_write || stalled) {
+        return;
+    }
+    stalled = true;
+    for (int n = 0; n < STALL_BLOCKS; n++) {
+        feed(true);
+    }
+}
+
+void test_voice_detection_survives_stall(void) {
+    recorder_begin(&file, &test_format);
+    sd_write_hook = stall;
+    stall_at_write = 3;
+
+    feed_seconds(true, 3); // The stall happens in here
+    TEST_ASSERT_TRUE(stalled);
+    feed_seconds(true, 2);
+    uint32_t voice_end_blocks = blocks_fed;
+    feed_seconds(false, 8);
+
+    // Still listening after the stall: 8s of silence less the hangover (and what is still waiting in the ring)
+    uint32_t silent_ms = recorder_silent_ms();
+    TEST_ASSERT_GREATER_THAN(8000 - VAD_HANGOVER_MS - 1100, silent_ms);
+    TEST_ASSERT_LESS_OR_EQUAL(8000 - VAD_HANGOVER_MS, silent_ms);
+
+    recorder_end();
+    const recorder_stats_t *stats = recorder_stats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats->dropped_blocks);
+    // The trim keeps all the voice (and its hangover), to the end of the write it ended in
+    uint32_t voice_samples = voice_end_blocks * AUDIO_BLOCK_SAMPLES + VAD_HANGOVER_MS * RECORDER_SAMPLE_RATE / 1000;
+    TEST_ASSERT_GREATER_OR_EQUAL(voice_samples, stats->samples);
+    TEST_ASSERT_LESS_THAN(voice_samples + RECORDER_WRITE_BLOCKS * AUDIO_BLOCK_SAMPLES, stats->samples);
+    TEST_ASSERT_EQUAL_UINT32(blocks_fed * AUDIO_BLOCK_SAMPLES, stats->samples + stats->trimmed_samples);
+    TEST_ASSERT_EQUAL_UINT32(stats->samples * 2, recorder_bytes_saved());
+}
+
+void test_silence_timeout_after_repeated_stalls(void) {
+    recorder_begin(&file, &test_format);
+    sd_write_hook = stall;
+    for (uint32_t i = 0; i < 5; i++) {
+        stall_at_write = writes + 2;
+        stalled = false;
+        feed_seconds(true, 1);
+        feed_seconds(false, 1);
+    }
+    feed_seconds(false, VAD_SILENCE_SECONDS + 1);
+    TEST_ASSERT_GREATER_OR_EQUAL(VAD_SILENCE_SECONDS * 1000, recorder_silent_ms());
+    recorder_end();
+}
+
+void test_prompt_bleed_is_not_voice(void) {
+    // The prompt picked up by the microphone fills the pre-roll, then the guest says nothing
+    recorder_preroll();
+    feed_seconds(true, 1);
+    recorder_hold();
+    recorder_begin(&file, &test_format);
+    feed_seconds(false, 3);
+    TEST_ASSERT_GREATER_THAN(3000 - 1100, recorder_silent_ms());
+
+    // A silent call, kept whole
+    recorder_end();
+    const recorder_stats_t *stats = recorder_stats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats->trimmed_samples);
+    TEST_ASSERT_GREATER_THAN(3 * RECORDER_SAMPLE_RATE, stats->samples);
+}
+
+void test_adpcm_trim_keeps_block_with_last_voice(void) {
+    recorder_begin(&file, &adpcm_format);
+    feed_seconds(true, 2);
+    // End the voice part way through an ADPCM block, whatever the hangover
+    while ((blocks_fed * AUDIO_BLOCK_SAMPLES + VAD_HANGOVER_MS * RECORDER_SAMPLE_RATE / 1000) %
+               IMA_ADPCM_SAMPLES_PER_BLOCK < IMA_ADPCM_SAMPLES_PER_BLOCK - AUDIO_BLOCK_SAMPLES) {
+        feed(true);
+    }
+    uint32_t voice_samples = blocks_fed * AUDIO_BLOCK_SAMPLES + VAD_HANGOVER_MS * RECORDER_SAMPLE_RATE / 1000;
+    feed_seconds(false, 4);
+    recorder_end();
+
+    // Cut at the end of the ADPCM block holding the last voice, and the counts are exact
+    const recorder_stats_t *stats = recorder_stats();
+    TEST_ASSERT_GREATER_OR_EQUAL(voice_samples, stats->samples);
+    TEST_ASSERT_LESS_THAN(voice_samples + IMA_ADPCM_SAMPLES_PER_BLOCK, stats->samples);
+    TEST_ASSERT_EQUAL_UINT32(0, stats->samples % IMA_ADPCM_SAMPLES_PER_BLOCK);
+    TEST_ASSERT_EQUAL_UINT32(blocks_fed * AUDIO_BLOCK_SAMPLES, stats->samples + stats->trimmed_samples);
+    TEST_ASSERT_EQUAL_UINT32(stats->samples / IMA_ADPCM_SAMPLES_PER_BLOCK * IMA_ADPCM_BLOCK_BYTES,
+                             recorder_bytes_saved());
+}
+
+void test_adpcm_voice_to_the_end(void) {
+    // No silence to trim, the short last block is kept
+    recorder_begin(&file, &adpcm_format);
+    feed_seconds(true, 3);
+    recorder_end();
+    const recorder_stats_t *stats = recorder_stats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats->trimmed_samples);
+    TEST_ASSERT_EQUAL_UINT32(blocks_fed * AUDIO_BLOCK_SAMPLES, stats->samples);
+    uint32_t short_block = stats->samples % IMA_ADPCM_SAMPLES_PER_BLOCK;
+    TEST_ASSERT_EQUAL_UINT32(stats->samples / IMA_ADPCM_SAMPLES_PER_BLOCK * IMA_ADPCM_BLOCK_BYTES +
+                                 (short_block > 0 ? 4 + short_block / 2 : 0),
+                             recorder_bytes_saved());
+}
+
+int main(int argc, char **argv) {
+    srand(1);
+    recorder_init(&ring);
+    recorder_set_checkpoint_interval(0);
+    UNITY_BEGIN();
+    RUN_TEST(test_voice_detection_survives_stall);
+    RUN_TEST(test_silence_timeout_after_repeated_stalls);
+    RUN_TEST(test_prompt_bleed_is_not_voice);
+    RUN_TEST(test_adpcm_trim_keeps_block_with_last_voice);
+    RUN_TEST(test_adpcm_voice_to_the_end);
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+/**
+ * Boot time recovery of recordings, on files built the way the recorder and the original firmware leave them.
+ */
+#include "flac_encoder.h"
+#include "recording_recovery.h"
+#include "wav_header.h"
+#include <unity.h>
+
+typedef WavHeader<1, 16000, 16> test_wav_t;
+
+static uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+void setUp(void) { recovery_begin(); }
+void tearDown(void) {}
+
+/**
+ * @brief A PCM recording of 'data_bytes' with the header last checkpointed at 'header_bytes', in a file of 'size'.
+ */
+static void make_wav(FsFile *file, uint32_t header_bytes, uint32_t data_bytes, uint32_t size) {
+    *file = FsFile();
+    file->data.assign(size, 0x5a); // Stale sectors
+    test_wav_t::build(file->data.data(), header_bytes);
+    for (uint32_t i = 0; i < data_bytes; i++) {
+        file->data[test_wav_t::header_bytes + i] = i * 7;
+    }
+}
+
+void test_finalised_wav_untouched(void) {
+    static FsFile file;
+    make_wav(&file, 8192, 8192, 512 + 8192);
+    TEST_ASSERT_FALSE(recovery_visit(&file));
+    TEST_ASSERT_EQUAL_UINT32(512 + 8192, file.fileSize());
+    TEST_ASSERT_EQUAL_UINT32(0, recovery_repaired());
+}
+
+void test_preallocated_wav_cut_to_checkpoint(void) {
+    static FsFile file;
+    // Checkpointed at 16KB, 24KB written, in a 1MB extent (FAT32 reports the whole extent as the size)
+    make_wav(&file, 16384, 24576, 1 << 20);
+    TEST_ASSERT_TRUE(recovery_visit(&file));
+    TEST_ASSERT_EQUAL_UINT32(512 + 16384, file.fileSize());
+    TEST_ASSERT_EQUAL_UINT32(16384, get_le32(file.data.data() + 508));
+    TEST_ASSERT_EQUAL_UINT32(512 - 8 + 16384, get_le32(file.data.data() + 4));
+    TEST_ASSERT_EQUAL_UINT32(1, recovery_repaired());
+}
+
+void test_unfinalised_wav_header_repaired(void) {
+    static FsFile file;
+    // Never checkpointed, only the empty header it started with is known good
+    make_wav(&file, 0, 8192, 512 + 8192);
+    TEST_ASSERT_TRUE(recovery_visit(&file));
+    TEST_ASSERT_EQUAL_UINT32(512, file.fileSize());
+    TEST_ASSERT_EQUAL_UINT32(0, get_le32(file.data.data() + 508));
+}
+
+void test_legacy_wav_untouched(void) {
+    static FsFile file;
+    // The original firmware wrote the 44 byte header over the start of the audio, data size = file size - 42
+    uint32_t size = 44 + 32000;
+    file = FsFile();
+    file.data.assign(size, 0);
+    test_wav_t::build(file.data.data(), 0);
+    uint8_t *h = file.data.data();
+    memcpy(h + 36, "data", 4);
+    uint32_t data = size - 42, riff = data + 34;
+    for (int i = 0; i < 4; i++) {
+        h[40 + i] = data >> (8 * i);
+        h[4 + i] = riff >> (8 * i);
+    }
+    std::vector<uint8_t> before = file.data;
+    TEST_ASSERT_FALSE(recovery_visit(&file));
+    TEST_ASSERT_TRUE(before == file.data);
+    TEST_ASSERT_EQUAL_UINT32(0, recovery_repaired());
+    TEST_ASSERT_EQUAL_UINT32(0, recovery_unrepairable());
+}
+
+/**
+ * @brief A FLAC recording of 'frames' frames with STREAMINFO checkpointed after 'checkpoint_frames' of them.
+ *
+ * @return Offset just past frame 'checkpoint_frames' - 1.
+ */
+static uint32_t make_flac(FsFile *file, uint32_t frames, uint32_t checkpoint_frames, uint32_t size) {
+    static uint8_t out[FLAC_MAX_FRAME_BYTES];
+    static int16_t pcm[FLAC_BLOCK_SAMPLES];
+    flac_encoder_t encoder;
+    uint32_t checkpoint_end = FLAC_HEADER_BYTES;
+    uint8_t sector[FLAC_HEADER_BYTES];
+
+    *file = FsFile();
+    flac_init(&encoder, 16000);
+    file->data.assign(FLAC_HEADER_BYTES, 0);
+    for (uint32_t n = 0; n < frames; n++) {
+        for (int i = 0; i < FLAC_BLOCK_SAMPLES; i++) {
+            pcm[i] = (int16_t)(8000 * sin((n * FLAC_BLOCK_SAMPLES + i) * 0.05) + (rand() % 200));
+        }
+        size_t bytes = flac_encode(&encoder, pcm, FLAC_BLOCK_SAMPLES, out);
+        file->data.insert(file->data.end(), out, out + bytes);
+        if (n + 1 == checkpoint_frames) {
+            flac_build_header(&encoder, sector, NULL);
+            memcpy(file->data.data(), sector, sizeof sector);
+            checkpoint_end = file->data.size();
+        }
+    }
+    if (checkpoint_frames == 0) {
+        flac_init(&encoder, 16000);
+        flac_build_header(&encoder, sector, NULL);
+        memcpy(file->data.data(), sector, sizeof sector);
+    }
+    // The rest of the extent, a stale recording's frames would look much the same
+    while (file->data.size() < size) {
+        file->data.push_back(rand());
+    }
+    return checkpoint_end;
+}
+
+void test_comment_chunk_sizes(void) {
+    static const char *const comments[] = {"odd", "even"}; // 4 and 5 bytes with the nul
+    for (const char *comment : comments) {
+        uint8_t sector[WAV_HEADER_SECTOR_BYTES];
+        uint32_t text_bytes = strlen(comment) + 1;
+        test_wav_t::build(sector, 0, comment);
+
+        // ICMT is the text without the pad byte, LIST covers the pad, and walking the chunks lands on "data"
+        TEST_ASSERT_EQUAL_MEMORY("LIST", sector + 36, 4);
+        TEST_ASSERT_EQUAL_UINT32(4 + 8 + text_bytes + (text_bytes & 1), get_le32(sector + 40));
+        TEST_ASSERT_EQUAL_MEMORY("ICMT", sector + 48, 4);
+        TEST_ASSERT_EQUAL_UINT32(text_bytes, get_le32(sector + 52));
+        TEST_ASSERT_EQUAL_STRING(comment, (const char *)sector + 56);
+        uint32_t pos = 12;
+        while (pos < WAV_HEADER_SECTOR_BYTES - 8 && memcmp(sector + pos, "data", 4) != 0) {
+            uint32_t size = get_le32(sector + pos + 4);
+            pos += 8 + size + (size & 1);
+        }
+        TEST_ASSERT_EQUAL_UINT32(WAV_HEADER_SECTOR_BYTES - 8, pos);
+    }
+}
+
+void test_finalised_flac_untouched(void) {
+    static FsFile file;
+    uint32_t end = make_flac(&file, 100, 100, 0);
+    TEST_ASSERT_FALSE(recovery_visit(&file));
+    TEST_ASSERT_EQUAL_UINT32(end, file.fileSize());
+}
+
+void test_preallocated_flac_cut_to_checkpoint(void) {
+    static FsFile file;
+    uint32_t end = make_flac(&file, 700, 625, 1 << 20);
+    TEST_ASSERT_TRUE(recovery_visit(&file));
+    TEST_ASSERT_EQUAL_UINT32(end, file.fileSize());
+    TEST_ASSERT_EQUAL_UINT32(1, recovery_repaired());
+}
+
+void test_unfinalised_flac_without_checkpoint(void) {
+    static FsFile file;
+    make_flac(&file, 50, 0, 1 << 16);
+    TEST_ASSERT_TRUE(recovery_visit(&file));
+    TEST_ASSERT_EQUAL_UINT32(FLAC_HEADER_BYTES, file.fileSize());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_finalised_wav_untouched);
+    RUN_TEST(test_preallocated_wav_cut_to_checkpoint);
+    RUN_TEST(test_unfinalised_wav_header_repaired);
+    RUN_TEST(test_legacy_wav_untouched);
+    RUN_TEST(test_comment_chunk_sizes);
+    RUN_TEST(test_finalised_flac_untouched);
+    RUN_TEST(test_preallocated_flac_cut_to_checkpoint);
+    RUN_TEST(test_unfinalised_flac_without_checkpoint);
+    return UNITY_END();
+}
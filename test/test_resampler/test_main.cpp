@@ -0,0 +1,211 @@
+/**
+ * The resampler's three interpolators against an ideal reference: the input is a tone sampled at the input rate, and
+ * the reference output is the same tone worked out exactly at each output sample's time, which is what a perfect
+ * band limited resampler would give (all three line the first output sample up with the first input sample).
+ *
+ * Accuracy is the SNR against the reference, the frequency response the gain against it across the input's band,
+ * and the polyphase filter's stop band is checked by what aliases back in when 48kHz is brought down to 44.1kHz.
+ */
+#include "resampler.h"
+#include <unity.h>
+#include <vector>
+
+#define TEST_SECONDS 0.5
+#define EDGE_SAMPLES 64 // Left out of each measurement at both ends, where the filter runs off the tone
+#define AMPLITUDE 16000.0
+
+static const uint8_t modes[] = {RESAMPLER_LINEAR, RESAMPLER_CUBIC, RESAMPLER_POLYPHASE};
+static const char *const mode_names[] = {"", "linear", "cubic", "polyphase"};
+
+void setUp(void) { resampler_design(); }
+void tearDown(void) {}
+
+/**
+ * @brief Convert 'left' (and 'right' for stereo) from 'in_rate' to 'out_rate', all of it including the filter's
+ * tail, as AudioPlaySdWavX does.
+ */
+static void resample(uint8_t mode, uint32_t in_rate, uint32_t out_rate, const std::vector<int16_t> &left,
+                     const std::vector<int16_t> *right, std::vector<int16_t> *out_left, std::vector<int16_t> *out_right) {
+    resampler_t resampler;
+    TEST_ASSERT_TRUE(resampler_init(&resampler, in_rate, out_rate, right ? 2 : 1, mode));
+
+    uint32_t tail = resampler.delay;
+    size_t in = 0;
+    out_left->clear();
+    if (out_right) {
+        out_right->clear();
+    }
+    while (true) {
+        while (resampler_ready(&resampler)) {
+            int16_t l, r = 0;
+            resampler_output(&resampler, &l, &r);
+            out_left->push_back(l);
+            if (out_right) {
+                out_right->push_back(r);
+            }
+        }
+        if (in < left.size()) {
+            resampler_push(&resampler, left[in], right ? (*right)[in] : 0);
+            in++;
+        } else if (tail > 0) {
+            resampler_push(&resampler, 0, 0);
+            tail--;
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 'samples' of a tone of 'frequency' Hz at 'rate'.
+ */
+static std::vector<int16_t> tone(double frequency, uint32_t rate, size_t samples) {
+    std::vector<int16_t> out(samples);
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = (int16_t)lround(AMPLITUDE * sin(2.0 * M_PI * frequency * i / rate));
+    }
+    return out;
+}
+
+/**
+ * @brief Compare 'out' with the exact tone of 'frequency' Hz at 'out_rate', away from the ends ('in_samples' long at
+ * 'in_rate').  Gives the gain (the part of 'out' that is the tone) and the SNR in dB.
+ */
+static void measure(const std::vector<int16_t> &out, double frequency, uint32_t in_rate, uint32_t out_rate,
+                    size_t in_samples, double *gain, double *snr) {
+    size_t end = (size_t)((double)in_samples * out_rate / in_rate);
+    double reference_energy = 0.0;
+    double projection = 0.0;
+    double error_energy = 0.0;
+
+    TEST_ASSERT_GREATER_OR_EQUAL(end, out.size());
+    for (size_t i = EDGE_SAMPLES; i < end - EDGE_SAMPLES; i++) {
+        double reference = AMPLITUDE * sin(2.0 * M_PI * frequency * i / out_rate);
+        reference_energy += reference * reference;
+        projection += out[i] * reference;
+        error_energy += (out[i] - reference) * (out[i] - reference);
+    }
+    *gain = projection / reference_energy;
+    *snr = 10.0 * log10(reference_energy / error_energy);
+}
+
+/**
+ * @brief SNR of a 1kHz tone brought up from 16kHz (a recording) and from 22.05kHz (a prompt) with 'mode'.
+ */
+static void check_accuracy(uint8_t mode, double min_snr) {
+    static const uint32_t rates[] = {16000, 22050};
+
+    for (uint32_t rate : rates) {
+        std::vector<int16_t> in = tone(1000.0, rate, (size_t)(TEST_SECONDS * rate));
+        std::vector<int16_t> out;
+        double gain, snr;
+
+        resample(mode, rate, 44100, in, NULL, &out, NULL);
+        measure(out, 1000.0, rate, 44100, in.size(), &gain, &snr);
+        printf("%s %lu to 44100, 1kHz: SNR %.1f dB\n", mode_names[mode], (unsigned long)rate, snr);
+        TEST_ASSERT_GREATER_THAN(min_snr, snr);
+    }
+}
+
+void test_linear_accuracy(void) { check_accuracy(RESAMPLER_LINEAR, 35.0); }
+
+void test_cubic_accuracy(void) { check_accuracy(RESAMPLER_CUBIC, 50.0); }
+
+void test_polyphase_accuracy(void) { check_accuracy(RESAMPLER_POLYPHASE, 60.0); }
+
+void test_same_rate_passes_straight_through(void) {
+    std::vector<int16_t> in = tone(1000.0, 44100, 4410);
+    std::vector<int16_t> out;
+
+    resample(RESAMPLER_POLYPHASE, 44100, 44100, in, NULL, &out, NULL);
+    TEST_ASSERT_EQUAL_UINT32(in.size(), out.size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(in.data(), out.data(), in.size());
+}
+
+void test_frequency_response(void) {
+    static const uint32_t rates[] = {8000, 16000, 22050, 32000, 48000};
+    static const double fractions[] = {0.05, 0.1, 0.15, 0.2, 0.25, 0.3, 0.35};
+
+    for (uint32_t rate : rates) {
+        for (uint8_t mode : modes) {
+            printf("%s %lu to 44100, dB at", mode_names[mode], (unsigned long)rate);
+            double previous = 1.0;
+            for (double fraction : fractions) {
+                double frequency = fraction * rate;
+                std::vector<int16_t> in = tone(frequency, rate, (size_t)(TEST_SECONDS * rate));
+                std::vector<int16_t> out;
+                double gain, snr;
+
+                resample(mode, rate, 44100, in, NULL, &out, NULL);
+                measure(out, frequency, rate, 44100, in.size(), &gain, &snr);
+                printf(" %.2ffs %+.2f", fraction, 20.0 * log10(gain));
+
+                if (mode == RESAMPLER_POLYPHASE) {
+                    // Flat to within 0.1dB up to 0.3 of the input rate, 60% of its band
+                    if (fraction <= 0.3) {
+                        TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, 20.0 * log10(gain));
+                    }
+                } else {
+                    // Linear and cubic roll off steadily, and never gain
+                    TEST_ASSERT_LESS_OR_EQUAL(previous + 0.001, gain);
+                    previous = gain;
+                }
+            }
+            printf("\n");
+        }
+    }
+}
+
+void test_polyphase_rejects_aliases(void) {
+    // 23kHz at 48kHz is above the 22.05kHz a 44.1kHz output can hold, it can only alias back in at 21.1kHz
+    const double frequency = 23000.0;
+    std::vector<int16_t> in = tone(frequency, 48000, (size_t)(TEST_SECONDS * 48000));
+
+    for (uint8_t mode : modes) {
+        std::vector<int16_t> out;
+        double energy = 0.0;
+
+        resample(mode, 48000, 44100, in, NULL, &out, NULL);
+        for (size_t i = EDGE_SAMPLES; i < out.size() - EDGE_SAMPLES; i++) {
+            energy += (double)out[i] * out[i];
+        }
+        double level = 10.0 * log10(energy / (out.size() - 2 * EDGE_SAMPLES) / (AMPLITUDE * AMPLITUDE / 2));
+        printf("%s 48000 to 44100, 23kHz comes out at %.1f dB\n", mode_names[mode], level);
+        if (mode == RESAMPLER_POLYPHASE) {
+            TEST_ASSERT_LESS_THAN(-50.0, level);
+        }
+    }
+}
+
+void test_stereo_channels_kept_apart(void) {
+    std::vector<int16_t> left = tone(1000.0, 32000, (size_t)(TEST_SECONDS * 32000));
+    std::vector<int16_t> right = tone(2500.0, 32000, (size_t)(TEST_SECONDS * 32000));
+
+    for (uint8_t mode : modes) {
+        std::vector<int16_t> out_left, out_right, mono;
+        double gain, snr;
+
+        resample(mode, 32000, 44100, left, &right, &out_left, &out_right);
+        measure(out_left, 1000.0, 32000, 44100, left.size(), &gain, &snr);
+        TEST_ASSERT_GREATER_THAN(30.0, snr);
+        measure(out_right, 2500.0, 32000, 44100, right.size(), &gain, &snr);
+        TEST_ASSERT_GREATER_THAN(30.0, snr);
+
+        // Each channel of a stereo file comes out the same as it would on its own
+        resample(mode, 32000, 44100, right, NULL, &mono, NULL);
+        TEST_ASSERT_EQUAL_UINT32(mono.size(), out_right.size());
+        TEST_ASSERT_EQUAL_INT16_ARRAY(mono.data(), out_right.data(), mono.size());
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_linear_accuracy);
+    RUN_TEST(test_cubic_accuracy);
+    RUN_TEST(test_polyphase_accuracy);
+    RUN_TEST(test_same_rate_passes_straight_through);
+    RUN_TEST(test_frequency_response);
+    RUN_TEST(test_polyphase_rejects_aliases);
+    RUN_TEST(test_stereo_channels_kept_apart);
+    return UNITY_END();
+}
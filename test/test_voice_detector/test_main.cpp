@@ -0,0 +1,174 @@
+/**
+ * Voice activity detector against a corpus of synthesised recordings: voiced speech at different levels, fricatives,
+ * speech in noise, and the backgrounds it must not mistake for voice (hiss, hum, a room getting louder).
+ */
+#include "voice_detector.h"
+#include <math.h>
+#include <unity.h>
+
+#define RATE 16000
+#define BLOCK 256
+#define BLOCKS_PER_SECOND (RATE / BLOCK)
+
+static voice_detector_t vad;
+static uint32_t n; // Sample clock of the corpus
+static double hum_phase;
+
+void setUp(void) {
+    vad_init(&vad, RATE);
+    n = 0;
+    srand(1);
+}
+void tearDown(void) {}
+
+static double noise(void) { return (rand() / (double)RAND_MAX) * 2 - 1; }
+
+static double dbfs(double db) { return 32767 * pow(10, db / 20); }
+
+typedef enum { SILENCE, VOWEL, FRICATIVE, HUM } sound_t;
+
+/**
+ * @brief Synthesise 'seconds' of 'sound' at 'level_db' over white noise at 'noise_db', return the fraction of blocks
+ * that counted as voice (hangover included), as the recorder sees it.
+ */
+static double play(sound_t sound, double level_db, double noise_db, double seconds) {
+    int16_t block[BLOCK];
+    uint32_t blocks = seconds * BLOCKS_PER_SECOND;
+    uint32_t voiced = 0;
+    double previous = 0;
+
+    for (uint32_t b = 0; b < blocks; b++) {
+        for (int i = 0; i < BLOCK; i++, n++) {
+            double t = (double)n / RATE;
+            double value = 0;
+            switch (sound) {
+            case VOWEL: {
+                // Glottal harmonics with a wandering pitch, a formant-ish tilt and a syllable envelope
+                double pitch = 110 + 40 * sin(2 * M_PI * 2.5 * t);
+                for (int h = 1; h <= 12; h++) {
+                    value += sin(2 * M_PI * pitch * h * t) * ((h >= 3 && h <= 5) ? 0.6 : 0.25 / h);
+                }
+                value *= 0.6 + 0.4 * sin(2 * M_PI * 4 * t);
+                break;
+            }
+            case FRICATIVE: {
+                // "sss": white noise through a first difference, most of the energy above 3kHz
+                double x = noise();
+                value = (x - previous) * 0.5;
+                previous = x;
+                break;
+            }
+            case HUM:
+                hum_phase += 2 * M_PI * 50 / RATE;
+                value = sin(hum_phase) + 0.3 * sin(3 * hum_phase);
+                break;
+            default:
+                break;
+            }
+            double sample = value * dbfs(level_db) + noise() * dbfs(noise_db);
+            block[i] = (int16_t)fmax(-32768, fmin(32767, sample));
+        }
+        vad_block(&vad, block, BLOCK);
+        if (vad_silent_samples(&vad) == 0) {
+            voiced++;
+        }
+    }
+    return (double)voiced / blocks;
+}
+
+void test_vowels_at_speaking_levels(void) {
+    const double levels[] = {-30, -20, -12, -6}; // Quiet talker to shouting
+    for (double level : levels) {
+        setUp();
+        play(SILENCE, 0, -60, 1);
+        double voiced = play(VOWEL, level, -60, 3);
+        printf("vowels at %.0fdBFS: %.0f%% voice\n", level, voiced * 100);
+        TEST_ASSERT_GREATER_THAN(0.95, voiced);
+    }
+}
+
+void test_quiet_fricatives(void) {
+    // Much less energy than vowels, found by their zero crossings
+    play(SILENCE, 0, -60, 1);
+    double voiced = play(FRICATIVE, -40, -60, 1);
+    printf("fricatives at -40dBFS: %.0f%% voice\n", voiced * 100);
+    TEST_ASSERT_GREATER_THAN(0.9, voiced);
+}
+
+void test_backgrounds_are_not_voice(void) {
+    const double levels[] = {-70, -50, -40, -30};
+    for (double level : levels) {
+        setUp();
+        play(SILENCE, 0, level, VAD_NOISE_WINDOW_MS / 1000.0 + 0.5); // Learn it
+        double voiced = play(SILENCE, 0, level, 5);
+        printf("hiss at %.0fdBFS: %.0f%% voice\n", level, voiced * 100);
+        TEST_ASSERT_LESS_THAN(0.02, voiced);
+    }
+
+    setUp();
+    play(HUM, -30, -70, VAD_NOISE_WINDOW_MS / 1000.0 + 0.5);
+    double voiced = play(HUM, -30, -70, 5);
+    printf("hum at -30dBFS: %.0f%% voice\n", voiced * 100);
+    TEST_ASSERT_LESS_THAN(0.02, voiced);
+}
+
+void test_room_gets_louder(void) {
+    // Quiet room, then a fan comes on 20dB louder: learnt within the noise window
+    play(SILENCE, 0, -60, 2);
+    play(SILENCE, 0, -40, VAD_NOISE_WINDOW_MS / 1000.0 + 0.5);
+    double voiced = play(SILENCE, 0, -40, 5);
+    printf("after a 20dB step in the noise: %.0f%% voice\n", voiced * 100);
+    TEST_ASSERT_LESS_THAN(0.02, voiced);
+}
+
+void test_speech_in_noise(void) {
+    play(SILENCE, 0, -40, 2);
+    double voiced = play(VOWEL, -24, -40, 3); // ~+12dB SNR
+    printf("vowels at +12dB SNR: %.0f%% voice\n", voiced * 100);
+    TEST_ASSERT_GREATER_THAN(0.9, voiced);
+}
+
+void test_words_and_pauses_in_noise(void) {
+    // Talking, thinking for a few seconds (long enough for the noise to be relearnt), talking again
+    play(SILENCE, 0, -45, 2);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_GREATER_THAN(0.95, play(VOWEL, -25, -45, 1.5));
+        TEST_ASSERT_GREATER_THAN(0.8, 1 - play(SILENCE, 0, -45, 3));
+        TEST_ASSERT_GREATER_THAN(0.95, play(FRICATIVE, -35, -45, 0.3));
+    }
+}
+
+void test_long_message_not_learnt_as_background(void) {
+    play(SILENCE, 0, -60, 1);
+    play(VOWEL, -20, -60, 60);
+    double voiced = play(VOWEL, -20, -60, 5);
+    TEST_ASSERT_GREATER_THAN(0.95, voiced);
+}
+
+void test_hangover_and_silence(void) {
+    play(SILENCE, 0, -60, 1);
+    TEST_ASSERT_FALSE(vad_heard_voice(&vad));
+    play(VOWEL, -20, -60, 2);
+    uint32_t voice_end = n;
+    play(SILENCE, 0, -60, 3);
+
+    // Voice lasts to the end of the last voiced block plus the hangover, then it is silence
+    TEST_ASSERT_TRUE(vad_heard_voice(&vad));
+    uint32_t hangover = VAD_HANGOVER_MS * RATE / 1000;
+    TEST_ASSERT_GREATER_OR_EQUAL(voice_end + hangover - 2 * BLOCK, vad.last_voice_samples);
+    TEST_ASSERT_LESS_OR_EQUAL(voice_end + hangover + BLOCK, vad.last_voice_samples);
+    TEST_ASSERT_EQUAL_UINT32(n - vad.last_voice_samples, vad_silent_samples(&vad));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_vowels_at_speaking_levels);
+    RUN_TEST(test_quiet_fricatives);
+    RUN_TEST(test_backgrounds_are_not_voice);
+    RUN_TEST(test_room_gets_louder);
+    RUN_TEST(test_speech_in_noise);
+    RUN_TEST(test_words_and_pauses_in_noise);
+    RUN_TEST(test_long_message_not_learnt_as_background);
+    RUN_TEST(test_hangover_and_silence);
+    return UNITY_END();
+}